@@ -0,0 +1,112 @@
+/**
+ * \author Yongkai Zhang
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "checkpoint.h"
+
+/* FNV-1a over the slot order, so a reordered or edited sensor map is never restored. */
+static uint64_t map_hash(const sensor_table_t *table)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (size_t slot = 0; slot < table->count; slot++) {
+        uint32_t pair = ((uint32_t)table->sensor_ids[slot] << 16) | table->room_ids[slot];
+
+        for (int shift = 0; shift < 32; shift += 8) {
+            hash ^= (pair >> shift) & 0xff;
+            hash *= 1099511628211ULL;
+        }
+    }
+    return hash;
+}
+
+static bool header_matches(const checkpoint_header_t *header, const sensor_table_t *table, uint64_t hash)
+{
+    return memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) == 0 &&
+           header->version == CHECKPOINT_VERSION &&
+           header->header_size == sizeof(checkpoint_header_t) &&
+           header->capacity == table->capacity &&
+           header->window == table->window &&
+           header->count == table->count &&
+           header->arena_size == table->arena_size &&
+           header->map_hash == hash;
+}
+
+int checkpoint_open(checkpoint_t *checkpoint, const char *path, sensor_table_t *table, time_t now, time_t max_age,
+                    bool *restored, time_t *saved_at)
+{
+    uint64_t hash = map_hash(table);
+    struct stat info;
+    void *mapping;
+    bool restore;
+
+    checkpoint->fd = -1;
+    checkpoint->header = NULL;
+    checkpoint->size = sizeof(checkpoint_header_t) + table->arena_size;
+    *restored = false;
+    *saved_at = 0;
+
+    checkpoint->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (checkpoint->fd < 0) return -1;
+    if (fstat(checkpoint->fd, &info) != 0) goto checkpoint_error;
+    restore = (size_t)info.st_size == checkpoint->size;
+    if (!restore && ftruncate(checkpoint->fd, (off_t)checkpoint->size) != 0) goto checkpoint_error;
+
+    mapping = mmap(NULL, checkpoint->size, PROT_READ | PROT_WRITE, MAP_SHARED, checkpoint->fd, 0);
+    if (mapping == MAP_FAILED) goto checkpoint_error;
+    checkpoint->header = mapping;
+    restore = restore && header_matches(checkpoint->header, table, hash);
+    if (restore) {
+        *saved_at = (time_t)checkpoint->header->saved_at;
+        /* Averages and alert states from long ago would drive alerts without fresh data. */
+        restore = max_age <= 0 || now - *saved_at <= max_age;
+    }
+
+    if (!restore) {
+        memset(checkpoint->header, 0, sizeof(*checkpoint->header));
+        memcpy(checkpoint->header->magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+        checkpoint->header->version = CHECKPOINT_VERSION;
+        checkpoint->header->header_size = sizeof(checkpoint_header_t);
+        checkpoint->header->capacity = table->capacity;
+        checkpoint->header->window = table->window;
+        checkpoint->header->count = table->count;
+        checkpoint->header->arena_size = table->arena_size;
+        checkpoint->header->map_hash = hash;
+    }
+    sensor_table_move_arena(table, (unsigned char *)mapping + sizeof(checkpoint_header_t), restore);
+    if (restore) {
+        sensor_table_rebuild_sums(table);
+    }
+    *restored = restore;
+    return 0;
+
+checkpoint_error:
+    close(checkpoint->fd);
+    checkpoint->fd = -1;
+    return -1;
+}
+
+int checkpoint_sync(checkpoint_t *checkpoint, time_t now, bool wait)
+{
+    if (checkpoint->header == NULL) return -1;
+    checkpoint->header->saved_at = (int64_t)now;
+    return msync(checkpoint->header, checkpoint->size, wait ? MS_SYNC : MS_ASYNC);
+}
+
+void checkpoint_close(checkpoint_t *checkpoint, sensor_table_t *table)
+{
+    if (checkpoint->header == NULL) return;
+    (void)checkpoint_sync(checkpoint, time(NULL), true);
+    sensor_table_free(table);
+    munmap(checkpoint->header, checkpoint->size);
+    close(checkpoint->fd);
+    checkpoint->header = NULL;
+    checkpoint->fd = -1;
+}
@@ -0,0 +1,72 @@
+/**
+ * \author Yongkai Zhang
+ */
+
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "sensor_table.h"
+
+#define CHECKPOINT_MAGIC "GWSNAP"   // 6 chars + NUL fill the 8-byte magic
+#define CHECKPOINT_VERSION 1
+
+/**
+ * First 64 bytes of a snapshot file; the sensor_table arena follows, so every
+ * column keeps its SENSOR_TABLE_ALIGN alignment inside the mapping.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t capacity;
+    uint64_t window;
+    uint64_t count;
+    uint64_t arena_size;
+    uint64_t map_hash;          /**< (sensor_id, room_id) of every slot, in slot order */
+    int64_t saved_at;           /**< last checkpoint_sync() */
+} checkpoint_header_t;
+
+_Static_assert(sizeof(checkpoint_header_t) == SENSOR_TABLE_ALIGN, "the arena must start on a cache line");
+
+/**
+ * A snapshot file mapped MAP_SHARED and used as the live sensor_table arena:
+ * every update lands in the page cache directly, so a checkpoint is only a
+ * writeback and survives a crash of the process (not of the machine) as is.
+ */
+typedef struct {
+    int fd;
+    checkpoint_header_t *header;
+    size_t size;
+} checkpoint_t;
+
+/**
+ * Maps 'path' and moves the arena of 'table' (sensors already added) into it.
+ * A snapshot with the same layout and sensor map, saved at most 'max_age'
+ * seconds before 'now', is restored: windows, sums, sample counts and alert
+ * states continue where the last run stopped. Anything else, an older snapshot
+ * included, is overwritten with the current (empty) table.
+ * \param max_age oldest snapshot restored in seconds, 0 = any age
+ * \param restored set to whether the snapshot was used
+ * \param saved_at set to the time of a matching snapshot (used or too old), 0 otherwise
+ * \return zero on success, -1 when the file cannot be used (the table is left untouched)
+ */
+int checkpoint_open(checkpoint_t *checkpoint, const char *path, sensor_table_t *table, time_t now, time_t max_age,
+                    bool *restored, time_t *saved_at);
+
+/**
+ * Writes the snapshot back to the file
+ * \param wait false schedules the writeback (periodic checkpoints), true waits for it (shutdown)
+ * \return zero on success, -1 on failure
+ */
+int checkpoint_sync(checkpoint_t *checkpoint, time_t now, bool wait);
+
+/**
+ * Syncs and unmaps the snapshot; 'table' keeps nothing that points into it
+ */
+void checkpoint_close(checkpoint_t *checkpoint, sensor_table_t *table);
+
+#endif /* _CHECKPOINT_H_ */
@@ -4,7 +4,31 @@
 #include <stdbool.h>
 #ifndef _CONFIG_H_
 #define _CONFIG_H_
-#define RUN_AVG_LENGTH 5
+#define RUN_AVG_LENGTH 5          // default running average window, override with --avg-window
+#define RUN_AVG_LENGTH_MAX 86400
+#define STATS_SUMMARY_INTERVAL 60   // seconds between SUMMARY lines, override with --summary-interval
+#define DATAMGR_MAX_SHARDS 16       // upper bound for --shards
+#define ROLLUP_FLUSH_ROWS 4096      // closed rollup windows buffered before a forced flush
+#define ROLLUP_FLUSH_SECONDS 1      // max age of buffered rollup windows
+#define DB_BATCH_ROWS 512           // sensor rows per insert transaction
+#define DB_BATCH_MS 200             // max age of an open insert transaction
+#define DB_PROFILE "ssd"            // SQLite tuning profile, override with --db-profile
+#define DB_PARTITION_SECONDS 86400  // readings per partition table, override with --db-partition=hour|day
+#define DB_RETENTION_HOURS 0        // partitions older than this are dropped, 0 = keep; --db-retention-hours
+#define DB_ARCHIVE_FILE "Sensor.tsa" // dropped partitions are archived here first, override with --db-archive=FILE|off
+#define STORAGE_COMMIT_ROWS 1024    // readings per storage manager group commit
+#define STORAGE_COMMIT_MS 100       // max wait of a queued reading before its group is committed
+#define DATA_LOG_SHED_DEPTH 1024    // queued readings that switch DATA output to alerts only, override with --shed-depth
+#define REORDER_WATERMARK -1        // allowed lateness in seconds, -1 = apply in arrival order; --reorder-watermark
+#define LIVENESS_SILENCE_MIN 10     // seconds without readings before SILENT, override with --silence-seconds
+#define LIVENESS_SILENCE_FACTOR 5.0 // ...or this many learned reading intervals, whichever is longer
+#define LIVENESS_STUCK_SECONDS 3600 // identical value this long is STUCK, override with --stuck-seconds
+#define LIVENESS_RATE_WINDOW 10     // seconds per reading-rate sample
+#define LIVENESS_RATE_FACTOR 4.0    // RATE_ANOMALY when a window is this many times above/below the learned rate
+#define CHECKPOINT_FILE "datamgr.snap" // sensor state snapshot (".<shard>" appended with several shards)
+#define CHECKPOINT_INTERVAL 10      // seconds between snapshot writebacks, 0 = no snapshot
+#define CHECKPOINT_MAX_AGE 300      // older snapshots are not restored, 0 = any age; --checkpoint-max-age
+#define QUERY_SOCKET "gateway.sock" // datamgr state queries (".<shard>" appended with several shards)
 #define BUFFER_SIZE 1024
 #define FIFO_NAME 	"logFifo"     //name of the FIFO
 #define FIFO_LOG    "gateway.log"	//name of log file
@@ -13,75 +37,115 @@
 #define SBUFFER_FULL_BLOCK 0
 #define SBUFFER_FULL_DROP_NEWEST 1
 #define SBUFFER_FULL_DROP_OLDEST 2
+#define SBUFFER_LANE_EXPRESS 0      // drained first: readings likely to change alert state
+#define SBUFFER_LANE_NORMAL 1       // routine readings
+#define SBUFFER_LANE_COUNT 2
+#define SBUFFER_SENSOR_SLOTS 65536  // one pending chain per possible sensor_id
+
+#ifndef EXPRESS_LANE_MARGIN
+#define EXPRESS_LANE_MARGIN 0.5     // degrees inside [SET_MIN_TEMP, SET_MAX_TEMP] still treated as express
+#endif
 
 #ifndef SBUFFER_FULL_POLICY
 #define SBUFFER_FULL_POLICY SBUFFER_FULL_BLOCK
 #endif
-
-//error code
-#define ASPRINTF_ERROR(err) 								\
-		do {												\
-			if ( (err) == -1 )								\
-			{												\
-				perror("asprintf failed");					\
-				exit( EXIT_FAILURE );						\
-			}												\
-		} while(0)
-
-typedef uint16_t sensor_id_t;
-typedef double sensor_value_t;
-typedef time_t sensor_ts_t;         // UTC timestamp as returned by time() - notice that the size of time_t is different on 32/64 bit machine
-typedef struct sbuffer sbuffer_t;
-/**
- * structure to hold sensor data
- */
-// typedef struct {
-//     sensor_id_t id;         /** < sensor id */
-//     sensor_value_t value;   /** < sensor value */
-//     sensor_ts_t ts;         /** < sensor timestamp */
-// } sensor_data_t;
-// typedef struct pollfd pollfd_t;
-
-// typedef struct{
-//   pollfd_t *file_descriptors;
-//   time_t last_record;
-//   sensor_data_t* sensor;
-//   tcpsock_t* socket_id;
-// } pollinfo;
-
+
+//error code
+#define ASPRINTF_ERROR(err) 								\
+		do {												\
+			if ( (err) == -1 )								\
+			{												\
+				perror("asprintf failed");					\
+				exit( EXIT_FAILURE );						\
+			}												\
+		} while(0)
+
+typedef uint16_t sensor_id_t;
+typedef double sensor_value_t;
+typedef time_t sensor_ts_t;         // UTC timestamp as returned by time() - notice that the size of time_t is different on 32/64 bit machine
+typedef struct sbuffer sbuffer_t;
+
+/*
+ * Shard that owns room 'room_id', and every sensor of it, when datamgr runs as
+ * 'shard_count' processes. Shared by connmgr (routing) and datamgr (registry
+ * slice); Fibonacci hashing spreads consecutive ids over the shards.
+ */
+static inline int room_shard_of(uint16_t room_id, int shard_count)
+{
+    if (shard_count <= 1) return 0;
+    return (int)((((uint32_t)room_id * 2654435761u) >> 16) % (uint32_t)shard_count);
+}
+/**
+ * structure to hold sensor data
+ */
+// typedef struct {
+//     sensor_id_t id;         /** < sensor id */
+//     sensor_value_t value;   /** < sensor value */
+//     sensor_ts_t ts;         /** < sensor timestamp */
+// } sensor_data_t;
+// typedef struct pollfd pollfd_t;
+
+// typedef struct{
+//   pollfd_t *file_descriptors;
+//   time_t last_record;
+//   sensor_data_t* sensor;
+//   tcpsock_t* socket_id;
+// } pollinfo;
+
 typedef struct {
     uint16_t sensor_id;
     uint16_t room_id;
     double RUN_AVG;
     sensor_value_t value;   /** < sensor value */
     time_t timestamp;
+    uint32_t seq;           /** < per-sensor sequence number assigned by the sender */
+    uint32_t epoch;         /** < run of the sender that numbered 'seq', random per run */
     size_t sample_count;
     int8_t alert_state;
-    double temperatures[RUN_AVG_LENGTH];
+    uint8_t lane;           /** < sbuffer lane chosen by connmgr */
 } sensor_data_t;
-/**
- * basic node for the buffer, these nodes are linked together to create the buffer
- */
-typedef struct sbuffer_node {
-    struct sbuffer_node *next;  /**< a pointer to the next node*/
-    sensor_data_t data;         /**< a structure containing the data */
-    bool ismgr;//to check if the data is read
-    bool isStore;// to check if the data is stored
-} sbuffer_node_t;
-
-/**s
- * a structure to keep track of the buffer
- */
-
+/**
+ * basic node for the buffer, these nodes are linked together to create the buffer
+ */
+typedef struct sbuffer_node {
+    struct sbuffer_node *next;  /**< a pointer to the next node*/
+    struct sbuffer_node *prev;  /**< a pointer to the previous node in the same lane */
+    struct sbuffer_node *sensor_next; /**< next pending normal-lane node of the same sensor */
+    sensor_data_t data;         /**< a structure containing the data */
+    bool ismgr;//to check if the data is read
+    bool isStore;// to check if the data is stored
+} sbuffer_node_t;
+
+/**
+ * one FIFO lane of the buffer
+ */
+typedef struct {
+    sbuffer_node_t *head;       /**< a pointer to the first node in the lane */
+    sbuffer_node_t *tail;       /**< a pointer to the last node in the lane */
+    size_t size;                /**< number of pending items in the lane */
+} sbuffer_lane_t;
+
+/**
+ * pending normal-lane nodes of one sensor, oldest first
+ */
+typedef struct {
+    sbuffer_node_t *head;
+    sbuffer_node_t *tail;
+} sbuffer_chain_t;
+
+/**s
+ * a structure to keep track of the buffer
+ */
+
 typedef struct sbuffer{
-    sbuffer_node_t *head;       /**< a pointer to the first node in the buffer */
-    sbuffer_node_t *tail;       /**< a pointer to the last node in the buffer */
+    sbuffer_lane_t lanes[SBUFFER_LANE_COUNT]; /**< express lane is drained before normal lane */
+    sbuffer_chain_t *chains;    /**< per-sensor normal-lane chains, indexed by sensor_id */
     size_t size;                /**< number of pending items in queue */
     size_t capacity;            /**< max number of pending items */
     bool closed;                /**< producer side closed flag */
     unsigned long long dropped_count;
     time_t last_stamp;//to record the time of last processing
 }sbuffer_t;
-
-
-#endif /* _CONFIG_H_ */
+
+
+#endif /* _CONFIG_H_ */
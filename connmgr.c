@@ -1,3 +1,5 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <errno.h>
 #include <fcntl.h>
 #include <signal.h>
@@ -12,12 +14,21 @@
 #include <unistd.h>
 #include "config.h"
 #include "connmgr.h"
+#include "dedup.h"
 #include "lib/tcpsock.h"
 
 #ifndef TIMEOUT
 #error TIMEOUT not defined
 #endif
 
+#ifndef SET_MAX_TEMP
+#error SET_MAX_TEMP not defined
+#endif
+
+#ifndef SET_MIN_TEMP
+#error SET_MIN_TEMP not defined
+#endif
+
 typedef struct worker_proc {
     pid_t pid;
     struct worker_proc *next;
@@ -28,16 +39,22 @@ typedef struct {
     sensor_id_t sensor_id;
 } sensor_map_entry_t;
 
-static int datamgr_pipe_fd = -1;
+static int datamgr_pipe_fds[DATAMGR_MAX_SHARDS];
+static int datamgr_shard_count = 0;
 static int stats_pipe_read_fd = -1;
 static int stats_pipe_write_fd = -1;
 static int receiver_data_fd = -1;
+static int storage_fd = -1;
 static int server_socket_fd = -1;
 static worker_proc_t *worker_list = NULL;
 static sensor_map_entry_t *sensor_map_entries = NULL;
 static size_t sensor_map_count = 0;
 static unsigned long long total_received = 0;
 static unsigned long long total_rejected = 0;
+static unsigned long long total_duplicates = 0;
+static unsigned long long total_stale = 0;
+static unsigned long long total_storage_dropped = 0;
+static dedup_table_t dedup_table;       // shared with the workers, mapped before they fork
 static time_t last_data_timestamp = 0;
 
 static void free_sensor_map(void)
@@ -109,6 +126,24 @@ static bool is_valid_sensor_pair(uint16_t room_id, sensor_id_t sensor_id)
     return false;
 }
 
+static bool is_near_alert_band(sensor_value_t value)
+{
+    return value >= (double)SET_MAX_TEMP - EXPRESS_LANE_MARGIN ||
+           value <= (double)SET_MIN_TEMP + EXPRESS_LANE_MARGIN;
+}
+
+/*
+ * Cheap per-connection guess of whether a reading can flip the sensor state:
+ * it sits near/past a threshold, or the previous reading did (possible recovery).
+ * Such readings go to the express lane so datamgr handles them first.
+ */
+static uint8_t classify_lane(sensor_value_t value, sensor_value_t previous_value, bool has_previous)
+{
+    if (is_near_alert_band(value)) return SBUFFER_LANE_EXPRESS;
+    if (has_previous && is_near_alert_band(previous_value)) return SBUFFER_LANE_EXPRESS;
+    return SBUFFER_LANE_NORMAL;
+}
+
 static int write_atomic_message(int fd, const void *buffer, size_t size)
 {
     ssize_t written;
@@ -175,10 +210,45 @@ static int notify_parent(char event_code)
     return write_atomic_message(stats_pipe_write_fd, &event_code, sizeof(event_code));
 }
 
+/*
+ * Readings are routed by room; the pair was checked against the map, so every reading
+ * of a sensor goes to the shard that holds its whole room and per-sensor order holds.
+ */
 static int forward_measurement(const sensor_data_t *data)
 {
-    if (datamgr_pipe_fd < 0 || data == NULL) return -1;
-    return write_atomic_message(datamgr_pipe_fd, data, sizeof(*data));
+    int shard;
+
+    if (datamgr_shard_count <= 0 || data == NULL) return -1;
+    shard = room_shard_of(data->room_id, datamgr_shard_count);
+    return write_atomic_message(datamgr_pipe_fds[shard], data, sizeof(*data));
+}
+
+void connmgr_set_storage_fd(int fd)
+{
+    storage_fd = fd;
+}
+
+/* Never waits: the disk may be slow, ingest and alerting must not be. Returns -1 when dropped. */
+static int offer_to_storage(const sensor_data_t *data)
+{
+    ssize_t written;
+
+    if (storage_fd < 0) return 0;
+    do {
+        written = write(storage_fd, data, sizeof(*data));
+    } while (written < 0 && errno == EINTR);
+    return written == (ssize_t)sizeof(*data) ? 0 : -1;
+}
+
+static void close_datamgr_pipes(void)
+{
+    for (int shard = 0; shard < datamgr_shard_count; shard++) {
+        if (datamgr_pipe_fds[shard] >= 0) {
+            close(datamgr_pipe_fds[shard]);
+            datamgr_pipe_fds[shard] = -1;
+        }
+    }
+    datamgr_shard_count = 0;
 }
 
 static int receive_measurement(tcpsock_t *client, sensor_data_t *data)
@@ -202,12 +272,18 @@ static int receive_measurement(tcpsock_t *client, sensor_data_t *data)
     rc = tcp_receive(client, &data->timestamp, &bytes);
     if (rc != TCP_NO_ERROR) return rc;
 
+    bytes = sizeof(data->seq);
+    rc = tcp_receive(client, &data->seq, &bytes);
+    if (rc != TCP_NO_ERROR) return rc;
+
+    bytes = sizeof(data->epoch);
+    rc = tcp_receive(client, &data->epoch, &bytes);
+    if (rc != TCP_NO_ERROR) return rc;
+
     data->RUN_AVG = 0;
     data->sample_count = 0;
     data->alert_state = 0;
-    for (size_t i = 0; i < RUN_AVG_LENGTH; i++) {
-        data->temperatures[i] = 0;
-    }
+    data->lane = SBUFFER_LANE_NORMAL;
     return TCP_NO_ERROR;
 }
 
@@ -237,6 +313,8 @@ static void shutdown_client_socket(tcpsock_t *client)
 static void worker_process(tcpsock_t *client)
 {
     sensor_data_t data;
+    sensor_value_t previous_value = 0;
+    bool has_previous = false;
 
     if (stats_pipe_read_fd >= 0) {
         close(stats_pipe_read_fd);
@@ -254,14 +332,31 @@ static void worker_process(tcpsock_t *client)
             shutdown_client_socket(client);
             break;
         }
+        /* A retried or replayed reading never reaches the receiver log or datamgr. */
+        switch (dedup_check(&dedup_table, data.sensor_id, data.epoch, data.seq)) {
+        case DEDUP_DUPLICATE:
+            (void)notify_parent('D');
+            continue;
+        case DEDUP_STALE:
+            (void)notify_parent('T');
+            continue;
+        default:
+            break;
+        }
 
         if (append_receiver_measurement(&data) != 0) {
             break;
         }
+        data.lane = classify_lane(data.value, previous_value, has_previous);
+        previous_value = data.value;
+        has_previous = true;
         if (forward_measurement(&data) != 0) {
             shutdown_client_socket(client);
             break;
         }
+        if (offer_to_storage(&data) != 0) {
+            (void)notify_parent('S');
+        }
         if (notify_parent('M') != 0) {
             shutdown_client_socket(client);
             break;
@@ -270,7 +365,8 @@ static void worker_process(tcpsock_t *client)
 
     tcp_close(&client);
     if (stats_pipe_write_fd >= 0) close(stats_pipe_write_fd);
-    if (datamgr_pipe_fd >= 0) close(datamgr_pipe_fd);
+    if (storage_fd >= 0) close(storage_fd);
+    close_datamgr_pipes();
     if (receiver_data_fd >= 0) close(receiver_data_fd);
     _exit(EXIT_SUCCESS);
 }
@@ -368,29 +464,53 @@ static void drain_worker_events(void)
             last_data_timestamp = time(NULL);
         } else if (event_code == 'R') {
             total_rejected++;
+        } else if (event_code == 'D') {
+            total_duplicates++;
+            last_data_timestamp = time(NULL);
+        } else if (event_code == 'T') {
+            total_stale++;
+            last_data_timestamp = time(NULL);
+        } else if (event_code == 'S') {
+            total_storage_dropped++;
         }
     }
 }
 
-int connmgr_listen(int pipe_write_fd, int port, int timeout_seconds)
+int connmgr_listen(const int *pipe_write_fds, int shard_count, int port, int timeout_seconds)
 {
     tcpsock_t *server = NULL;
     int stats_pipe[2];
     int exit_code = EXIT_SUCCESS;
 
-    if (pipe_write_fd < 0 || port <= 0) return EXIT_FAILURE;
+    if (pipe_write_fds == NULL || shard_count <= 0 || shard_count > DATAMGR_MAX_SHARDS || port <= 0) {
+        return EXIT_FAILURE;
+    }
+    for (int shard = 0; shard < shard_count; shard++) {
+        if (pipe_write_fds[shard] < 0) return EXIT_FAILURE;
+    }
     if (timeout_seconds < 0) timeout_seconds = TIMEOUT;
 
     signal(SIGPIPE, SIG_IGN);
-    datamgr_pipe_fd = pipe_write_fd;
+    for (int shard = 0; shard < shard_count; shard++) {
+        datamgr_pipe_fds[shard] = pipe_write_fds[shard];
+    }
+    datamgr_shard_count = shard_count;
     last_data_timestamp = time(NULL);
     total_received = 0;
     total_rejected = 0;
+    total_duplicates = 0;
+    total_stale = 0;
+    total_storage_dropped = 0;
 
     if (load_sensor_map() != 0) {
         fprintf(stderr, "Unable to load room_sensor.map for validation\n");
         return EXIT_FAILURE;
     }
+    if (dedup_init(&dedup_table) != 0) {
+        perror("mmap dedup table");
+        free_sensor_map();
+        return EXIT_FAILURE;
+    }
 
     receiver_data_fd = open(
         RECEIVER_DATA_LOG,
@@ -400,6 +520,7 @@ int connmgr_listen(int pipe_write_fd, int port, int timeout_seconds)
     if (receiver_data_fd < 0) {
         perror("open sensor_data_recv.txt");
         free_sensor_map();
+        dedup_free(&dedup_table);
         return EXIT_FAILURE;
     }
 
@@ -408,6 +529,7 @@ int connmgr_listen(int pipe_write_fd, int port, int timeout_seconds)
         close(receiver_data_fd);
         receiver_data_fd = -1;
         free_sensor_map();
+        dedup_free(&dedup_table);
         return EXIT_FAILURE;
     }
     stats_pipe_read_fd = stats_pipe[0];
@@ -510,9 +632,10 @@ cleanup:
         close(server_socket_fd);
         server_socket_fd = -1;
     }
-    if (datamgr_pipe_fd >= 0) {
-        close(datamgr_pipe_fd);
-        datamgr_pipe_fd = -1;
+    close_datamgr_pipes();
+    if (storage_fd >= 0) {
+        close(storage_fd);
+        storage_fd = -1;
     }
     if (stats_pipe_write_fd >= 0) {
         close(stats_pipe_write_fd);
@@ -530,13 +653,18 @@ cleanup:
     }
 
     printf(
-        "Connection manager stopped. total received=%llu, dropped=%llu, rejected=%llu (queue dropped=%llu)\n",
+        "Connection manager stopped. total received=%llu, duplicates=%llu, stale=%llu, dropped=%llu, rejected=%llu "
+        "(queue dropped=%llu, storage dropped=%llu)\n",
         total_received,
+        total_duplicates,
+        total_stale,
         0ULL,
         total_rejected,
-        0ULL
+        0ULL,
+        total_storage_dropped
     );
     free_sensor_map();
+    dedup_free(&dedup_table);
     return exit_code;
 }
 
@@ -22,12 +22,20 @@ typedef struct{
   tcpsock_t* socket_id;
 } pollinfo;
 
+/*
+ * Sets the non-blocking pipe to the storage manager (-1 = none). Every forwarded
+ * measurement is also offered to it; when the pipe is full the measurement is
+ * not stored and counted as "storage dropped" instead of stalling the worker.
+ */
+void connmgr_set_storage_fd(int fd);
+
 /*
  * Starts the TCP receiver process.
  * Valid measurements are written to sensor_data_recv.txt and forwarded
- * to the datamgr child through the supplied pipe write end.
+ * to the datamgr shard that owns the sensor's room (room_shard_of()) through
+ * that shard's pipe write end.
  */
-int connmgr_listen(int pipe_write_fd, int port, int timeout_seconds);
+int connmgr_listen(const int *pipe_write_fds, int shard_count, int port, int timeout_seconds);
 
 /*
  * This method should be called to clean up the connmgr, and to free all used memory.
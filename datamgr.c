@@ -3,15 +3,117 @@
  */
 
 #include <errno.h>
+#include <math.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include "config.h"
+#include "checkpoint.h"
 #include "datamgr.h"
+#include "eventlog.h"
+#include "liveness.h"
+#include "logwriter.h"
+#include "query.h"
+#include "reorder.h"
+#include "rollup.h"
+#include "room_agg.h"
+#include "sensor_db.h"
+#include "sensor_stats.h"
+#include "sensor_table.h"
+#include "thresholds.h"
 
-static dplist_t *list = NULL;
+#define DATAMGR_READ_BATCH 256
+#define BATCH_SLOT_INVALID_SENSOR -1
+#define BATCH_SLOT_INVALID_PAIR -2
+#define READ_BATCH_TIMEOUT -2
+#define HOUSEKEEPING_TICK_MS 1000
+#define ROLLUP_BUSY_MS 50   // longest wait for the storage manager's (or anyone's) database lock
+#define ROLLUP_EXIT_BUSY_MS 5000                    // ...and for the last flush at exit
+#define ROLLUP_RETRY_ROWS (16 * ROLLUP_FLUSH_ROWS)  // closed windows kept while the database is locked
+
+typedef struct {
+    unsigned char bytes[DATAMGR_READ_BATCH * sizeof(sensor_data_t)];
+    size_t used;
+} pipe_reader_t;
+
+/*
+ * Sensor registry in structure-of-arrays layout; 'sensor_slots' inside the
+ * table is a direct index over the whole 16-bit sensor_id space.
+ */
+static sensor_table_t table;
+static room_index_t rooms;
+static sensor_stats_t *sensor_stats = NULL;  // indexed by table slot, reset every summary interval
+static sensor_rollup_t *sensor_rollups = NULL;  // open 1 s / 1 min / 1 h windows, indexed by slot
+static rollup_record_t pending_rollups[ROLLUP_RETRY_ROWS];
+static size_t pending_rollup_count = 0;
+static bool rollup_failing = false;             // the last flush left windows behind
+static unsigned long long rollup_dropped = 0;   // windows lost to a full retry buffer
+static DBCONN *rollup_db = NULL;
+static size_t avg_window = RUN_AVG_LENGTH;
+static int summary_interval = STATS_SUMMARY_INTERVAL;
+static int shard_index = 0;
+static int shard_count = 1;
+static int summary_fd = -1;
+static char log_path[64] = FIFO_LOG;
+static datamgr_summary_t shard_totals;
+static logwriter_policy_t log_policy = { LOGWRITER_FLUSH_BYTES, LOGWRITER_FLUSH_MS, true, true };
+static logwriter_t log_writer;
+static int log_format = DATAMGR_LOG_TEXT;
+static char event_path[64] = EVENTLOG_FILE;
+static logwriter_t event_writer;
+static eventlog_writer_t event_log;     // 'out' is NULL unless the binary log is active
+static int data_log_mode = DATAMGR_DATA_LOG_ALL;
+static double data_log_parameter = 0;
+static int shed_depth = DATA_LOG_SHED_DEPTH;
+static bool shedding = false;
+static unsigned long long data_suppressed = 0;
+static double *last_logged_values = NULL;   // per slot, NAN until the first DATA line
+static uint32_t *data_log_counters = NULL;  // per slot, readings seen by every-Nth sampling
+static reorder_buffer_t *reorder_buffers = NULL;   // per slot, only used with a watermark
+static reorder_queue_t reorder_queue;       // slots whose buffer holds readings, least recently pushed first
+static int reorder_watermark = REORDER_WATERMARK;
+static char thresholds_path[256] = THRESHOLDS_FILE;
+static thresholds_t thresholds;
+static threshold_t *room_limits = NULL;     // per room index of 'rooms'
+static time_t thresholds_mtime = 0;        // of the file last read, 0 when none
+static off_t thresholds_size = -1;
+static liveness_t liveness;
+static liveness_config_t liveness_config = { LIVENESS_SILENCE_MIN, LIVENESS_SILENCE_FACTOR, LIVENESS_STUCK_SECONDS,
+                                             LIVENESS_RATE_WINDOW, LIVENESS_RATE_FACTOR };
+static time_t arrival_time = 0;             // wall-clock second of the readings being applied
+static checkpoint_t checkpoint = { -1, NULL, 0 };
+static char checkpoint_path[256] = CHECKPOINT_FILE;
+static int checkpoint_interval = CHECKPOINT_INTERVAL;
+static int checkpoint_max_age = CHECKPOINT_MAX_AGE;
+static query_server_t query_server = { .listen_fd = -1 };
+static char query_path[sizeof(query_server.path) - 8] = QUERY_SOCKET;
 static int listen_port = 0;
+static pipe_reader_t pipe_reader;
+static sensor_data_t read_records[DATAMGR_READ_BATCH];
+
+/*
+ * One batch of readings dequeued from the sbuffer. Scalar code fills the
+ * per-reading sums/sizes in arrival order, then the vector kernels compute
+ * averages and alert states for the whole batch at once.
+ */
+static sensor_data_t batch_readings[DATAMGR_READ_BATCH];
+static int batch_slots[DATAMGR_READ_BATCH];
+static double batch_sums[DATAMGR_READ_BATCH];
+static double batch_sizes[DATAMGR_READ_BATCH];
+static double batch_ready[DATAMGR_READ_BATCH];
+static double batch_averages[DATAMGR_READ_BATCH];
+static int8_t batch_states[DATAMGR_READ_BATCH];
+static int8_t batch_holds[DATAMGR_READ_BATCH];       // state the clear band would keep
+static double batch_mins[DATAMGR_READ_BATCH];
+static double batch_maxs[DATAMGR_READ_BATCH];
+static double batch_clear_mins[DATAMGR_READ_BATCH];
+static double batch_clear_maxs[DATAMGR_READ_BATCH];
+static size_t batch_count = 0;
 
 enum {
     ALERT_STATE_COLD = -1,
@@ -26,59 +128,53 @@ static const char *alert_state_to_text(int8_t state)
     return "NORMAL";
 }
 
-static void *element_copy(void *element)
+static void write_log_message(logwriter_t *log, const char *message)
 {
-    sensor_data_t *sensor = element;
-    sensor_data_t *sensor_copy = malloc(sizeof(*sensor_copy));
-
-    if (sensor_copy == NULL) return NULL;
-
-    *sensor_copy = *sensor;
-    return sensor_copy;
+    if (log == NULL) return;
+    logwriter_write(log, message, strlen(message));
 }
 
-static void element_free(void **element)
+/* Binary mode: one fixed-size record, no text formatting on the hot path. */
+static void write_event(int type, int8_t status, int slot, double value, double average, sensor_ts_t ts)
 {
-    free(*element);
-    *element = NULL;
-}
+    eventlog_record_t record;
 
-static int element_compare(void *x, void *y)
-{
-    sensor_id_t sensor_id = *(sensor_id_t *)x;
-    sensor_data_t *sensor = y;
-
-    if (sensor_id == sensor->sensor_id) return 0;
-    return (sensor_id < sensor->sensor_id) ? -1 : 1;
+    memset(&record, 0, sizeof(record));
+    record.type = (uint8_t)type;
+    record.status = status;
+    record.room_id = table.room_ids[slot];
+    record.sensor_id = table.sensor_ids[slot];
+    record.reading.value = value;
+    record.reading.average = average;
+    eventlog_append(&event_log, &record, ts);
 }
 
-static void write_log_message(FILE *file, const char *message)
-{
-    if (file == NULL) return;
-    fputs(message, file);
-    fflush(file);
-}
-
-static void write_data_log(FILE *file, const sensor_data_t *sensor)
+static void write_data_log(logwriter_t *log, int slot, const sensor_data_t *measurement, double average, bool warm)
 {
     const char *status = "WARMUP";
 
-    if (file == NULL || sensor == NULL) return;
+    if (slot < 0) return;
+    if (event_log.out != NULL) {
+        write_event(EVENT_DATA, warm ? table.alert_states[slot] : EVENT_STATUS_WARMUP, slot,
+                    measurement->value, average, measurement->timestamp);
+        return;
+    }
+    if (log == NULL) return;
     /* Before window is full, report warmup instead of normal/hot/cold. */
-    if (sensor->sample_count >= RUN_AVG_LENGTH) {
-        status = alert_state_to_text(sensor->alert_state);
+    if (warm) {
+        status = alert_state_to_text(table.alert_states[slot]);
     }
 
-    fprintf(
-        file,
+    logwriter_printf(
+        log,
         "DATA port=%d room=%hu sensor=%hu temp=%.2f avg=%.2f status=%s ts=%ld\n",
         listen_port,
-        sensor->room_id,
-        sensor->sensor_id,
-        sensor->value,
-        sensor->RUN_AVG,
+        table.room_ids[slot],
+        table.sensor_ids[slot],
+        measurement->value,
+        average,
         status,
-        (long)sensor->timestamp
+        (long)measurement->timestamp
     );
 }
 
@@ -87,98 +183,962 @@ void datamgr_set_listen_port(int port)
     listen_port = port;
 }
 
-static sensor_data_t *datamgr_get_sensor(sensor_id_t sensor_id)
+void datamgr_set_shard(int shard, int count)
 {
-    for (int index = 0; index < dpl_size(list); index++) {
-        sensor_data_t *sensor = dpl_get_element_at_index(list, index);
-        if (sensor != NULL && sensor->sensor_id == sensor_id) {
-            return sensor;
-        }
+    if (count < 1 || shard < 0 || shard >= count) return;
+    shard_index = shard;
+    shard_count = count;
+    if (count == 1) {
+        snprintf(log_path, sizeof(log_path), "%s", FIFO_LOG);
+        snprintf(event_path, sizeof(event_path), "%s", EVENTLOG_FILE);
+    } else {
+        snprintf(log_path, sizeof(log_path), "%s.%d", FIFO_LOG, shard);
+        snprintf(event_path, sizeof(event_path), "%s.%d", EVENTLOG_FILE, shard);
     }
+}
 
-    return NULL;
+void datamgr_set_summary_fd(int fd)
+{
+    summary_fd = fd;
+}
+
+void datamgr_set_summary_interval(int seconds)
+{
+    summary_interval = seconds < 0 ? 0 : seconds;
+}
+
+void datamgr_set_log_policy(const logwriter_policy_t *policy)
+{
+    if (policy != NULL) log_policy = *policy;
+}
+
+void datamgr_set_log_format(int format)
+{
+    log_format = format == DATAMGR_LOG_BINARY ? DATAMGR_LOG_BINARY : DATAMGR_LOG_TEXT;
+}
+
+int datamgr_set_data_log(int mode, double parameter)
+{
+    if (mode == DATAMGR_DATA_LOG_EVERY && !(parameter >= 1)) return -1;
+    if (mode == DATAMGR_DATA_LOG_DELTA && !(parameter >= 0)) return -1;
+    if (mode < DATAMGR_DATA_LOG_ALL || mode > DATAMGR_DATA_LOG_ALERTS) return -1;
+    data_log_mode = mode;
+    data_log_parameter = parameter;
+    return 0;
+}
+
+void datamgr_set_shed_depth(int depth)
+{
+    shed_depth = depth < 0 ? 0 : depth;
+}
+
+void datamgr_set_thresholds_file(const char *path)
+{
+    snprintf(thresholds_path, sizeof(thresholds_path), "%s", path);
+}
+
+void datamgr_set_reorder_watermark(int seconds)
+{
+    reorder_watermark = seconds < 0 ? -1 : seconds;
+}
+
+void datamgr_set_liveness(const liveness_config_t *config)
+{
+    liveness_config = *config;
+}
+
+void datamgr_set_query_socket(const char *path)
+{
+    snprintf(query_path, sizeof(query_path), "%s", path == NULL ? "" : path);
+}
+
+void datamgr_set_checkpoint(const char *path, int interval, int max_age)
+{
+    snprintf(checkpoint_path, sizeof(checkpoint_path), "%s", path);
+    checkpoint_interval = interval < 0 ? 0 : interval;
+    checkpoint_max_age = max_age < 0 ? 0 : max_age;
+}
+
+int datamgr_get_sensor_stats(sensor_id_t sensor_id, sensor_stats_t *stats)
+{
+    int slot;
+
+    if (stats == NULL || sensor_stats == NULL) return -1;
+    slot = sensor_table_lookup(&table, sensor_id);
+    if (slot < 0) return -1;
+    *stats = sensor_stats[slot];
+    return 0;
+}
+
+int datamgr_set_avg_window(size_t window)
+{
+    if (window == 0 || window > RUN_AVG_LENGTH_MAX) return -1;
+    avg_window = window;
+    return 0;
 }
 
 static int load_sensor_map(FILE *fp_sensor_map)
 {
     uint16_t room_id;
     sensor_id_t sensor_id;
+    uint16_t (*pairs)[2];
+    size_t capacity = 16;
+    size_t count = 0;
 
     if (fp_sensor_map == NULL) return -1;
 
-    if (list != NULL) {
-        dpl_free(&list, true);
+    datamgr_free();
+    pairs = malloc(capacity * sizeof(*pairs));
+    if (pairs == NULL) return -1;
+
+    /* Map format: <room_id> <sensor_id>. Only the sensors of this shard's rooms are kept. */
+    while (fscanf(fp_sensor_map, "%hu %hu", &room_id, &sensor_id) == 2) {
+        if (room_shard_of(room_id, shard_count) != shard_index) continue;
+        if (count == capacity) {
+            uint16_t (*resized)[2];
+
+            capacity *= 2;
+            resized = realloc(pairs, capacity * sizeof(*pairs));
+            if (resized == NULL) {
+                free(pairs);
+                return -1;
+            }
+            pairs = resized;
+        }
+        pairs[count][0] = room_id;
+        pairs[count][1] = sensor_id;
+        count++;
     }
 
-    list = dpl_create(element_copy, element_free, element_compare);
-    if (list == NULL) return -1;
+    if (sensor_table_init(&table, count, avg_window) != 0) {
+        free(pairs);
+        return -1;
+    }
+    sensor_stats = calloc(table.capacity, sizeof(*sensor_stats));
+    sensor_rollups = calloc(table.capacity, sizeof(*sensor_rollups));
+    last_logged_values = malloc(table.capacity * sizeof(*last_logged_values));
+    data_log_counters = calloc(table.capacity, sizeof(*data_log_counters));
+    reorder_buffers = calloc(table.capacity, sizeof(*reorder_buffers));
+    if (sensor_stats == NULL || sensor_rollups == NULL || last_logged_values == NULL || data_log_counters == NULL ||
+        reorder_buffers == NULL) {
+        free(pairs);
+        datamgr_free();
+        return -1;
+    }
+    /* A sensor listed twice keeps its first room, like the old list lookup did. */
+    for (size_t index = 0; index < count; index++) {
+        (void)sensor_table_add(&table, pairs[index][1], pairs[index][0]);
+    }
+    for (size_t slot = 0; slot < table.count; slot++) {
+        rollup_init(&sensor_rollups[slot], table.sensor_ids[slot], table.room_ids[slot]);
+        last_logged_values[slot] = NAN;
+        reorder_init(&reorder_buffers[slot]);
+    }
+    reorder_queue_init(&reorder_queue);
+    free(pairs);
+    if (room_index_build(&rooms, &table) != 0) {
+        datamgr_free();
+        return -1;
+    }
+    room_limits = calloc(rooms.count == 0 ? 1 : rooms.count, sizeof(*room_limits));
+    if (room_limits == NULL || liveness_init(&liveness, table.count, &liveness_config, time(NULL)) != 0) {
+        datamgr_free();
+        return -1;
+    }
+    return 0;
+}
 
-    /* Map format: <room_id> <sensor_id>. */
-    while (fscanf(fp_sensor_map, "%hu %hu", &room_id, &sensor_id) == 2) {
-        sensor_data_t sensor = {0};
+static void write_transition_log(logwriter_t *log, int slot, int8_t new_alert_state, double average,
+                                 const sensor_data_t *measurement)
+{
+    char buffer[160];
 
-        sensor.sensor_id = sensor_id;
-        sensor.room_id = room_id;
-        sensor.alert_state = ALERT_STATE_NORMAL;
+    if (event_log.out != NULL) {
+        write_event(new_alert_state == ALERT_STATE_NORMAL ? EVENT_RECOVERY : EVENT_ALERT, new_alert_state, slot,
+                    measurement->value, average, measurement->timestamp);
+        logwriter_alert(event_log.out);
+        return;
+    }
 
-        if (dpl_insert_at_index(list, &sensor, dpl_size(list), true) == NULL) {
-            return -1;
+    if (new_alert_state == ALERT_STATE_COLD) {
+        snprintf(
+            buffer,
+            sizeof(buffer),
+            "ALERT room=%hu sensor=%hu status=COLD avg=%.2f\n",
+            table.room_ids[slot],
+            table.sensor_ids[slot],
+            average
+        );
+    } else if (new_alert_state == ALERT_STATE_HOT) {
+        snprintf(
+            buffer,
+            sizeof(buffer),
+            "ALERT room=%hu sensor=%hu status=HOT avg=%.2f\n",
+            table.room_ids[slot],
+            table.sensor_ids[slot],
+            average
+        );
+    } else {
+        snprintf(
+            buffer,
+            sizeof(buffer),
+            "RECOVERY room=%hu sensor=%hu status=NORMAL avg=%.2f\n",
+            table.room_ids[slot],
+            table.sensor_ids[slot],
+            average
+        );
+    }
+    write_log_message(log, buffer);
+    if (log != NULL) {
+        logwriter_alert(log);
+    }
+}
+
+static void write_room_transition_log(logwriter_t *log, int room, sensor_ts_t ts)
+{
+    const room_state_t *state = &rooms.rooms[room];
+    char buffer[192];
+
+    if (event_log.out != NULL) {
+        eventlog_record_t record;
+
+        memset(&record, 0, sizeof(record));
+        record.type = state->state == ALERT_STATE_NORMAL ? EVENT_ROOM_RECOVERY : EVENT_ROOM_ALERT;
+        record.status = state->state;
+        record.room_id = state->room_id;
+        record.aux = state->hottest < 0 ? 0 : table.sensor_ids[state->hottest];
+        record.aux2 = state->coldest < 0 ? 0 : table.sensor_ids[state->coldest];
+        record.reading.value = room_mean(&rooms, room);
+        eventlog_append(&event_log, &record, ts);
+        logwriter_alert(event_log.out);
+        return;
+    }
+
+    snprintf(
+        buffer,
+        sizeof(buffer),
+        "%s room=%hu status=%s mean=%.2f hottest=%hu coldest=%hu\n",
+        state->state == ALERT_STATE_NORMAL ? "ROOM_RECOVERY" : "ROOM_ALERT",
+        state->room_id,
+        alert_state_to_text(state->state),
+        room_mean(&rooms, room),
+        state->hottest < 0 ? 0 : table.sensor_ids[state->hottest],
+        state->coldest < 0 ? 0 : table.sensor_ids[state->coldest]
+    );
+    write_log_message(log, buffer);
+    if (log != NULL) {
+        logwriter_alert(log);
+    }
+}
+
+static void write_invalid_log(logwriter_t *log, const sensor_data_t *measurement, int reason)
+{
+    char buffer[192];
+
+    if (event_log.out != NULL) {
+        eventlog_record_t record;
+
+        memset(&record, 0, sizeof(record));
+        record.type = reason == BATCH_SLOT_INVALID_SENSOR ? EVENT_INVALID_SENSOR : EVENT_INVALID_PAIR;
+        record.room_id = measurement->room_id;
+        record.sensor_id = measurement->sensor_id;
+        if (reason != BATCH_SLOT_INVALID_SENSOR) {
+            record.aux = table.room_ids[sensor_table_lookup(&table, measurement->sensor_id)];
         }
+        record.reading.value = measurement->value;
+        eventlog_append(&event_log, &record, measurement->timestamp);
+        return;
     }
 
-    return 0;
+    if (reason == BATCH_SLOT_INVALID_SENSOR) {
+        snprintf(
+            buffer,
+            sizeof(buffer),
+            "INVALID_SENSOR port=%d room=%hu sensor=%hu\n",
+            listen_port,
+            measurement->room_id,
+            measurement->sensor_id
+        );
+    } else {
+        snprintf(
+            buffer,
+            sizeof(buffer),
+            "INVALID_PAIR port=%d sensor=%hu room=%hu expected_room=%hu\n",
+            listen_port,
+            measurement->sensor_id,
+            measurement->room_id,
+            table.room_ids[sensor_table_lookup(&table, measurement->sensor_id)]
+        );
+    }
+    write_log_message(log, buffer);
+}
+
+/*
+ * Emits one SUMMARY line per sensor that reported during the interval, then
+ * starts a new interval. The EWMA carries over; everything else restarts.
+ * Each room with at least one warm sensor gets a ROOM line.
+ */
+static void write_summaries(logwriter_t *log)
+{
+    for (size_t slot = 0; slot < table.count; slot++) {
+        sensor_stats_t *stats = &sensor_stats[slot];
+
+        if (stats->count == 0) continue;
+        stats_merge(&shard_totals.stats, stats);
+        if (log != NULL) {
+            logwriter_printf(
+                log,
+                "SUMMARY room=%hu sensor=%hu n=%llu min=%.2f max=%.2f mean=%.2f stddev=%.2f "
+                "ewma=%.2f p50=%.2f p95=%.2f p99=%.2f\n",
+                table.room_ids[slot],
+                table.sensor_ids[slot],
+                (unsigned long long)stats->count,
+                stats->min,
+                stats->max,
+                stats->mean,
+                sqrt(stats_variance(stats)),
+                stats->ewma,
+                stats_quantile(stats, 0.50),
+                stats_quantile(stats, 0.95),
+                stats_quantile(stats, 0.99)
+            );
+        }
+        stats_reset(stats, true);
+    }
+
+    for (size_t room = 0; room < rooms.count && log != NULL; room++) {
+        const room_state_t *state = &rooms.rooms[room];
+
+        if (state->warm_count == 0) continue;
+        logwriter_printf(
+            log,
+            "ROOM room=%hu sensors=%u/%u mean=%.2f hottest=%hu hottest_avg=%.2f "
+            "coldest=%hu coldest_avg=%.2f status=%s\n",
+            state->room_id,
+            state->warm_count,
+            state->member_count,
+            room_mean(&rooms, (int)room),
+            table.sensor_ids[state->hottest],
+            rooms.contribution[state->hottest],
+            table.sensor_ids[state->coldest],
+            rooms.contribution[state->coldest],
+            alert_state_to_text(state->state)
+        );
+    }
 }
 
-static void update_running_average(sensor_data_t *sensor, sensor_value_t new_value)
+/*
+ * Stores the closed windows, ROLLUP_FLUSH_ROWS per transaction. Windows the
+ * database did not take (its lock held past ROLLUP_BUSY_MS) stay pending, in
+ * order, for the next flush.
+ * \return zero when nothing is left pending, -1 otherwise
+ */
+static int flush_rollups(void)
 {
-    double total = 0;
-    size_t window_size;
+    size_t stored = 0;
 
-    /* Fixed-size sliding window with oldest sample eviction. */
-    if (sensor->sample_count < RUN_AVG_LENGTH) {
-        sensor->temperatures[sensor->sample_count] = new_value;
-        sensor->sample_count++;
+    if (rollup_db == NULL) {
+        pending_rollup_count = 0;
+        return 0;
+    }
+    while (stored < pending_rollup_count) {
+        size_t chunk = pending_rollup_count - stored;
+
+        if (chunk > ROLLUP_FLUSH_ROWS) chunk = ROLLUP_FLUSH_ROWS;
+        if (insert_rollups(rollup_db, pending_rollups + stored, chunk) != 0) break;
+        stored += chunk;
+    }
+    pending_rollup_count -= stored;
+    memmove(pending_rollups, pending_rollups + stored, pending_rollup_count * sizeof(*pending_rollups));
+    rollup_failing = pending_rollup_count > 0;
+    return rollup_failing ? -1 : 0;
+}
+
+static void collect_rollup(const rollup_record_t *record, void *context)
+{
+    (void)context;
+    if (pending_rollup_count == ROLLUP_RETRY_ROWS) {
+        rollup_dropped++;
+        return;
+    }
+    pending_rollups[pending_rollup_count++] = *record;
+    /* While the database refuses, only the housekeeping tick retries. */
+    if (!rollup_failing && pending_rollup_count >= ROLLUP_FLUSH_ROWS) {
+        (void)flush_rollups();
+    }
+}
+
+/*
+ * Decides whether a reading gets a DATA line under the current output mode.
+ * Shedding overrides the mode with alerts-only output.
+ */
+static bool want_data_log(int slot, double value)
+{
+    int mode = shedding ? DATAMGR_DATA_LOG_ALERTS : data_log_mode;
+
+    switch (mode) {
+    case DATAMGR_DATA_LOG_EVERY:
+        if (data_log_counters[slot]++ % (uint32_t)data_log_parameter != 0) return false;
+        break;
+    case DATAMGR_DATA_LOG_DELTA:
+        if (!isnan(last_logged_values[slot]) && fabs(value - last_logged_values[slot]) <= data_log_parameter) {
+            return false;
+        }
+        break;
+    case DATAMGR_DATA_LOG_ALERTS:
+        return false;
+    default:
+        break;
+    }
+    last_logged_values[slot] = value;
+    return true;
+}
+
+/*
+ * Switches shed mode on when the backlog (sbuffer plus readings still in the
+ * pipe) exceeds 'shed_depth', and off again below a quarter of it.
+ */
+static void update_shed_mode(logwriter_t *log, int input_fd, sbuffer_t *buffer)
+{
+    int pipe_bytes = 0;
+    long depth;
+
+    if (shed_depth <= 0) return;
+    if (ioctl(input_fd, FIONREAD, &pipe_bytes) != 0) pipe_bytes = 0;
+    depth = (long)sbuffer_getlength(buffer) + pipe_bytes / (long)sizeof(sensor_data_t);
+
+    if (!shedding && depth > shed_depth) {
+        shedding = true;
+        if (log != NULL) logwriter_printf(log, "SHED_ON depth=%ld threshold=%d\n", depth, shed_depth);
+    } else if (shedding && depth < shed_depth / 4) {
+        shedding = false;
+        if (log != NULL) {
+            logwriter_printf(log, "SHED_OFF depth=%ld suppressed=%llu\n", depth, data_suppressed);
+        }
+    }
+}
+
+/* SILENT comes from the timer wheel; ALIVE, STUCK and RATE_ANOMALY are found when a reading arrives. */
+static void write_liveness_log(const liveness_event_t *event, void *context)
+{
+    logwriter_t *log = context;
+    int slot = event->slot;
+
+    if (log == NULL) return;
+    switch (event->type) {
+    case LIVENESS_SILENT:
+        logwriter_printf(log, "SILENT room=%hu sensor=%hu last_seen=%ld expected_interval=%.1f\n",
+                         table.room_ids[slot], table.sensor_ids[slot], (long)event->since, event->expected);
+        logwriter_alert(log);
+        break;
+    case LIVENESS_ALIVE:
+        logwriter_printf(log, "ALIVE room=%hu sensor=%hu silent_for=%.0f\n", table.room_ids[slot],
+                         table.sensor_ids[slot], event->observed);
+        break;
+    case LIVENESS_STUCK:
+        logwriter_printf(log, "STUCK room=%hu sensor=%hu temp=%.2f since=%ld\n", table.room_ids[slot],
+                         table.sensor_ids[slot], event->observed, (long)event->since);
+        logwriter_alert(log);
+        break;
+    case LIVENESS_RATE_ANOMALY:
+        logwriter_printf(log, "RATE_ANOMALY room=%hu sensor=%hu readings=%.0f expected=%.1f window=%d\n",
+                         table.room_ids[slot], table.sensor_ids[slot], event->observed, event->expected,
+                         liveness.config.rate_window);
+        break;
+    }
+}
+
+/*
+ * Applies one batch of readings. Window updates are scalar because readings
+ * of the same sensor must be applied in order; averages and the threshold
+ * comparison run through the vector kernels; logging follows arrival order.
+ */
+static void process_batch(logwriter_t *log, size_t count)
+{
+    for (size_t index = 0; index < count; index++) {
+        const sensor_data_t *measurement = &batch_readings[index];
+        int slot = sensor_table_lookup(&table, measurement->sensor_id);
+
+        batch_sums[index] = 0;
+        batch_sizes[index] = 1;
+        batch_ready[index] = 0;
+        batch_mins[index] = batch_maxs[index] = 0;
+        batch_clear_mins[index] = batch_clear_maxs[index] = 0;
+        if (slot < 0) {
+            batch_slots[index] = BATCH_SLOT_INVALID_SENSOR;
+            continue;
+        }
+        if (table.room_ids[slot] != measurement->room_id) {
+            batch_slots[index] = BATCH_SLOT_INVALID_PAIR;
+            continue;
+        }
+
+        batch_slots[index] = slot;
+        sensor_table_push_sample(&table, slot, measurement->value, measurement->timestamp,
+                                 &batch_sums[index], &batch_sizes[index]);
+        batch_ready[index] = table.sample_counts[slot] >= avg_window ? 1.0 : 0.0;
+        batch_mins[index] = table.min_temps[slot];
+        batch_maxs[index] = table.max_temps[slot];
+        batch_clear_mins[index] = table.clear_min_temps[slot];
+        batch_clear_maxs[index] = table.clear_max_temps[slot];
+    }
+
+    sensor_table_batch_average(batch_sums, batch_sizes, batch_averages, count);
+    sensor_table_batch_classify(batch_averages, batch_ready, batch_mins, batch_maxs, batch_states, count);
+    sensor_table_batch_classify(batch_averages, batch_ready, batch_clear_mins, batch_clear_maxs,
+                                batch_holds, count);
+
+    for (size_t index = 0; index < count; index++) {
+        int slot = batch_slots[index];
+        const threshold_t *room_band;
+        int room;
+
+        if (slot < 0) {
+            write_invalid_log(log, &batch_readings[index], slot);
+            shard_totals.invalid++;
+            continue;
+        }
+        shard_totals.readings++;
+
+        liveness_observe(&liveness, slot, batch_readings[index].value, arrival_time, write_liveness_log, log);
+        table.averages[slot] = batch_averages[index];
+        stats_update(&sensor_stats[slot], batch_readings[index].value);
+        rollup_add(&sensor_rollups[slot], batch_readings[index].timestamp, batch_readings[index].value,
+                   collect_rollup, NULL);
+        /* Hysteresis: an active alert holds while the average stays outside the clear band. */
+        if (table.alert_states[slot] != ALERT_STATE_NORMAL && batch_holds[index] == table.alert_states[slot]) {
+            batch_states[index] = table.alert_states[slot];
+        }
+        /*
+         * Log only state transitions to avoid alert spam:
+         * NORMAL->HOT/COLD, HOT/COLD->NORMAL.
+         */
+        if (batch_ready[index] != 0 && batch_states[index] != table.alert_states[slot]) {
+            write_transition_log(log, slot, batch_states[index], batch_averages[index], &batch_readings[index]);
+            shard_totals.alerts++;
+        }
+        table.alert_states[slot] = batch_states[index];
+        room_band = &room_limits[rooms.room_of_slot[slot]];
+        room = room_update(&rooms, slot, batch_averages[index], batch_ready[index] != 0,
+                           room_band->min_temp, room_band->max_temp, room_band->hysteresis);
+        if (room != ROOM_NONE) {
+            write_room_transition_log(log, room, batch_readings[index].timestamp);
+        }
+        if (want_data_log(slot, batch_readings[index].value)) {
+            write_data_log(log, slot, &batch_readings[index], batch_averages[index], batch_ready[index] != 0);
+        } else {
+            data_suppressed++;
+        }
+    }
+}
+
+static void apply_thresholds(void)
+{
+    for (size_t slot = 0; slot < table.count; slot++) {
+        threshold_t limits = thresholds_for_sensor(&thresholds, table.sensor_ids[slot], table.room_ids[slot]);
+
+        sensor_table_set_thresholds(&table, (int)slot, limits.min_temp, limits.max_temp, limits.hysteresis);
+    }
+    for (size_t room = 0; room < rooms.count; room++) {
+        room_limits[room] = thresholds_for_room(&thresholds, rooms.rooms[room].room_id);
+    }
+}
+
+/*
+ * (Re)loads the thresholds file when its modification time or size changed.
+ * Until a file is read every sensor uses SET_MIN_TEMP/SET_MAX_TEMP. A file that fails to
+ * parse is reported and the limits in force are kept. Alert states are not
+ * reset: the next reading of each sensor is judged against its new band.
+ */
+static void reload_thresholds(logwriter_t *log)
+{
+    const threshold_t fallback = { (double)SET_MIN_TEMP, (double)SET_MAX_TEMP, 0 };
+    struct stat info;
+    thresholds_t loaded;
+
+    if (stat(thresholds_path, &info) != 0) return;
+    if (info.st_mtime == thresholds_mtime && info.st_size == thresholds_size) return;
+    thresholds_mtime = info.st_mtime;
+    thresholds_size = info.st_size;
+
+    if (thresholds_load(thresholds_path, &fallback, &loaded) != 0) {
+        if (log != NULL) {
+            logwriter_printf(log, "THRESHOLDS_ERROR file=%s (keeping current limits)\n", thresholds_path);
+        }
+        return;
+    }
+    thresholds_free(&thresholds);
+    thresholds = loaded;
+    apply_thresholds();
+    if (log != NULL) {
+        logwriter_printf(log, "THRESHOLDS file=%s rules=%zu default_min=%.2f default_max=%.2f hysteresis=%.2f\n",
+                         thresholds_path, thresholds.count, thresholds.defaults.min_temp,
+                         thresholds.defaults.max_temp, thresholds.defaults.hysteresis);
+    }
+}
+
+/*
+ * Maps the shard's snapshot file as the sensor table arena. A snapshot of the
+ * same sensor map and window, no older than checkpoint_max_age, brings back
+ * every ring, count and alert state, so sensors skip WARMUP; room aggregates
+ * are rebuilt from it in seed_rooms().
+ */
+static void open_checkpoint(time_t now, bool *restored, time_t *saved_at)
+{
+    char path[sizeof(checkpoint_path) + 8];
+
+    *restored = false;
+    *saved_at = 0;
+    if (checkpoint_interval <= 0) return;
+    if (shard_count > 1) {
+        snprintf(path, sizeof(path), "%s.%d", checkpoint_path, shard_index);
+    } else {
+        snprintf(path, sizeof(path), "%s", checkpoint_path);
+    }
+    if (checkpoint_open(&checkpoint, path, &table, now, checkpoint_max_age, restored, saved_at) != 0) {
+        perror("datamgr: checkpoint");
+    }
+}
+
+static void open_query_socket(logwriter_t *log)
+{
+    char path[sizeof(query_server.path)];
+
+    if (query_path[0] == '\0') return;
+    if (shard_count > 1) {
+        snprintf(path, sizeof(path), "%s.%d", query_path, shard_index);
     } else {
-        for (size_t index = 0; index < RUN_AVG_LENGTH - 1; index++) {
-            sensor->temperatures[index] = sensor->temperatures[index + 1];
+        snprintf(path, sizeof(path), "%s", query_path);
+    }
+    if (query_server_open(&query_server, path) != 0) {
+        perror("datamgr: query socket");
+        return;
+    }
+    if (log != NULL) {
+        logwriter_printf(log, "QUERY socket=%s\n", path);
+    }
+}
+
+/* Restored alert states were logged by the previous run; rooms pick up their state silently. */
+static void seed_rooms(void)
+{
+    for (size_t slot = 0; slot < table.count; slot++) {
+        const threshold_t *room_band = &room_limits[rooms.room_of_slot[slot]];
+
+        if (table.sample_counts[slot] < avg_window) continue;
+        (void)room_update(&rooms, (int)slot, table.averages[slot], true, room_band->min_temp, room_band->max_temp,
+                          room_band->hysteresis);
+    }
+}
+
+static void write_sensor_reply(query_reply_t *reply, int slot)
+{
+    bool warm = table.sample_counts[slot] >= avg_window;
+
+    query_reply_printf(reply, "SENSOR id=%hu room=%hu avg=%.2f last=%.2f ts=%ld samples=%llu status=%s\n",
+                       table.sensor_ids[slot], table.room_ids[slot], table.averages[slot], table.last_values[slot],
+                       (long)table.last_timestamps[slot], (unsigned long long)table.sample_counts[slot],
+                       warm ? alert_state_to_text(table.alert_states[slot]) : "WARMUP");
+}
+
+static int compare_hotter(const void *left, const void *right)
+{
+    double a = table.averages[*(const int *)left];
+    double b = table.averages[*(const int *)right];
+
+    return (a < b) - (a > b);
+}
+
+/* Consumes 'word' (followed by a blank or the end) at the start of '*cursor'. */
+static bool take_word(char **cursor, const char *word)
+{
+    size_t length = strlen(word);
+
+    while (**cursor == ' ' || **cursor == '\t') (*cursor)++;
+    if (strncmp(*cursor, word, length) != 0) return false;
+    if ((*cursor)[length] != '\0' && (*cursor)[length] != ' ' && (*cursor)[length] != '\t') return false;
+    *cursor += length;
+    return true;
+}
+
+/* Parses the next id of a GET or STATS list; returns 0 at the end, -1 for a malformed id. */
+static int next_id(char **cursor, long *id)
+{
+    char *endptr;
+
+    while (**cursor == ' ' || **cursor == '\t') (*cursor)++;
+    if (**cursor == '\0') return 0;
+    *id = strtol(*cursor, &endptr, 10);
+    if (endptr == *cursor || (*endptr != '\0' && *endptr != ' ' && *endptr != '\t') || *id < 0 ||
+        *id > UINT16_MAX) {
+        return -1;
+    }
+    *cursor = endptr;
+    return 1;
+}
+
+/* Statistics of the current summary interval, in the fields of a SUMMARY line. */
+static void write_stats_reply(query_reply_t *reply, int slot)
+{
+    sensor_stats_t stats;
+
+    if (datamgr_get_sensor_stats(table.sensor_ids[slot], &stats) != 0) return;
+    query_reply_printf(reply, "STATS room=%hu sensor=%hu n=%llu min=%.2f max=%.2f mean=%.2f stddev=%.2f ewma=%.2f "
+                       "p50=%.2f p95=%.2f p99=%.2f\n", table.room_ids[slot], table.sensor_ids[slot],
+                       (unsigned long long)stats.count, stats.min, stats.max, stats.mean, sqrt(stats_variance(&stats)),
+                       stats.ewma, stats_quantile(&stats, 0.50), stats_quantile(&stats, 0.95),
+                       stats_quantile(&stats, 0.99));
+}
+
+/*
+ * Query protocol, one request per line, every answer ends with "END <lines>":
+ *   GET <id> [<id> ...]   SENSOR line per id, UNKNOWN id=<id> when another shard owns it
+ *   STATS <id> [<id> ...] STATS line per id: the SUMMARY fields of the interval so far
+ *   HOT_ROOMS             ROOM line per room whose mean is above its band
+ *   TOP <n>               SENSOR lines of the n warm sensors with the highest average
+ * Everything is answered from the in-memory table.
+ */
+static void answer_query(char *request, query_reply_t *reply, void *context)
+{
+    char *cursor = request;
+    size_t lines = 0;
+    bool stats = false;
+    long id;
+    int rc;
+
+    (void)context;
+    if (take_word(&cursor, "GET") || (stats = take_word(&cursor, "STATS"))) {
+        char *ids = cursor;
+
+        while ((rc = next_id(&cursor, &id)) > 0) {}
+        if (rc < 0 || cursor == ids) {
+            query_reply_printf(reply, "ERR usage: %s <sensor_id> [<sensor_id> ...]\n", stats ? "STATS" : "GET");
+            return;
+        }
+        cursor = ids;
+        while (next_id(&cursor, &id) > 0) {
+            int slot = sensor_table_lookup(&table, (sensor_id_t)id);
+
+            if (slot < 0) {
+                query_reply_printf(reply, "UNKNOWN id=%ld\n", id);
+            } else if (stats) {
+                write_stats_reply(reply, slot);
+            } else {
+                write_sensor_reply(reply, slot);
+            }
+            lines++;
+        }
+    } else if (take_word(&cursor, "HOT_ROOMS")) {
+        for (size_t room = 0; room < rooms.count; room++) {
+            const room_state_t *state = &rooms.rooms[room];
+
+            if (state->state != ALERT_STATE_HOT) continue;
+            query_reply_printf(reply, "ROOM id=%hu mean=%.2f sensors=%u/%u hottest=%hu hottest_avg=%.2f status=HOT\n",
+                               state->room_id, room_mean(&rooms, (int)room), state->warm_count, state->member_count,
+                               state->hottest < 0 ? 0 : table.sensor_ids[state->hottest],
+                               state->hottest < 0 ? 0.0 : table.averages[state->hottest]);
+            lines++;
+        }
+    } else if (take_word(&cursor, "TOP")) {
+        int *slots;
+        size_t warm = 0;
+        long extra;
+
+        if (next_id(&cursor, &id) <= 0 || id == 0 || next_id(&cursor, &extra) != 0) {
+            query_reply_printf(reply, "ERR usage: TOP <n>\n");
+            return;
+        }
+        slots = malloc((table.count == 0 ? 1 : table.count) * sizeof(*slots));
+        if (slots == NULL) {
+            query_reply_printf(reply, "ERR out of memory\n");
+            return;
+        }
+        for (size_t slot = 0; slot < table.count; slot++) {
+            if (table.sample_counts[slot] >= avg_window) slots[warm++] = (int)slot;
         }
-        sensor->temperatures[RUN_AVG_LENGTH - 1] = new_value;
-        sensor->sample_count++;
+        qsort(slots, warm, sizeof(*slots), compare_hotter);
+        for (size_t index = 0; index < warm && index < (size_t)id; index++) {
+            write_sensor_reply(reply, slots[index]);
+            lines++;
+        }
+        free(slots);
+    } else {
+        query_reply_printf(reply, "ERR unknown request (GET, STATS, HOT_ROOMS, TOP)\n");
+        return;
     }
+    query_reply_printf(reply, "END %zu\n", lines);
+}
 
-    window_size = sensor->sample_count < RUN_AVG_LENGTH ? sensor->sample_count : RUN_AVG_LENGTH;
-    for (size_t index = 0; index < window_size; index++) {
-        total += sensor->temperatures[index];
+/* Appends one reading to the current batch; a full batch is processed at once. */
+static void stage_reading(const sensor_data_t *reading, void *context)
+{
+    batch_readings[batch_count++] = *reading;
+    if (batch_count == DATAMGR_READ_BATCH) {
+        process_batch(context, batch_count);
+        batch_count = 0;
     }
-    sensor->RUN_AVG = total / (double)window_size;
 }
 
-static int read_exact(int input_fd, void *buffer, size_t size)
+static void flush_batch(logwriter_t *log)
 {
-    char *cursor = buffer;
-    size_t received = 0;
+    if (batch_count > 0) {
+        process_batch(log, batch_count);
+        batch_count = 0;
+    }
+}
+
+static void write_late_log(logwriter_t *log, int slot, const sensor_data_t *measurement)
+{
+    sensor_ts_t lag = reorder_buffers[slot].released_ts - measurement->timestamp;
+
+    if (event_log.out != NULL) {
+        eventlog_record_t record;
+
+        memset(&record, 0, sizeof(record));
+        record.type = EVENT_LATE;
+        record.room_id = measurement->room_id;
+        record.sensor_id = measurement->sensor_id;
+        record.aux = lag > UINT16_MAX ? UINT16_MAX : (uint16_t)lag;
+        record.reading.value = measurement->value;
+        eventlog_append(&event_log, &record, measurement->timestamp);
+        return;
+    }
+    if (log == NULL) return;
+    logwriter_printf(log, "LATE room=%hu sensor=%hu temp=%.2f ts=%ld lag=%ld\n", measurement->room_id,
+                     measurement->sensor_id, measurement->value, (long)measurement->timestamp, (long)lag);
+}
+
+/*
+ * Passes a dequeued reading on in timestamp order. With a watermark, readings
+ * of known sensors wait in their reorder buffer; one that arrives after a newer
+ * reading of the same sensor was already applied is logged as LATE and does not
+ * touch the sensor state. Unknown sensors go straight through to be reported.
+ */
+static void admit_reading(logwriter_t *log, const sensor_data_t *reading, time_t now)
+{
+    int slot;
+
+    if (reorder_watermark < 0) {
+        stage_reading(reading, log);
+        return;
+    }
+    slot = sensor_table_lookup(&table, reading->sensor_id);
+    if (slot < 0 || table.room_ids[slot] != reading->room_id) {
+        stage_reading(reading, log);
+        return;
+    }
+    if (reorder_push(&reorder_buffers[slot], reading, reorder_watermark, now, stage_reading, log) == REORDER_LATE) {
+        write_late_log(log, slot, reading);
+        shard_totals.late++;
+    }
+    reorder_queue_touch(&reorder_queue, reorder_buffers, slot);
+}
+
+/*
+ * Releases the buffers of sensors that went quiet, so their last readings are not held back.
+ * Only buffers holding readings are queued, and only the idle ones at its front are visited.
+ */
+static void release_reorder_buffers(logwriter_t *log, time_t now)
+{
+    sensor_ts_t idle = reorder_watermark > 0 ? reorder_watermark : 1;
+
+    if (reorder_watermark < 0) return;
+    reorder_queue_release_idle(&reorder_queue, reorder_buffers, now, idle, stage_reading, log);
+    flush_batch(log);
+}
 
-    while (received < size) {
-        ssize_t rc = read(input_fd, cursor + received, size - received);
+/* One write below PIPE_BUF (4096 on Linux), so summaries of concurrent shards never interleave. */
+_Static_assert(sizeof(datamgr_summary_t) <= 4096, "datamgr_summary_t must fit one atomic pipe write");
 
+static void send_summary(int fd, const datamgr_summary_t *summary)
+{
+    ssize_t written;
+
+    do {
+        written = write(fd, summary, sizeof(*summary));
+    } while (written < 0 && errno == EINTR);
+    if (written != (ssize_t)sizeof(*summary)) {
+        perror("datamgr summary");
+    }
+}
+
+/*
+ * Reads whatever is available on the pipe (up to one batch) and returns the
+ * number of complete records copied to 'records'. A trailing partial record is
+ * kept in 'reader' for the next call. Waits at most 'timeout_ms' (-1 = forever) so idle periods still get
+ * housekeeping such as log flushes.
+ * \return record count, 0 at end of stream, READ_BATCH_TIMEOUT, -1 on error
+ */
+static int read_batch(int input_fd, pipe_reader_t *reader, sensor_data_t *records, int timeout_ms)
+{
+    while (true) {
+        struct pollfd pfds[2 + QUERY_MAX_CLIENTS] = { { .fd = input_fd, .events = POLLIN } };
+        size_t query_fds = query_server_pollfds(&query_server, &pfds[1], QUERY_MAX_CLIENTS + 1);
+        size_t count;
+        ssize_t rc;
+
+        rc = poll(pfds, 1 + query_fds, timeout_ms);
+        if (rc < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (rc == 0) return READ_BATCH_TIMEOUT;
+        /* Queries are answered between batches, so they see the state of every reading applied so far. */
+        if (query_fds > 0) {
+            query_server_dispatch(&query_server, &pfds[1], query_fds, answer_query, NULL);
+        }
+        if (pfds[0].revents == 0) return READ_BATCH_TIMEOUT;
+
+        rc = read(input_fd, reader->bytes + reader->used, sizeof(reader->bytes) - reader->used);
         if (rc == 0) {
-            return received == 0 ? 0 : -1;
+            return reader->used == 0 ? 0 : -1;
         }
         if (rc < 0) {
             if (errno == EINTR) continue;
             return -1;
         }
-        received += (size_t)rc;
+        reader->used += (size_t)rc;
+
+        count = reader->used / sizeof(sensor_data_t);
+        if (count == 0) continue;
+        memcpy(records, reader->bytes, count * sizeof(sensor_data_t));
+        reader->used -= count * sizeof(sensor_data_t);
+        memmove(reader->bytes, reader->bytes + count * sizeof(sensor_data_t), reader->used);
+        return (int)count;
     }
-    return 1;
+}
+
+/*
+ * Moves every record waiting on the pipe into the sbuffer (as long as it has room),
+ * so an express reading overtakes the whole backlog rather than only the readings
+ * that shared its read().
+ * \return as read_batch() for the last read, -1 also if the sbuffer refused a record
+ */
+static int fill_sbuffer(int input_fd, sbuffer_t *buffer, int timeout_ms)
+{
+    int rc = read_batch(input_fd, &pipe_reader, read_records, timeout_ms);
+
+    while (rc > 0) {
+        for (int index = 0; index < rc; index++) {
+            if (sbuffer_insert(buffer, &read_records[index]) == SBUFFER_FAILURE) return -1;
+        }
+        if (sbuffer_getlength(buffer) > SBUFFER_CAPACITY - DATAMGR_READ_BATCH) break;
+        rc = read_batch(input_fd, &pipe_reader, read_records, 0);
+    }
+    return rc;
 }
 
 int datamgr_parse_sensor_pipe(int input_fd, FILE *fp_sensor_map)
 {
-    FILE *log_file;
+    logwriter_t *log = NULL;
     sbuffer_t *buffer = NULL;
-    size_t pending_data_lines = 0;
     char startup_msg[192];
+    time_t last_summary;
+    time_t last_rollup_flush;
+    time_t last_thresholds_check;
+    time_t last_checkpoint;
+    time_t restored_at;
+    bool restored;
 
     if (listen_port <= 0) {
 #ifdef PORT
@@ -191,158 +1151,194 @@ int datamgr_parse_sensor_pipe(int input_fd, FILE *fp_sensor_map)
     if (input_fd < 0 || fp_sensor_map == NULL) return -1;
     if (load_sensor_map(fp_sensor_map) != 0) return -1;
     if (sbuffer_init(&buffer) != SBUFFER_SUCCESS) return -1;
-    log_file = fopen(FIFO_LOG, "a");
-    if (log_file != NULL) {
-        // Flush each line so logs are observable in real time while debugging.
-        setvbuf(log_file, NULL, _IOLBF, 0);
+    pipe_reader.used = 0;
+    last_summary = time(NULL);
+    last_rollup_flush = last_summary;
+    pending_rollup_count = 0;
+    rollup_failing = false;
+    rollup_dropped = 0;
+    batch_count = 0;
+    shedding = false;
+    data_suppressed = 0;
+    rollup_db = init_connection(NULL);
+    if (rollup_db == NULL) {
+        fprintf(stderr, "datamgr: rollups are computed but not stored (database unavailable)\n");
+    } else {
+        /* A busy or slow database costs rollup windows, never alert latency. */
+        sensor_db_set_busy_timeout(rollup_db, ROLLUP_BUSY_MS);
+    }
+    memset(&shard_totals, 0, sizeof(shard_totals));
+    shard_totals.shard = shard_index;
+    shard_totals.sensors = (uint32_t)table.count;
+    open_checkpoint(last_summary, &restored, &restored_at);
+    thresholds.defaults = (threshold_t){ (double)SET_MIN_TEMP, (double)SET_MAX_TEMP, 0 };
+    thresholds_mtime = 0;
+    thresholds_size = -1;
+    apply_thresholds();
+    if (logwriter_open(&log_writer, log_path, &log_policy) == 0) {
+        log = &log_writer;
         snprintf(
             startup_msg,
             sizeof(startup_msg),
-            "START port=%d min=%.2f max=%.2f avg_window=%d\n",
+            "START port=%d shard=%d/%d sensors=%zu min=%.2f max=%.2f avg_window=%zu\n",
             listen_port,
+            shard_index,
+            shard_count,
+            table.count,
             (double)SET_MIN_TEMP,
             (double)SET_MAX_TEMP,
-            RUN_AVG_LENGTH
+            avg_window
         );
-        write_log_message(log_file, startup_msg);
+        write_log_message(log, startup_msg);
+        if (checkpoint.header != NULL) {
+            logwriter_printf(log, "CHECKPOINT restored=%d sensors=%zu age=%ld max_age=%d interval=%d\n",
+                             restored ? 1 : 0, restored ? table.count : (size_t)0,
+                             restored_at != 0 ? (long)(last_summary - restored_at) : 0L, checkpoint_max_age,
+                             checkpoint_interval);
+        }
+        logwriter_flush(log, false);
+    }
+    reload_thresholds(log);
+    if (restored) {
+        seed_rooms();
+    }
+    last_checkpoint = last_summary;
+    open_query_socket(log);
+    last_thresholds_check = last_summary;
+    /* Binary mode moves the per-reading events to their own file; gateway.log keeps the rest. */
+    event_log.out = NULL;
+    if (log_format == DATAMGR_LOG_BINARY) {
+        logwriter_policy_t event_policy = log_policy;
+
+        event_policy.whole_lines = false;
+        if (logwriter_open(&event_writer, event_path, &event_policy) == 0) {
+            eventlog_begin(&event_log, &event_writer, listen_port, shard_index, shard_count);
+        } else {
+            perror("datamgr: binary event log");
+        }
     }
 
     while (true) {
-        sensor_data_t measurement;
-        sensor_data_t *sensor;
-        int new_alert_state;
+        sensor_data_t reading;
+        time_t now;
         int rc;
+        int timeout_ms = HOUSEKEEPING_TICK_MS;
 
-        rc = read_exact(input_fd, &measurement, sizeof(measurement));
-        if (rc < 0) {
-            break;
+        if (log != NULL) {
+            int deadline = logwriter_next_deadline_ms(log);
+
+            if (deadline >= 0 && deadline < timeout_ms) timeout_ms = deadline;
         }
-        if (rc == 0) {
+        if (event_log.out != NULL) {
+            int deadline = logwriter_next_deadline_ms(event_log.out);
+
+            if (deadline >= 0 && deadline < timeout_ms) timeout_ms = deadline;
+        }
+        rc = fill_sbuffer(input_fd, buffer, timeout_ms);
+        if (rc == 0 || rc == -1) {
+            /* End of stream or error: what is already queued is still applied. */
             sbuffer_close(buffer);
-        } else if (sbuffer_insert(buffer, &measurement) == SBUFFER_FAILURE) {
-            break;
         }
+        update_shed_mode(log, input_fd, buffer);
 
-        while (true) {
-            rc = sbuffer_remove(buffer, &measurement);
-            if (rc == SBUFFER_NO_DATA) {
-                break;
-            }
-            if (rc == SBUFFER_CLOSED) {
-                goto datamgr_done;
-            }
-            if (rc != SBUFFER_SUCCESS) {
-                goto datamgr_done;
-            }
-
-            sensor = datamgr_get_sensor(measurement.sensor_id);
-            if (sensor == NULL) {
-                char buffer[160];
-
-                snprintf(
-                    buffer,
-                    sizeof(buffer),
-                    "INVALID_SENSOR port=%d room=%hu sensor=%hu\n",
-                    listen_port,
-                    measurement.room_id,
-                    measurement.sensor_id
-                );
-                write_log_message(log_file, buffer);
-                continue;
-            }
-            if (sensor->room_id != measurement.room_id) {
-                char buffer[192];
-
-                snprintf(
-                    buffer,
-                    sizeof(buffer),
-                    "INVALID_PAIR port=%d sensor=%hu room=%hu expected_room=%hu\n",
-                    listen_port,
-                    measurement.sensor_id,
-                    measurement.room_id,
-                    sensor->room_id
-                );
-                write_log_message(log_file, buffer);
-                continue;
-            }
-
-            sensor->value = measurement.value;
-            sensor->timestamp = measurement.timestamp;
-            update_running_average(sensor, measurement.value);
-            new_alert_state = ALERT_STATE_NORMAL;
-
-            if (sensor->sample_count >= RUN_AVG_LENGTH) {
-                char buffer[160];
-
-                if (sensor->RUN_AVG < SET_MIN_TEMP) {
-                    new_alert_state = ALERT_STATE_COLD;
-                } else if (sensor->RUN_AVG > SET_MAX_TEMP) {
-                    new_alert_state = ALERT_STATE_HOT;
-                }
-
-                /*
-                 * Log only state transitions to avoid alert spam:
-                 * NORMAL->HOT/COLD, HOT/COLD->NORMAL.
-                 */
-                if (new_alert_state != sensor->alert_state) {
-                    if (new_alert_state == ALERT_STATE_COLD) {
-                        snprintf(
-                            buffer,
-                            sizeof(buffer),
-                            "ALERT room=%hu sensor=%hu status=COLD avg=%.2f\n",
-                            sensor->room_id,
-                            sensor->sensor_id,
-                            sensor->RUN_AVG
-                        );
-                        write_log_message(log_file, buffer);
-                    } else if (new_alert_state == ALERT_STATE_HOT) {
-                        snprintf(
-                            buffer,
-                            sizeof(buffer),
-                            "ALERT room=%hu sensor=%hu status=HOT avg=%.2f\n",
-                            sensor->room_id,
-                            sensor->sensor_id,
-                            sensor->RUN_AVG
-                        );
-                        write_log_message(log_file, buffer);
-                    } else {
-                        snprintf(
-                            buffer,
-                            sizeof(buffer),
-                            "RECOVERY room=%hu sensor=%hu status=NORMAL avg=%.2f\n",
-                            sensor->room_id,
-                            sensor->sensor_id,
-                            sensor->RUN_AVG
-                        );
-                        write_log_message(log_file, buffer);
-                    }
-                }
-            }
-
-            sensor->alert_state = new_alert_state;
-            write_data_log(log_file, sensor);
-            pending_data_lines++;
-            /* Periodic flush safeguard for long high-frequency runs. */
-            if (log_file != NULL && pending_data_lines >= 128) {
-                fflush(log_file);
-                pending_data_lines = 0;
+        now = time(NULL);
+        arrival_time = now;
+        while ((rc = sbuffer_remove(buffer, &reading)) == SBUFFER_SUCCESS) {
+            admit_reading(log, &reading, now);
+        }
+        flush_batch(log);
+        if (rc != SBUFFER_NO_DATA) {
+            goto datamgr_done;
+        }
+        release_reorder_buffers(log, now);
+        /* Only the buckets of the elapsed seconds are visited; healthy sensors were re-armed into later ones. */
+        liveness_tick(&liveness, now, write_liveness_log, log);
+        if (summary_interval > 0 && now - last_summary >= summary_interval) {
+            write_summaries(log);
+            last_summary = now;
+        }
+        /* Hot reload: the thresholds file is checked once per second. */
+        if (now != last_thresholds_check) {
+            reload_thresholds(log);
+            last_thresholds_check = now;
+        }
+        /* The arena is the mapping, so a checkpoint is just a writeback of dirty pages. */
+        if (checkpoint.header != NULL && now - last_checkpoint >= checkpoint_interval) {
+            (void)checkpoint_sync(&checkpoint, now, false);
+            last_checkpoint = now;
+        }
+        /* Closed windows go to storage in one transaction per flush. */
+        if (pending_rollup_count > 0 && now - last_rollup_flush >= ROLLUP_FLUSH_SECONDS) {
+            if (flush_rollups() != 0 && log != NULL) {
+                logwriter_printf(log, "ROLLUP_DEFERRED pending=%zu dropped=%llu\n", pending_rollup_count,
+                                 rollup_dropped);
             }
+            last_rollup_flush = now;
+        }
+        /* Size/age flush policy; alerts were already flushed when written. */
+        if (log != NULL) {
+            logwriter_poll(log);
+        }
+        if (event_log.out != NULL) {
+            logwriter_poll(event_log.out);
         }
     }
 
 datamgr_done:
-    if (log_file != NULL) {
-        fflush(log_file);
-        write_log_message(log_file, "STOP receiver drained queue and exited\n");
-        fclose(log_file);
+    for (size_t slot = 0; slot < table.count && reorder_watermark >= 0; slot++) {
+        reorder_flush(&reorder_buffers[slot], stage_reading, log);
+    }
+    flush_batch(log);
+    write_summaries(log);
+    for (size_t slot = 0; slot < table.count; slot++) {
+        rollup_close_all(&sensor_rollups[slot], collect_rollup, NULL);
+    }
+    /* Alert latency no longer matters; wait for the lock rather than lose the last windows. */
+    if (rollup_db != NULL) sensor_db_set_busy_timeout(rollup_db, ROLLUP_EXIT_BUSY_MS);
+    if (flush_rollups() != 0 || rollup_dropped > 0) {
+        fprintf(stderr, "datamgr: dropped %llu rollup windows\n",
+                rollup_dropped + (unsigned long long)pending_rollup_count);
+    }
+    if (rollup_db != NULL) {
+        disconnect(rollup_db);
+        rollup_db = NULL;
     }
+    if (summary_fd >= 0) {
+        send_summary(summary_fd, &shard_totals);
+    }
+    if (event_log.out != NULL) {
+        logwriter_close(event_log.out);
+        event_log.out = NULL;
+    }
+    if (log != NULL && data_suppressed > 0) {
+        logwriter_printf(log, "DATA_LOG suppressed=%llu\n", data_suppressed);
+    }
+    if (log != NULL) {
+        write_log_message(log, "STOP receiver drained queue and exited\n");
+        logwriter_close(log);
+    }
+    query_server_close(&query_server);
+    checkpoint_close(&checkpoint, &table);
     sbuffer_free(&buffer);
     return 0;
 }
 
 void datamgr_free(void)
 {
-    if (list != NULL) {
-        dpl_free(&list, true);
-    }
+    sensor_table_free(&table);
+    room_index_free(&rooms);
+    free(sensor_stats);
+    sensor_stats = NULL;
+    free(sensor_rollups);
+    sensor_rollups = NULL;
+    free(last_logged_values);
+    last_logged_values = NULL;
+    free(data_log_counters);
+    data_log_counters = NULL;
+    free(reorder_buffers);
+    reorder_buffers = NULL;
+    free(room_limits);
+    room_limits = NULL;
+    liveness_free(&liveness);
+    thresholds_free(&thresholds);
 }
@@ -1,47 +1,180 @@
 #ifndef DATAMGR_H_
 #define DATAMGR_H_
-
+
 #include <stdlib.h>
 #include <stdio.h>
 #include "config.h"
-#include "lib/dplist.h"
+#include "liveness.h"
+#include "logwriter.h"
 #include "sbuffer.h"
-
-#ifndef RUN_AVG_LENGTH
-#define RUN_AVG_LENGTH 5
-#endif
-
-#ifndef SET_MAX_TEMP
-  #error SET_MAX_TEMP not set
-#endif
-
-#ifndef SET_MIN_TEMP
-  #error SET_MIN_TEMP not set
-#endif
-
-
-/*
- * Use ERROR_HANDLER() for handling memory allocation problems, invalid sensor IDs, non-existing files, etc.
- */
-#define ERROR_HANDLER(condition, ...)    do {                       \
-                      if (condition) {                              \
-                        printf("\nError: in %s - function %s at line %d: %s\n", __FILE__, __func__, __LINE__, __VA_ARGS__); \
-                        exit(EXIT_FAILURE);                         \
-                      }                                             \
-                    } while(0)
-
-
+#include "sensor_stats.h"
+
+#ifndef RUN_AVG_LENGTH
+#define RUN_AVG_LENGTH 5
+#endif
+
+#define DATAMGR_LOG_TEXT 0
+#define DATAMGR_LOG_BINARY 1
+
+/* Which readings produce a DATA line; state updates and alerts are never affected. */
+#define DATAMGR_DATA_LOG_ALL 0      // every reading
+#define DATAMGR_DATA_LOG_EVERY 1    // every Nth reading per sensor
+#define DATAMGR_DATA_LOG_DELTA 2    // when the value moved more than X since the last logged one
+#define DATAMGR_DATA_LOG_ALERTS 3   // no DATA lines, only ALERT/RECOVERY
+
+#ifndef SET_MAX_TEMP
+  #error SET_MAX_TEMP not set
+#endif
+
+#ifndef SET_MIN_TEMP
+  #error SET_MIN_TEMP not set
+#endif
+
+
+/*
+ * Use ERROR_HANDLER() for handling memory allocation problems, invalid sensor IDs, non-existing files, etc.
+ */
+#define ERROR_HANDLER(condition, ...)    do {                       \
+                      if (condition) {                              \
+                        printf("\nError: in %s - function %s at line %d: %s\n", __FILE__, __func__, __LINE__, __VA_ARGS__); \
+                        exit(EXIT_FAILURE);                         \
+                      }                                             \
+                    } while(0)
+
+
+/**
+ * Totals of one datamgr shard, sent to the parent over the summary pipe at exit
+ * and merged there into the gateway-level summary.
+ */
+typedef struct {
+    int32_t shard;
+    uint32_t sensors;           /**< sensors owned by the shard */
+    uint64_t readings;          /**< accepted readings */
+    uint64_t invalid;           /**< INVALID_SENSOR / INVALID_PAIR readings */
+    uint64_t alerts;            /**< sensor ALERT + RECOVERY transitions */
+    uint64_t late;              /**< readings behind the reorder watermark (LATE) */
+    sensor_stats_t stats;       /**< every accepted reading of the shard */
+} datamgr_summary_t;
+
 /**
  *  Reads validated measurements from the connmgr pipe and updates
  *  the in-memory sensor state plus gateway.log output.
  */
 void datamgr_set_listen_port(int port);
+
+/**
+ * Sets the running average window length (samples per sensor), chosen at startup.
+ * Must be called before datamgr_parse_sensor_pipe().
+ * \param window number of samples, 1..RUN_AVG_LENGTH_MAX
+ * \return zero on success, -1 if the length is out of range
+ */
+int datamgr_set_avg_window(size_t window);
+/**
+ * Selects the slice of the sensor registry this datamgr process owns: the
+ * sensors of the rooms that room_shard_of() assigns to it.
+ * With more than one shard the output goes to gateway.log.<shard>.
+ * \param shard index of this process, 0..shard_count-1
+ * \param shard_count number of datamgr processes
+ */
+void datamgr_set_shard(int shard, int shard_count);
+
+/**
+ * Sets the pipe that receives this shard's datamgr_summary_t at exit, -1 for none
+ */
+void datamgr_set_summary_fd(int fd);
+
+/**
+ * Sets how often SUMMARY lines (min/max/mean/stddev/ewma/p50/p95/p99 per sensor)
+ * are written to gateway.log. Statistics restart after every summary.
+ * \param seconds interval in seconds, 0 disables periodic summaries
+ */
+void datamgr_set_summary_interval(int seconds);
+
+/**
+ * Sets when buffered gateway.log output is handed to the log writer stage
+ * ALERT/RECOVERY and ROOM_ALERT/ROOM_RECOVERY lines flush immediately when
+ * 'flush_on_alert' is set; everything else waits for the size or age limit.
+ */
+void datamgr_set_log_policy(const logwriter_policy_t *policy);
+
+/**
+ * Selects how per-reading events (DATA, ALERT, RECOVERY, INVALID_*, ROOM_ALERT,
+ * ROOM_RECOVERY) are logged. DATAMGR_LOG_BINARY writes fixed-size records to
+ * gateway.evlog (see eventlog.h, decode with gateway_logcat) instead of text lines.
+ */
+void datamgr_set_log_format(int format);
+
+/**
+ * Selects which readings produce a DATA line
+ * \param mode one of DATAMGR_DATA_LOG_*
+ * \param parameter N for DATAMGR_DATA_LOG_EVERY (>= 1), X for DATAMGR_DATA_LOG_DELTA (>= 0), ignored otherwise
+ * \return zero on success, -1 for an invalid mode or parameter
+ */
+int datamgr_set_data_log(int mode, double parameter);
+
+/**
+ * Sets the queue depth (sbuffer plus unread pipe data, in readings) above which
+ * datamgr stops writing DATA lines until the backlog falls below a quarter of it.
+ * \param depth threshold in readings, 0 disables shedding
+ */
+void datamgr_set_shed_depth(int depth);
+
+/**
+ * Enables per-sensor reordering: a reading is applied once a reading at least
+ * 'seconds' newer of the same sensor arrived (or that much wall-clock time
+ * passed), so readings delivered out of order are applied by timestamp. Readings
+ * older than one already applied are counted and logged as LATE instead.
+ * \param seconds allowed lateness, -1 disables reordering (arrival order)
+ */
+void datamgr_set_reorder_watermark(int seconds);
+
+/**
+ * Sets the thresholds file (default THRESHOLDS_FILE) with per-sensor and per-room
+ * alert bands and hysteresis; see thresholds.h for the format. The file is
+ * re-read while running whenever it changes. Without it SET_MIN_TEMP and
+ * SET_MAX_TEMP apply to every sensor and room.
+ */
+void datamgr_set_thresholds_file(const char *path);
+
+/**
+ * Sets when a sensor is reported SILENT (no reading for max(silence_min,
+ * silence_factor x its learned reading interval)), STUCK (the same value for
+ * stuck_seconds) or RATE_ANOMALY (readings per rate_window rate_factor times
+ * above or below its learned rate). Must be called before datamgr_parse_sensor_pipe().
+ */
+void datamgr_set_liveness(const liveness_config_t *config);
+
+/**
+ * Sets the Unix socket (QUERY_SOCKET by default) on which datamgr answers
+ * GET <id>..., HOT_ROOMS and TOP <n> from its in-memory state; see datamgr.c
+ * for the protocol. An empty path disables the endpoint.
+ */
+void datamgr_set_query_socket(const char *path);
+
+/**
+ * Sets the sensor state snapshot (CHECKPOINT_FILE by default). The sensor table
+ * lives in the memory-mapped file, which is written back every 'interval'
+ * seconds and at exit; a restart with the same sensor map and window resumes
+ * from it without WARMUP, unless the snapshot is older than 'max_age' seconds.
+ * \param interval seconds between writebacks, 0 disables the snapshot
+ * \param max_age oldest snapshot restored (CHECKPOINT_MAX_AGE by default), 0 = any age
+ */
+void datamgr_set_checkpoint(const char *path, int interval, int max_age);
+
+/**
+ * Copies the live statistics of one sensor for the current summary interval
+ * \param sensor_id the sensor to query
+ * \param stats destination of the copy
+ * \return zero on success, -1 if the sensor is unknown or datamgr is not running
+ */
+int datamgr_get_sensor_stats(sensor_id_t sensor_id, sensor_stats_t *stats);
+
 int datamgr_parse_sensor_pipe(int input_fd, FILE *fp_sensor_data);
-
-/**
- * This method should be called to clean up the datamgr, and to free all used memory. 
- * After this, any call to datamgr_get_room_id, datamgr_get_avg, datamgr_get_last_modified or datamgr_get_total_sensors will not return a valid result
- */
+
+/**
+ * This method should be called to clean up the datamgr, and to free all used memory. 
+ * After this, any call to datamgr_get_room_id, datamgr_get_avg, datamgr_get_last_modified or datamgr_get_total_sensors will not return a valid result
+ */
 void datamgr_free(void);
 
 #endif  //DATAMGR_H_
@@ -0,0 +1,224 @@
+/**
+ * \author Yongkai Zhang
+ *
+ * Measures insert and query throughput of Sensor.db for every SQLite tuning
+ * profile (see sensor_db_profiles()). Run it from a directory on the disk to
+ * be measured; it works on its own database file, DB_NAME at build time.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "sensor_db.h"
+
+#define BENCH_SENSORS 64        // readings cycle over this many sensor ids
+#define BENCH_ROWS 200000
+#define BENCH_QUERIES 50
+#define BENCH_FETCH_ROWS 256
+
+typedef struct {
+    int rows;
+    int queries;
+    int batch;
+    const char *profile;        /**< NULL = every built-in profile */
+    bool keep;                  /**< leave the database of the last profile behind */
+} bench_options_t;
+
+static void print_usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [--rows=N] [--queries=N] [--batch=N] [--profile=NAME] [--keep]\n", program);
+    fprintf(stderr, "  inserts N readings into %s, then runs N timestamp and sensor-range queries,\n"
+            "  once per profile\n", TO_STRING(DB_NAME));
+}
+
+static int parse_count(const char *text, int min_value)
+{
+    char *endptr = NULL;
+    long value;
+
+    errno = 0;
+    value = strtol(text, &endptr, 10);
+    if (errno != 0 || endptr == text || *endptr != '\0' || value < min_value || value > 100000000) return -1;
+    return (int)value;
+}
+
+static int parse_args(int argc, char *argv[], bench_options_t *options)
+{
+    options->rows = BENCH_ROWS;
+    options->queries = BENCH_QUERIES;
+    options->batch = DB_BATCH_ROWS;
+    options->profile = NULL;
+    options->keep = false;
+
+    for (int index = 1; index < argc; index++) {
+        const char *arg = argv[index];
+
+        if (strncmp(arg, "--rows=", 7) == 0) {
+            if ((options->rows = parse_count(arg + 7, 1)) < 0) return -1;
+        } else if (strncmp(arg, "--queries=", 10) == 0) {
+            if ((options->queries = parse_count(arg + 10, 0)) < 0) return -1;
+        } else if (strncmp(arg, "--batch=", 8) == 0) {
+            if ((options->batch = parse_count(arg + 8, 1)) < 0) return -1;
+        } else if (strncmp(arg, "--profile=", 10) == 0) {
+            options->profile = arg + 10;
+            if (sensor_db_find_profile(options->profile) == NULL) return -1;
+        } else if (strcmp(arg, "--keep") == 0) {
+            options->keep = true;
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static double elapsed_ms(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) * 1000.0 + (double)(now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static void remove_database(void)
+{
+    static const char *suffixes[] = { "", "-wal", "-shm", "-journal" };
+    char path[256];
+
+    for (size_t index = 0; index < sizeof(suffixes) / sizeof(suffixes[0]); index++) {
+        snprintf(path, sizeof(path), "%s%s", TO_STRING(DB_NAME), suffixes[index]);
+        (void)unlink(path);
+    }
+}
+
+/* Drains one query through a cursor; returns the number of rows, -1 on error. */
+static long long drain_query(DBCONN *conn, sensor_db_query_t query, uint16_t id, sensor_ts_t from, sensor_ts_t to)
+{
+    sensor_data_t rows[BENCH_FETCH_ROWS];
+    sensor_db_cursor_t cursor;
+    long long total = 0;
+    ssize_t count;
+
+    if (sensor_db_cursor_open(conn, &cursor, query, id, 0, from, to) != 0) return -1;
+    while ((count = sensor_db_cursor_next(&cursor, rows, BENCH_FETCH_ROWS)) > 0) {
+        total += count;
+    }
+    sensor_db_cursor_close(&cursor);
+    return count < 0 ? -1 : total;
+}
+
+static int read_pragma(DBCONN *conn, const char *sql, char *buffer, size_t size)
+{
+    sqlite3_stmt *stmt = NULL;
+    int rc = -1;
+
+    if (sqlite3_prepare_v2(conn->handle, sql, -1, &stmt, NULL) != SQLITE_OK) return -1;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        snprintf(buffer, size, "%s", (const char *)sqlite3_column_text(stmt, 0));
+        rc = 0;
+    }
+    sqlite3_finalize(stmt);
+    return rc;
+}
+
+static int run_profile(const bench_options_t *options, const sensor_db_profile_t *profile)
+{
+    const sensor_ts_t base_ts = 1700000000;
+    const int span = options->rows / BENCH_SENSORS + 1;
+    char journal[32] = "?";
+    char page_size[32] = "?";
+    struct timespec start;
+    double insert_ms;
+    double close_ms;
+    double query_ms;
+    unsigned long long rows_returned = 0;
+    DBCONN *conn;
+
+    remove_database();
+    sensor_db_set_profile(profile->name);
+    conn = init_connection(NULL);
+    if (conn == NULL) return -1;
+    read_pragma(conn, "PRAGMA journal_mode;", journal, sizeof(journal));
+    read_pragma(conn, "PRAGMA page_size;", page_size, sizeof(page_size));
+    sensor_db_set_batch(conn, (size_t)options->batch, 0);
+
+    srand(1);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int row = 0; row < options->rows; row++) {
+        sensor_value_t value = 15.0 + (double)(rand() % 1000) / 100.0;
+
+        if (insert_sensor(conn, (sensor_id_t)(1 + row % BENCH_SENSORS), value, base_ts + row / BENCH_SENSORS) != 0) {
+            disconnect(conn);
+            return -1;
+        }
+    }
+    if (sensor_db_flush(conn) != 0) {
+        disconnect(conn);
+        return -1;
+    }
+    insert_ms = elapsed_ms(&start);
+
+    /* The last close checkpoints the WAL into the database file. */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    disconnect(conn);
+    close_ms = elapsed_ms(&start);
+
+    conn = init_connection(NULL);
+    if (conn == NULL) return -1;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int query = 0; query < options->queries; query++) {
+        sensor_ts_t ts = base_ts + rand() % span;
+        long long rows;
+
+        /* Alternate a point-in-time lookup with a one-minute history of one sensor. */
+        if (query % 2 == 0) {
+            rows = drain_query(conn, SENSOR_DB_QUERY_TS_EQ, 0, ts, ts);
+        } else {
+            rows = drain_query(conn, SENSOR_DB_QUERY_SENSOR_RANGE, (uint16_t)(1 + rand() % BENCH_SENSORS), ts, ts + 59);
+        }
+        if (rows < 0) {
+            disconnect(conn);
+            return -1;
+        }
+        rows_returned += (unsigned long long)rows;
+    }
+    query_ms = elapsed_ms(&start);
+    disconnect(conn);
+
+    printf("BENCH profile=%s journal=%s page_size=%s batch=%d rows=%d insert_ms=%.1f rows_per_s=%.0f "
+           "close_ms=%.1f queries=%d query_ms=%.1f queries_per_s=%.1f rows_returned=%llu\n",
+           profile->name, journal, page_size, options->batch, options->rows, insert_ms,
+           insert_ms > 0 ? options->rows * 1000.0 / insert_ms : 0.0, close_ms, options->queries, query_ms,
+           query_ms > 0 ? options->queries * 1000.0 / query_ms : 0.0, rows_returned);
+    fflush(stdout);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    bench_options_t options;
+    const sensor_db_profile_t *profiles;
+    size_t count;
+    int status = EXIT_SUCCESS;
+
+    if (parse_args(argc, argv, &options) != 0) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    profiles = sensor_db_profiles(&count);
+    for (size_t index = 0; index < count; index++) {
+        if (options.profile != NULL && strcmp(options.profile, profiles[index].name) != 0) continue;
+        if (run_profile(&options, &profiles[index]) != 0) {
+            fprintf(stderr, "profile %s failed\n", profiles[index].name);
+            status = EXIT_FAILURE;
+        }
+    }
+    if (!options.keep) remove_database();
+    return status;
+}
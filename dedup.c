@@ -0,0 +1,106 @@
+/**
+ * \author Yongkai Zhang
+ */
+
+#define _DEFAULT_SOURCE     // MAP_ANONYMOUS, robust mutexes
+
+#include <errno.h>
+#include <sys/mman.h>
+#include "dedup.h"
+
+#define DEDUP_SENSOR_SPACE 65536
+
+int dedup_init(dedup_table_t *table)
+{
+    pthread_mutexattr_t attr;
+    void *memory;
+    int rc = 0;
+
+    table->size = DEDUP_SENSOR_SPACE * sizeof(dedup_entry_t);
+    memory = mmap(NULL, table->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        table->entries = NULL;
+        table->size = 0;
+        return -1;
+    }
+    /* Anonymous mappings are zero-filled: nothing seen yet. */
+    table->entries = memory;
+    if (pthread_mutexattr_init(&attr) != 0) {
+        dedup_free(table);
+        return -1;
+    }
+    if (pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED) != 0 ||
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST) != 0) {
+        rc = -1;
+    }
+    for (size_t sensor = 0; sensor < DEDUP_SENSOR_SPACE && rc == 0; sensor++) {
+        if (pthread_mutex_init(&table->entries[sensor].lock, &attr) != 0) rc = -1;
+    }
+    pthread_mutexattr_destroy(&attr);
+    if (rc != 0) dedup_free(table);
+    return rc;
+}
+
+void dedup_free(dedup_table_t *table)
+{
+    if (table->entries != NULL) {
+        munmap(table->entries, table->size);
+    }
+    table->entries = NULL;
+    table->size = 0;
+}
+
+static void start_epoch(dedup_entry_t *entry, uint32_t epoch, uint32_t seq)
+{
+    if (entry->seen) {
+        entry->previous_epoch = entry->epoch;
+        entry->has_previous = true;
+    }
+    entry->seen = true;
+    entry->epoch = epoch;
+    entry->highest = seq;
+    entry->window = 1;
+}
+
+static int record_seq(dedup_entry_t *entry, uint32_t epoch, uint32_t seq)
+{
+    int32_t distance;
+    uint32_t behind;
+
+    if (!entry->seen || epoch != entry->epoch) {
+        if (entry->seen && entry->has_previous && epoch == entry->previous_epoch) return DEDUP_STALE;
+        start_epoch(entry, epoch, seq);
+        return DEDUP_NEW;
+    }
+    /* Serial-number arithmetic: the distance stays meaningful across wrap-around. */
+    distance = (int32_t)(seq - entry->highest);
+    if (distance > 0) {
+        entry->window = distance >= DEDUP_WINDOW ? 0 : entry->window << distance;
+        entry->window |= 1;
+        entry->highest = seq;
+        return DEDUP_NEW;
+    }
+
+    behind = (uint32_t)-(int64_t)distance;
+    if (behind >= DEDUP_WINDOW) return DEDUP_STALE;
+    if (entry->window & ((uint64_t)1 << behind)) return DEDUP_DUPLICATE;
+    entry->window |= (uint64_t)1 << behind;
+    return DEDUP_NEW;
+}
+
+int dedup_check(dedup_table_t *table, sensor_id_t sensor_id, uint32_t epoch, uint32_t seq)
+{
+    dedup_entry_t *entry = &table->entries[sensor_id];
+    int result;
+    int rc = pthread_mutex_lock(&entry->lock);
+
+    if (rc == EOWNERDEAD) {
+        /* A worker died while updating; the entry is whole apart from that one reading. */
+        pthread_mutex_consistent(&entry->lock);
+    } else if (rc != 0) {
+        return DEDUP_NEW;
+    }
+    result = record_seq(entry, epoch, seq);
+    pthread_mutex_unlock(&entry->lock);
+    return result;
+}
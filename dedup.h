@@ -0,0 +1,65 @@
+/**
+ * \author Yongkai Zhang
+ */
+
+#ifndef _DEDUP_H_
+#define _DEDUP_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "config.h"
+
+#define DEDUP_WINDOW 64             // sequence numbers remembered below the highest one
+
+#define DEDUP_NEW 0
+#define DEDUP_DUPLICATE 1
+#define DEDUP_STALE 2
+
+/**
+ * Sequence state of one sensor: the sender run (epoch) being tracked, the
+ * highest sequence number seen in it and a bitmap of the DEDUP_WINDOW numbers
+ * below it (bit i = highest - i seen).
+ */
+typedef struct {
+    pthread_mutex_t lock;       /**< robust and process-shared: a worker that dies holding it is recovered */
+    bool seen;
+    uint32_t epoch;
+    uint32_t previous_epoch;    /**< the run before 'epoch'; its readings are replays */
+    bool has_previous;
+    uint32_t highest;
+    uint64_t window;
+} dedup_entry_t;
+
+/**
+ * One entry per possible sensor_id, in memory shared by all connmgr workers
+ * so a sensor that reconnects (new worker) is still checked against its history.
+ */
+typedef struct {
+    dedup_entry_t *entries;
+    size_t size;
+} dedup_table_t;
+
+/**
+ * Maps a shared table and initialises its locks; call before forking the workers
+ * \return zero on success, -1 if the mapping or a lock cannot be set up
+ */
+int dedup_init(dedup_table_t *table);
+
+/**
+ * Unmaps the table
+ */
+void dedup_free(dedup_table_t *table);
+
+/**
+ * Records ('epoch', 'seq') for 'sensor_id' in O(1)
+ * Senders draw a new epoch per run and number each run from 0. A new epoch
+ * starts the history over from 'seq'; readings of the epoch it replaced are
+ * replays and reported as stale. Within an epoch, numbers compare with
+ * wrap-around, and one DEDUP_WINDOW or more below the highest is stale.
+ * \return DEDUP_NEW the first time a sequence number is seen, DEDUP_DUPLICATE when
+ *         it was seen before, DEDUP_STALE when it is too far back to tell
+ */
+int dedup_check(dedup_table_t *table, sensor_id_t sensor_id, uint32_t epoch, uint32_t seq);
+
+#endif /* _DEDUP_H_ */
@@ -0,0 +1,120 @@
+/**
+ * \author Yongkai Zhang
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "eventlog.h"
+
+static void write_keyframe(eventlog_writer_t *writer, int64_t ts)
+{
+    eventlog_record_t keyframe;
+
+    memset(&keyframe, 0, sizeof(keyframe));
+    keyframe.type = EVENT_KEYFRAME;
+    keyframe.base_ts = ts;
+    logwriter_write(writer->out, &keyframe, sizeof(keyframe));
+    writer->last_ts = ts;
+    writer->since_keyframe = 0;
+}
+
+void eventlog_begin(eventlog_writer_t *writer, logwriter_t *out, int port, int shard, int shard_count)
+{
+    eventlog_header_t header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, EVENTLOG_MAGIC, sizeof(EVENTLOG_MAGIC));
+    header.version = EVENTLOG_VERSION;
+    header.record_size = (uint16_t)sizeof(eventlog_record_t);
+    header.port = port;
+    header.shard = (int16_t)shard;
+    header.shard_count = (int16_t)shard_count;
+    header.base_ts = 0;
+
+    writer->out = out;
+    writer->last_ts = 0;
+    writer->since_keyframe = EVENTLOG_KEYFRAME_INTERVAL;   // first event starts with a keyframe
+    logwriter_write(out, &header, sizeof(header));
+}
+
+void eventlog_append(eventlog_writer_t *writer, eventlog_record_t *record, sensor_ts_t ts)
+{
+    int64_t delta = (int64_t)ts - writer->last_ts;
+
+    /* Absolute time now and then, and whenever the delta does not fit. */
+    if (writer->since_keyframe >= EVENTLOG_KEYFRAME_INTERVAL || delta > INT32_MAX || delta < INT32_MIN) {
+        write_keyframe(writer, (int64_t)ts);
+        delta = 0;
+    }
+    record->ts_delta = (int32_t)delta;
+    record->reserved = 0;
+    writer->last_ts = (int64_t)ts;
+    writer->since_keyframe++;
+    logwriter_write(writer->out, record, sizeof(*record));
+}
+
+int eventlog_decode(eventlog_reader_t *reader, const void *unit, eventlog_record_t *record, int64_t *ts)
+{
+    const eventlog_record_t *event = unit;
+
+    if (memcmp(unit, EVENTLOG_MAGIC, sizeof(EVENTLOG_MAGIC)) == 0) {
+        eventlog_header_t header;
+
+        memcpy(&header, unit, sizeof(header));
+        if (header.version != EVENTLOG_VERSION || header.record_size != sizeof(eventlog_record_t)) return -1;
+        reader->port = header.port;
+        reader->ts = header.base_ts;
+        reader->has_header = true;
+        return 0;
+    }
+    if (!reader->has_header || event->type == 0 || event->type >= EVENT_TYPE_COUNT) return -1;
+    if (event->type == EVENT_KEYFRAME) {
+        reader->ts = event->base_ts;
+        return 0;
+    }
+
+    reader->ts += event->ts_delta;
+    *record = *event;
+    *ts = reader->ts;
+    return 1;
+}
+
+static const char *status_to_text(int8_t status)
+{
+    if (status == EVENT_STATUS_COLD) return "COLD";
+    if (status == EVENT_STATUS_HOT) return "HOT";
+    if (status == EVENT_STATUS_WARMUP) return "WARMUP";
+    return "NORMAL";
+}
+
+int eventlog_format(const eventlog_reader_t *reader, const eventlog_record_t *record, int64_t ts,
+                    char *buffer, size_t size)
+{
+    switch (record->type) {
+    case EVENT_DATA:
+        return snprintf(buffer, size, "DATA port=%d room=%hu sensor=%hu temp=%.2f avg=%.2f status=%s ts=%ld\n",
+                        reader->port, record->room_id, record->sensor_id, record->reading.value,
+                        record->reading.average, status_to_text(record->status), (long)ts);
+    case EVENT_ALERT:
+    case EVENT_RECOVERY:
+        return snprintf(buffer, size, "%s room=%hu sensor=%hu status=%s avg=%.2f\n",
+                        record->type == EVENT_ALERT ? "ALERT" : "RECOVERY", record->room_id,
+                        record->sensor_id, status_to_text(record->status), record->reading.average);
+    case EVENT_INVALID_SENSOR:
+        return snprintf(buffer, size, "INVALID_SENSOR port=%d room=%hu sensor=%hu\n",
+                        reader->port, record->room_id, record->sensor_id);
+    case EVENT_INVALID_PAIR:
+        return snprintf(buffer, size, "INVALID_PAIR port=%d sensor=%hu room=%hu expected_room=%hu\n",
+                        reader->port, record->sensor_id, record->room_id, record->aux);
+    case EVENT_ROOM_ALERT:
+    case EVENT_ROOM_RECOVERY:
+        return snprintf(buffer, size, "%s room=%hu status=%s mean=%.2f hottest=%hu coldest=%hu\n",
+                        record->type == EVENT_ROOM_ALERT ? "ROOM_ALERT" : "ROOM_RECOVERY", record->room_id,
+                        status_to_text(record->status), record->reading.value, record->aux, record->aux2);
+    case EVENT_LATE:
+        return snprintf(buffer, size, "LATE room=%hu sensor=%hu temp=%.2f ts=%ld lag=%u\n",
+                        record->room_id, record->sensor_id, record->reading.value, (long)ts, (unsigned)record->aux);
+    default:
+        return snprintf(buffer, size, "UNKNOWN type=%u\n", (unsigned)record->type);
+    }
+}
@@ -0,0 +1,125 @@
+/**
+ * \author Yongkai Zhang
+ */
+
+#ifndef _EVENTLOG_H_
+#define _EVENTLOG_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "config.h"
+#include "logwriter.h"
+
+#define EVENTLOG_FILE "gateway.evlog"   // binary counterpart of FIFO_LOG
+#define EVENTLOG_MAGIC "GWEVLOG"        // 7 chars + NUL fill the 8-byte magic
+#define EVENTLOG_VERSION 1
+#define EVENTLOG_KEYFRAME_INTERVAL 1024 // records between absolute timestamps
+
+/** Record tags. Values stay below 'G' so a header can never look like a record. */
+enum {
+    EVENT_KEYFRAME = 1,
+    EVENT_DATA,
+    EVENT_ALERT,
+    EVENT_RECOVERY,
+    EVENT_INVALID_SENSOR,
+    EVENT_INVALID_PAIR,
+    EVENT_ROOM_ALERT,
+    EVENT_ROOM_RECOVERY,
+    EVENT_LATE,
+    EVENT_TYPE_COUNT
+};
+
+/** Status values; -1/0/1 match the datamgr alert states */
+enum {
+    EVENT_STATUS_COLD = -1,
+    EVENT_STATUS_NORMAL = 0,
+    EVENT_STATUS_HOT = 1,
+    EVENT_STATUS_WARMUP = 2
+};
+
+/**
+ * Written once per datamgr run, so appended runs stay decodable.
+ * Also acts as a keyframe.
+ */
+typedef struct {
+    char magic[8];
+    uint16_t version;
+    uint16_t record_size;
+    int32_t port;
+    int16_t shard;
+    int16_t shard_count;
+    uint32_t reserved;
+    int64_t base_ts;
+} eventlog_header_t;
+
+/**
+ * One event. 'ts_delta' is relative to the previous record; keyframes carry
+ * the absolute timestamp so a reader can resynchronise.
+ */
+typedef struct {
+    uint8_t type;
+    int8_t status;
+    uint16_t room_id;
+    uint16_t sensor_id;
+    uint16_t aux;               /**< expected room (INVALID_PAIR), hottest sensor (ROOM_*), lag (LATE) */
+    int32_t ts_delta;
+    uint16_t aux2;              /**< coldest sensor (ROOM_*) */
+    uint16_t reserved;
+    union {
+        struct {
+            double value;       /**< reading, or room mean for ROOM_* */
+            double average;
+        } reading;
+        int64_t base_ts;        /**< EVENT_KEYFRAME */
+    };
+} eventlog_record_t;
+
+_Static_assert(sizeof(eventlog_header_t) == sizeof(eventlog_record_t), "header and records share one unit size");
+
+/**
+ * Encoder state of one binary log
+ */
+typedef struct {
+    logwriter_t *out;
+    int64_t last_ts;
+    uint32_t since_keyframe;
+} eventlog_writer_t;
+
+/**
+ * Decoder state; feed it units of sizeof(eventlog_record_t) bytes
+ */
+typedef struct {
+    int port;
+    int64_t ts;
+    bool has_header;
+} eventlog_reader_t;
+
+/**
+ * Writes the header of a new run to 'out'
+ */
+void eventlog_begin(eventlog_writer_t *writer, logwriter_t *out, int port, int shard, int shard_count);
+
+/**
+ * Appends one event stamped with 'ts' (no text formatting involved)
+ * \param record tag, status, ids and payload; 'ts_delta' is filled in here
+ */
+void eventlog_append(eventlog_writer_t *writer, eventlog_record_t *record, sensor_ts_t ts);
+
+/**
+ * Decodes one unit (header, keyframe or event) read from a binary log
+ * \param unit sizeof(eventlog_record_t) bytes
+ * \param record receives the event, untouched for headers and keyframes
+ * \param ts receives the absolute timestamp of the event
+ * \return 1 for an event, 0 for a header/keyframe, -1 for data that is not a valid unit
+ */
+int eventlog_decode(eventlog_reader_t *reader, const void *unit, eventlog_record_t *record, int64_t *ts);
+
+/**
+ * Renders an event in the gateway.log text format (newline included)
+ * \return length of the text, like snprintf
+ */
+int eventlog_format(const eventlog_reader_t *reader, const eventlog_record_t *record, int64_t ts,
+                    char *buffer, size_t size);
+
+#endif /* _EVENTLOG_H_ */
@@ -0,0 +1,146 @@
+/**
+ * \author Yongkai Zhang
+ *
+ * Decodes the binary event log written with --log-format=binary back to the
+ * gateway.log text format.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "eventlog.h"
+
+#define LOGCAT_READ_UNITS 4096
+#define LOGCAT_FOLLOW_SLEEP_MS 200
+
+typedef struct {
+    int sensor;                 /**< -1 = any */
+    int room;                   /**< -1 = any */
+    bool follow;
+    const char *path;
+} logcat_options_t;
+
+static void print_usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [--sensor=ID] [--room=ID] [-f] [file]\n", program);
+    fprintf(stderr, "  file defaults to %s; -f keeps reading as the gateway appends\n", EVENTLOG_FILE);
+}
+
+static int parse_id(const char *text)
+{
+    char *endptr = NULL;
+    long value;
+
+    errno = 0;
+    value = strtol(text, &endptr, 10);
+    if (errno != 0 || endptr == text || *endptr != '\0' || value < 0 || value > UINT16_MAX) return -1;
+    return (int)value;
+}
+
+static int parse_args(int argc, char *argv[], logcat_options_t *options)
+{
+    options->sensor = -1;
+    options->room = -1;
+    options->follow = false;
+    options->path = EVENTLOG_FILE;
+
+    for (int index = 1; index < argc; index++) {
+        const char *arg = argv[index];
+
+        if (strcmp(arg, "-f") == 0) {
+            options->follow = true;
+        } else if (strncmp(arg, "--sensor=", 9) == 0) {
+            if ((options->sensor = parse_id(arg + 9)) < 0) return -1;
+        } else if (strncmp(arg, "--room=", 7) == 0) {
+            if ((options->room = parse_id(arg + 7)) < 0) return -1;
+        } else if (arg[0] == '-') {
+            return -1;
+        } else {
+            options->path = arg;
+        }
+    }
+    return 0;
+}
+
+static bool matches(const logcat_options_t *options, const eventlog_record_t *record)
+{
+    if (options->room >= 0 && record->room_id != options->room) return false;
+    /* Room-level events have no sensor; keep them only when no sensor filter is set. */
+    if (options->sensor >= 0) {
+        if (record->type == EVENT_ROOM_ALERT || record->type == EVENT_ROOM_RECOVERY) return false;
+        if (record->sensor_id != options->sensor) return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    static eventlog_record_t units[LOGCAT_READ_UNITS];
+    logcat_options_t options;
+    eventlog_reader_t reader = { 0 };
+    size_t used = 0;
+    int fd;
+
+    if (parse_args(argc, argv, &options) != 0) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    fd = open(options.path, O_RDONLY);
+    if (fd < 0) {
+        perror(options.path);
+        return EXIT_FAILURE;
+    }
+
+    while (true) {
+        size_t count;
+        ssize_t rc = read(fd, (char *)units + used, sizeof(units) - used);
+
+        if (rc < 0) {
+            if (errno == EINTR) continue;
+            perror("read");
+            break;
+        }
+        if (rc == 0) {
+            struct timespec pause = { 0, LOGCAT_FOLLOW_SLEEP_MS * 1000000L };
+
+            if (!options.follow) break;
+            fflush(stdout);
+            nanosleep(&pause, NULL);
+            continue;
+        }
+        used += (size_t)rc;
+
+        /* Decode whole units; a partially written one waits for the next read. */
+        count = used / sizeof(eventlog_record_t);
+        for (size_t index = 0; index < count; index++) {
+            eventlog_record_t record;
+            char line[256];
+            int64_t ts;
+            int kind = eventlog_decode(&reader, &units[index], &record, &ts);
+
+            if (kind < 0) {
+                fprintf(stderr, "%s: not a gateway event log (or unsupported version)\n", options.path);
+                close(fd);
+                return EXIT_FAILURE;
+            }
+            if (kind == 0 || !matches(&options, &record)) continue;
+            eventlog_format(&reader, &record, ts, line, sizeof(line));
+            fputs(line, stdout);
+        }
+        used -= count * sizeof(eventlog_record_t);
+        memmove(units, (char *)units + count * sizeof(eventlog_record_t), used);
+    }
+
+    close(fd);
+    if (used != 0) {
+        fprintf(stderr, "%s: ignoring %zu trailing bytes\n", options.path, used);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,277 @@
+/**
+ * \author Yongkai Zhang
+ *
+ * Sends one query (see query.h) to every datamgr shard and merges the answers,
+ * so a sharded gateway reads like a single one: GET/STATS take each id from the
+ * shard that owns it, HOT_ROOMS joins the shards, TOP re-ranks their sensors.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "config.h"
+
+#define QUERY_REQUEST_MAX 4096
+
+/**
+ * Answer lines of one shard, END line excluded
+ */
+typedef struct {
+    char *text;                 /**< the whole answer, lines NUL terminated in place */
+    char **lines;
+    size_t count;
+} shard_answer_t;
+
+typedef struct {
+    char *line;
+    double avg;
+} ranked_line_t;
+
+static void print_usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [--socket=PATH] GET|STATS <id>...|HOT_ROOMS|TOP <n>\n", program);
+    fprintf(stderr, "  PATH defaults to %s; with shards every PATH.<shard> is asked\n", QUERY_SOCKET);
+}
+
+static bool is_socket(const char *path)
+{
+    struct stat info;
+
+    return stat(path, &info) == 0 && S_ISSOCK(info.st_mode);
+}
+
+/* Unsharded gateways listen on 'base' itself, sharded ones on base.0, base.1, ... */
+static size_t find_sockets(const char *base, char paths[][sizeof(((struct sockaddr_un *)0)->sun_path)])
+{
+    size_t count = 0;
+
+    if (is_socket(base)) {
+        snprintf(paths[0], sizeof(paths[0]), "%s", base);
+        return 1;
+    }
+    while (count < DATAMGR_MAX_SHARDS) {
+        snprintf(paths[count], sizeof(paths[count]), "%s.%zu", base, count);
+        if (!is_socket(paths[count])) break;
+        count++;
+    }
+    return count;
+}
+
+static int write_all(int fd, const char *data, size_t length)
+{
+    while (length > 0) {
+        ssize_t rc = write(fd, data, length);
+
+        if (rc < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += rc;
+        length -= (size_t)rc;
+    }
+    return 0;
+}
+
+/* Sends 'request', reads until the shard closes, splits the answer into lines. */
+static int ask_shard(const char *path, const char *request, shard_answer_t *answer)
+{
+    struct sockaddr_un address;
+    size_t used = 0;
+    size_t capacity = 4096;
+    char *end;
+    int fd;
+
+    memset(answer, 0, sizeof(*answer));
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        write_all(fd, request, strlen(request)) != 0 || write_all(fd, "\n", 1) != 0 || shutdown(fd, SHUT_WR) != 0) {
+        close(fd);
+        return -1;
+    }
+    answer->text = malloc(capacity);
+    while (answer->text != NULL) {
+        ssize_t rc;
+
+        if (capacity - used < 2) {
+            char *grown = realloc(answer->text, capacity * 2);
+
+            if (grown == NULL) break;
+            answer->text = grown;
+            capacity *= 2;
+        }
+        rc = read(fd, answer->text + used, capacity - used - 1);
+        if (rc < 0 && errno == EINTR) continue;
+        if (rc <= 0) break;
+        used += (size_t)rc;
+    }
+    close(fd);
+    if (answer->text == NULL) return -1;
+    answer->text[used] = '\0';
+
+    /* Every answer ends with "END <lines>" or is a single ERR line; anything else was cut off. */
+    answer->lines = malloc((used / 2 + 1) * sizeof(*answer->lines));
+    if (answer->lines == NULL) return -1;
+    for (char *line = answer->text; *line != '\0'; line = end + 1) {
+        end = strchr(line, '\n');
+        if (end == NULL) return -1;
+        *end = '\0';
+        if (strncmp(line, "END ", 4) == 0) return 0;
+        answer->lines[answer->count++] = line;
+        if (strncmp(line, "ERR ", 4) == 0) return 0;
+    }
+    return -1;
+}
+
+static void free_answer(shard_answer_t *answer)
+{
+    free(answer->text);
+    free(answer->lines);
+}
+
+static double line_avg(const char *line)
+{
+    const char *field = strstr(line, " avg=");
+
+    return field == NULL ? 0.0 : strtod(field + 5, NULL);
+}
+
+static int compare_ranked(const void *left, const void *right)
+{
+    double a = ((const ranked_line_t *)left)->avg;
+    double b = ((const ranked_line_t *)right)->avg;
+
+    return (a < b) - (a > b);
+}
+
+/* Line 'index' of every shard answers the same id; the owner's line wins over UNKNOWN. */
+static int merge_by_id(shard_answer_t *answers, size_t shards)
+{
+    for (size_t shard = 1; shard < shards; shard++) {
+        if (answers[shard].count != answers[0].count) return -1;
+    }
+    for (size_t index = 0; index < answers[0].count; index++) {
+        const char *line = answers[0].lines[index];
+
+        for (size_t shard = 0; shard < shards; shard++) {
+            if (strncmp(answers[shard].lines[index], "UNKNOWN ", 8) != 0) {
+                line = answers[shard].lines[index];
+                break;
+            }
+        }
+        puts(line);
+    }
+    printf("END %zu\n", answers[0].count);
+    return 0;
+}
+
+/* Each shard sent its own top 'limit'; the overall top is among them. */
+static int merge_top(shard_answer_t *answers, size_t shards, long limit)
+{
+    ranked_line_t *ranked;
+    size_t total = 0;
+    size_t printed = 0;
+
+    for (size_t shard = 0; shard < shards; shard++) total += answers[shard].count;
+    ranked = malloc((total == 0 ? 1 : total) * sizeof(*ranked));
+    if (ranked == NULL) return -1;
+    total = 0;
+    for (size_t shard = 0; shard < shards; shard++) {
+        for (size_t index = 0; index < answers[shard].count; index++) {
+            ranked[total].line = answers[shard].lines[index];
+            ranked[total].avg = line_avg(ranked[total].line);
+            total++;
+        }
+    }
+    qsort(ranked, total, sizeof(*ranked), compare_ranked);
+    for (; printed < total && printed < (size_t)limit; printed++) {
+        puts(ranked[printed].line);
+    }
+    printf("END %zu\n", printed);
+    free(ranked);
+    return 0;
+}
+
+/* Rooms are whole in one shard, so the shards' lists never overlap. */
+static void merge_concat(shard_answer_t *answers, size_t shards)
+{
+    size_t total = 0;
+
+    for (size_t shard = 0; shard < shards; shard++) {
+        for (size_t index = 0; index < answers[shard].count; index++) {
+            puts(answers[shard].lines[index]);
+            total++;
+        }
+    }
+    printf("END %zu\n", total);
+}
+
+int main(int argc, char *argv[])
+{
+    char paths[DATAMGR_MAX_SHARDS][sizeof(((struct sockaddr_un *)0)->sun_path)];
+    shard_answer_t answers[DATAMGR_MAX_SHARDS];
+    char request[QUERY_REQUEST_MAX] = "";
+    const char *base = QUERY_SOCKET;
+    size_t length = 0;
+    size_t shards;
+    size_t asked = 0;
+    long limit;
+    int rc = 0;
+
+    for (int index = 1; index < argc; index++) {
+        if (strncmp(argv[index], "--socket=", 9) == 0 && argv[index][9] != '\0' && length == 0) {
+            base = argv[index] + 9;
+            continue;
+        }
+        length += (size_t)snprintf(request + length, sizeof(request) - length, "%s%s", length == 0 ? "" : " ",
+                                   argv[index]);
+        if (length >= sizeof(request)) {
+            fprintf(stderr, "%s: request too long\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (length == 0) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    shards = find_sockets(base, paths);
+    if (shards == 0) {
+        fprintf(stderr, "%s: no query socket at %s or %s.0\n", argv[0], base, base);
+        return EXIT_FAILURE;
+    }
+    for (; asked < shards && rc == 0; asked++) {
+        rc = ask_shard(paths[asked], request, &answers[asked]);
+        if (rc != 0) {
+            fprintf(stderr, "%s: no complete answer from %s\n", argv[0], paths[asked]);
+        } else if (answers[asked].count > 0 && strncmp(answers[asked].lines[0], "ERR ", 4) == 0) {
+            /* Every shard parses the request the same way; one error stands for all. */
+            puts(answers[asked].lines[0]);
+            rc = -1;
+        }
+    }
+    if (rc == 0) {
+        if (strncmp(request, "GET ", 4) == 0 || strncmp(request, "STATS ", 6) == 0) {
+            rc = merge_by_id(answers, shards);
+            if (rc != 0) fprintf(stderr, "%s: shards answered a different number of ids\n", argv[0]);
+        } else if (sscanf(request, "TOP %ld", &limit) == 1) {
+            rc = merge_top(answers, shards, limit);
+        } else {
+            merge_concat(answers, shards);
+        }
+    }
+    for (size_t shard = 0; shard < asked; shard++) {
+        free_answer(&answers[shard]);
+    }
+    return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -21,4 +21,4 @@
     do {                                                                                            \
             if ((condition)) DEBUG_PRINTF(#condition " failed\n");                                  \
             assert(!(condition));                                                                   \
-        } while(0)
\ No newline at end of file
+        } while(0)
@@ -0,0 +1,214 @@
+/**
+ * \author Yongkai Zhang
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "liveness.h"
+
+#define WHEEL_MASK (LIVENESS_WHEEL_SLOTS - 1)
+#define RATE_EWMA_ALPHA 0.2
+#define RATE_MIN_WINDOWS 3          // learned rate is trusted after this many windows
+#define RATE_DECAY_WINDOWS 64       // empty windows folded one by one; past this the rate is ~0 anyway
+
+_Static_assert((LIVENESS_WHEEL_SLOTS & WHEEL_MASK) == 0, "LIVENESS_WHEEL_SLOTS must be a power of two");
+
+void liveness_default_config(liveness_config_t *config)
+{
+    config->silence_min = LIVENESS_SILENCE_MIN;
+    config->silence_factor = LIVENESS_SILENCE_FACTOR;
+    config->stuck_seconds = LIVENESS_STUCK_SECONDS;
+    config->rate_window = LIVENESS_RATE_WINDOW;
+    config->rate_factor = LIVENESS_RATE_FACTOR;
+}
+
+int liveness_init(liveness_t *liveness, size_t count, const liveness_config_t *config, time_t now)
+{
+    memset(liveness, 0, sizeof(*liveness));
+    liveness->config = *config;
+    if (liveness->config.rate_window < 1) liveness->config.rate_window = 1;
+    liveness->count = count;
+    liveness->entries = calloc(count == 0 ? 1 : count, sizeof(*liveness->entries));
+    if (liveness->entries == NULL) return -1;
+    for (size_t slot = 0; slot < count; slot++) {
+        liveness->entries[slot].bucket = -1;
+    }
+    for (size_t bucket = 0; bucket < LIVENESS_WHEEL_SLOTS; bucket++) {
+        liveness->buckets[bucket] = -1;
+    }
+    liveness->wheel_time = now;
+    return 0;
+}
+
+void liveness_free(liveness_t *liveness)
+{
+    free(liveness->entries);
+    liveness->entries = NULL;
+    liveness->count = 0;
+}
+
+static void unschedule(liveness_t *liveness, int32_t slot)
+{
+    liveness_entry_t *entry = &liveness->entries[slot];
+
+    if (entry->bucket < 0) return;
+    if (entry->prev >= 0) {
+        liveness->entries[entry->prev].next = entry->next;
+    } else {
+        liveness->buckets[entry->bucket] = entry->next;
+    }
+    if (entry->next >= 0) {
+        liveness->entries[entry->next].prev = entry->prev;
+    }
+    entry->bucket = -1;
+}
+
+static void schedule(liveness_t *liveness, int32_t slot, time_t deadline)
+{
+    liveness_entry_t *entry = &liveness->entries[slot];
+    int32_t bucket = (int32_t)(deadline & WHEEL_MASK);
+
+    entry->deadline = deadline;
+    entry->bucket = bucket;
+    entry->prev = -1;
+    entry->next = liveness->buckets[bucket];
+    if (entry->next >= 0) {
+        liveness->entries[entry->next].prev = slot;
+    }
+    liveness->buckets[bucket] = slot;
+}
+
+/* Expected seconds between readings, from the learned rate. */
+static double expected_interval(const liveness_t *liveness, const liveness_entry_t *entry)
+{
+    if (entry->windows_seen < RATE_MIN_WINDOWS || entry->rate <= 0) return 0;
+    return (double)liveness->config.rate_window / entry->rate;
+}
+
+static time_t silence_timeout(const liveness_t *liveness, const liveness_entry_t *entry)
+{
+    double timeout = liveness->config.silence_factor * expected_interval(liveness, entry);
+
+    if (timeout < liveness->config.silence_min) timeout = liveness->config.silence_min;
+    return (time_t)(timeout + 0.5);
+}
+
+static void emit(liveness_sink_t sink, void *context, int type, int slot, time_t since,
+                 double observed, double expected)
+{
+    liveness_event_t event = { type, slot, since, observed, expected };
+
+    sink(&event, context);
+}
+
+/*
+ * A window is anomalous when its count is rate_factor times above or below the learned
+ * rate. Falling that far below is only measurable when at least rate_factor readings are
+ * expected, otherwise the natural gaps of a slow sensor would be reported.
+ */
+static bool rate_anomaly(const liveness_config_t *config, const liveness_entry_t *entry, double count)
+{
+    if (entry->windows_seen < RATE_MIN_WINDOWS) return false;
+    if (count > config->rate_factor * entry->rate) return true;
+    return entry->rate >= config->rate_factor && count * config->rate_factor < entry->rate;
+}
+
+/* Folds one closed window into the learned rate. */
+static void close_window(liveness_entry_t *entry, double count)
+{
+    entry->rate = entry->windows_seen == 0 ? count : entry->rate + RATE_EWMA_ALPHA * (count - entry->rate);
+    entry->windows_seen++;
+}
+
+static void check_rate(liveness_t *liveness, int slot, time_t now, liveness_sink_t sink, void *context)
+{
+    liveness_entry_t *entry = &liveness->entries[slot];
+    const liveness_config_t *config = &liveness->config;
+    time_t windows = (now - entry->window_start) / config->rate_window;
+    double count;
+
+    if (windows < 1) return;
+
+    /* Close the window the counted readings fell in. */
+    count = (double)entry->window_count;
+    if (rate_anomaly(config, entry, count)) {
+        emit(sink, context, LIVENESS_RATE_ANOMALY, slot, entry->window_start, count, entry->rate);
+    }
+    close_window(entry, count);
+
+    /* The windows that passed without any reading count as zero; one report covers the gap. */
+    if (windows > 1 && rate_anomaly(config, entry, 0)) {
+        emit(sink, context, LIVENESS_RATE_ANOMALY, slot, entry->window_start + config->rate_window, 0, entry->rate);
+    }
+    for (time_t empty = 1; empty < windows && empty <= RATE_DECAY_WINDOWS; empty++) {
+        close_window(entry, 0);
+    }
+    entry->window_start += windows * config->rate_window;
+    entry->window_count = 0;
+}
+
+void liveness_observe(liveness_t *liveness, int slot, double value, time_t now,
+                      liveness_sink_t sink, void *context)
+{
+    liveness_entry_t *entry = &liveness->entries[slot];
+    time_t deadline;
+
+    if (!entry->seen) {
+        entry->seen = true;
+        entry->window_start = now;
+        entry->last_value = value;
+        entry->same_since = now;
+    } else {
+        check_rate(liveness, slot, now, sink, context);
+    }
+    if (entry->silent) {
+        entry->silent = false;
+        emit(sink, context, LIVENESS_ALIVE, slot, entry->last_seen, (double)(now - entry->last_seen), 0);
+    }
+    entry->window_count++;
+    entry->last_seen = now;
+
+    if (value != entry->last_value) {
+        entry->last_value = value;
+        entry->same_since = now;
+        entry->stuck = false;
+    } else if (!entry->stuck && liveness->config.stuck_seconds > 0 &&
+               now - entry->same_since >= liveness->config.stuck_seconds) {
+        entry->stuck = true;
+        emit(sink, context, LIVENESS_STUCK, slot, entry->same_since, value, 0);
+    }
+
+    /* Readings within the same second keep the timer where it is. */
+    deadline = now + silence_timeout(liveness, entry);
+    if (entry->bucket >= 0 && entry->deadline == deadline) return;
+    unschedule(liveness, slot);
+    schedule(liveness, slot, deadline);
+}
+
+void liveness_tick(liveness_t *liveness, time_t now, liveness_sink_t sink, void *context)
+{
+    time_t first = liveness->wheel_time + 1;
+
+    /* After a long stall one lap over the wheel visits every bucket. */
+    if (now - first >= LIVENESS_WHEEL_SLOTS) first = now - LIVENESS_WHEEL_SLOTS + 1;
+
+    for (time_t second = first; second <= now; second++) {
+        int32_t slot = liveness->buckets[second & WHEEL_MASK];
+
+        while (slot >= 0) {
+            liveness_entry_t *entry = &liveness->entries[slot];
+            int32_t next = entry->next;
+
+            /* Deadlines more than one lap ahead share the bucket; they stay. */
+            if (entry->deadline <= now) {
+                unschedule(liveness, slot);
+                entry->silent = true;
+                emit(sink, context, LIVENESS_SILENT, slot, entry->last_seen, 0,
+                     expected_interval(liveness, entry));
+            }
+            slot = next;
+        }
+    }
+    if (now > liveness->wheel_time) liveness->wheel_time = now;
+}
@@ -0,0 +1,98 @@
+/**
+ * \author Yongkai Zhang
+ */
+
+#ifndef _LIVENESS_H_
+#define _LIVENESS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define LIVENESS_WHEEL_SLOTS 1024   // one-second buckets, power of two
+
+enum {
+    LIVENESS_SILENT,            /**< no reading within the silence timeout */
+    LIVENESS_ALIVE,             /**< a silent sensor reported again */
+    LIVENESS_STUCK,             /**< identical value for stuck_seconds */
+    LIVENESS_RATE_ANOMALY       /**< readings per rate window far from the learned rate */
+};
+
+typedef struct {
+    int silence_min;            /**< seconds; the timeout is never shorter than this */
+    double silence_factor;      /**< timeout = factor * learned interval between readings */
+    int stuck_seconds;          /**< 0 disables STUCK */
+    int rate_window;            /**< seconds per rate sample */
+    double rate_factor;         /**< anomaly when the rate is this many times above or below normal */
+} liveness_config_t;
+
+typedef struct {
+    int type;                   /**< LIVENESS_* */
+    int slot;
+    time_t since;               /**< last reading (SILENT/ALIVE), first identical value (STUCK) */
+    double observed;            /**< STUCK: the value; RATE_ANOMALY: readings in the window */
+    double expected;            /**< SILENT: expected interval; RATE_ANOMALY: learned readings per window */
+} liveness_event_t;
+
+typedef void (*liveness_sink_t)(const liveness_event_t *event, void *context);
+
+/**
+ * Liveness state of one sensor slot, linked into the timer wheel by its deadline
+ */
+typedef struct {
+    time_t last_seen;
+    time_t deadline;            /**< SILENT fires at this time */
+    time_t window_start;
+    uint32_t window_count;
+    uint32_t windows_seen;
+    double rate;                /**< EWMA of readings per rate window */
+    double last_value;
+    time_t same_since;
+    bool seen;
+    bool silent;
+    bool stuck;
+    int32_t next;               /**< wheel bucket links, -1 terminated */
+    int32_t prev;
+    int32_t bucket;             /**< -1 when not scheduled */
+} liveness_entry_t;
+
+/**
+ * Hashed timer wheel over per-sensor silence deadlines. A reading moves its
+ * sensor's timer in O(1); a tick only visits the buckets of the seconds that
+ * elapsed, which hold no timers while every sensor reports on time.
+ */
+typedef struct {
+    liveness_config_t config;
+    size_t count;
+    liveness_entry_t *entries;
+    int32_t buckets[LIVENESS_WHEEL_SLOTS];
+    time_t wheel_time;          /**< last second processed by liveness_tick() */
+} liveness_t;
+
+/**
+ * Fills 'config' with the compile-time defaults (LIVENESS_* in config.h)
+ */
+void liveness_default_config(liveness_config_t *config);
+
+/**
+ * Allocates state for 'count' sensor slots; no sensor is watched until its first reading
+ * \return zero on success, -1 on allocation failure
+ */
+int liveness_init(liveness_t *liveness, size_t count, const liveness_config_t *config, time_t now);
+
+void liveness_free(liveness_t *liveness);
+
+/**
+ * Records a reading of 'slot' that arrived at 'now': re-arms its silence timer
+ * and checks STUCK / RATE_ANOMALY. O(1).
+ */
+void liveness_observe(liveness_t *liveness, int slot, double value, time_t now,
+                      liveness_sink_t sink, void *context);
+
+/**
+ * Advances the wheel to 'now' and reports SILENT for every expired timer
+ */
+void liveness_tick(liveness_t *liveness, time_t now, liveness_sink_t sink, void *context);
+
+#endif /* _LIVENESS_H_ */
@@ -0,0 +1,318 @@
+/**
+ * \author Yongkai Zhang
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "logwriter.h"
+
+#define WRITER_STAGE_CHUNK (1024 * 1024)
+
+static long elapsed_ms(const struct timespec *since)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long)(now.tv_sec - since->tv_sec) * 1000L + (now.tv_nsec - since->tv_nsec) / 1000000L;
+}
+
+static int write_all(int fd, const char *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += written;
+        size -= (size_t)written;
+    }
+    return 0;
+}
+
+/*
+ * Writer stage: copies the pipe into the file in large writes until EOF.
+ * With 'whole_lines' a partial last line stays in the chunk until its end
+ * arrives; the producer only hands off whole lines, so it is already in the pipe.
+ */
+static void run_writer_stage(int read_fd, int file_fd, bool whole_lines)
+{
+    char *chunk = malloc(WRITER_STAGE_CHUNK);
+    size_t held = 0;
+
+    long max_fd = sysconf(_SC_OPEN_MAX);
+
+    /* Drop inherited pipe ends so the stage never keeps another pipe open. */
+    if (max_fd < 0 || max_fd > 4096) max_fd = 4096;
+    for (int fd = 3; fd < max_fd; fd++) {
+        if (fd != read_fd && fd != file_fd) close(fd);
+    }
+    signal(SIGTERM, SIG_IGN);
+    if (chunk == NULL) _exit(EXIT_FAILURE);
+    while (true) {
+        ssize_t received = read(read_fd, chunk + held, WRITER_STAGE_CHUNK - held);
+        size_t available;
+        size_t complete;
+
+        if (received == 0) break;
+        if (received < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        available = held + (size_t)received;
+        complete = available;
+        if (whole_lines) {
+            while (complete > 0 && chunk[complete - 1] != '\n') complete--;
+            if (complete == 0 && available == WRITER_STAGE_CHUNK) complete = available;  // no newline at all
+        }
+        if (write_all(file_fd, chunk, complete) != 0) {
+            perror("log writer");
+            break;
+        }
+        held = available - complete;
+        memmove(chunk, chunk + complete, held);
+    }
+    if (held > 0 && write_all(file_fd, chunk, held) != 0) {
+        perror("log writer");
+    }
+    free(chunk);
+    close(read_fd);
+    close(file_fd);
+    _exit(EXIT_SUCCESS);
+}
+
+void logwriter_default_policy(logwriter_policy_t *policy)
+{
+    policy->flush_bytes = LOGWRITER_FLUSH_BYTES;
+    policy->flush_ms = LOGWRITER_FLUSH_MS;
+    policy->flush_on_alert = true;
+    policy->whole_lines = true;
+}
+
+int logwriter_open(logwriter_t *writer, const char *path, const logwriter_policy_t *policy)
+{
+    int file_fd;
+    int stage_pipe[2];
+
+    memset(writer, 0, sizeof(*writer));
+    writer->fd = -1;
+    writer->writer_pid = -1;
+    writer->pending = -1;
+    if (policy != NULL) {
+        writer->policy = *policy;
+    } else {
+        logwriter_default_policy(&writer->policy);
+    }
+    if (writer->policy.flush_bytes == 0 || writer->policy.flush_bytes > LOGWRITER_BUFFER_SIZE) {
+        writer->policy.flush_bytes = LOGWRITER_BUFFER_SIZE;
+    }
+
+    writer->buffers[0] = malloc(LOGWRITER_BUFFER_SIZE);
+    writer->buffers[1] = malloc(LOGWRITER_BUFFER_SIZE);
+    file_fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (writer->buffers[0] == NULL || writer->buffers[1] == NULL || file_fd < 0) {
+        if (file_fd >= 0) close(file_fd);
+        free(writer->buffers[0]);
+        free(writer->buffers[1]);
+        writer->buffers[0] = writer->buffers[1] = NULL;
+        return -1;
+    }
+
+    if (pipe(stage_pipe) == 0) {
+        pid_t pid = fork();
+
+        if (pid == 0) {
+            close(stage_pipe[1]);
+            run_writer_stage(stage_pipe[0], file_fd, writer->policy.whole_lines);
+        }
+        if (pid > 0) {
+            close(stage_pipe[0]);
+            close(file_fd);
+            fcntl(stage_pipe[1], F_SETFL, fcntl(stage_pipe[1], F_GETFL) | O_NONBLOCK);
+            writer->fd = stage_pipe[1];
+            writer->writer_pid = pid;
+            return 0;
+        }
+        close(stage_pipe[0]);
+        close(stage_pipe[1]);
+    }
+
+    /* No writer stage: fall back to synchronous writes to the file. */
+    writer->fd = file_fd;
+    return 0;
+}
+
+/*
+ * Pushes as much of the pending buffer as the pipe accepts. With 'wait' set
+ * it blocks until the whole buffer is handed off.
+ * \return true when no buffer is pending any more
+ */
+static bool drain_pending(logwriter_t *writer, bool wait)
+{
+    int index = writer->pending;
+
+    while (index >= 0 && writer->sent[index] < writer->used[index]) {
+        ssize_t written = write(writer->fd, writer->buffers[index] + writer->sent[index],
+                                writer->used[index] - writer->sent[index]);
+
+        if (written > 0) {
+            writer->sent[index] += (size_t)written;
+            continue;
+        }
+        if (written < 0 && errno == EINTR) continue;
+        if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct pollfd pfd = { .fd = writer->fd, .events = POLLOUT };
+
+            if (!wait) return false;
+            (void)poll(&pfd, 1, -1);
+            continue;
+        }
+        /* Writer stage is gone: drop this buffer rather than stall processing. */
+        perror("log writer");
+        break;
+    }
+
+    if (index >= 0) {
+        writer->used[index] = 0;
+        writer->sent[index] = 0;
+        writer->pending = -1;
+    }
+    return true;
+}
+
+void logwriter_flush(logwriter_t *writer, bool wait)
+{
+    if (writer->fd < 0) return;
+
+    /* Only one buffer can be in flight: finish the previous hand-off first. */
+    if (!drain_pending(writer, wait) || writer->used[writer->active] == 0) {
+        if (wait) drain_pending(writer, true);
+        return;
+    }
+
+    writer->pending = writer->active;
+    writer->active = 1 - writer->active;
+    (void)drain_pending(writer, wait);
+}
+
+static void reserve(logwriter_t *writer, size_t size)
+{
+    if (writer->used[writer->active] + size <= LOGWRITER_BUFFER_SIZE) return;
+    /* Active buffer is full: the other one must be free before swapping. */
+    drain_pending(writer, true);
+    logwriter_flush(writer, false);
+}
+
+static void mark_buffered(logwriter_t *writer, size_t before)
+{
+    /* The age limit counts from the oldest line still sitting in the active buffer. */
+    if (before == 0 && writer->used[writer->active] > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &writer->first_unflushed);
+    }
+    if (writer->used[writer->active] >= writer->policy.flush_bytes) {
+        logwriter_flush(writer, false);
+    }
+}
+
+void logwriter_write(logwriter_t *writer, const void *data, size_t size)
+{
+    size_t before;
+
+    if (writer->fd < 0 || size == 0) return;
+    if (size > LOGWRITER_BUFFER_SIZE) size = LOGWRITER_BUFFER_SIZE;
+    reserve(writer, size);
+    before = writer->used[writer->active];
+    memcpy(writer->buffers[writer->active] + before, data, size);
+    writer->used[writer->active] += size;
+    mark_buffered(writer, before);
+}
+
+void logwriter_printf(logwriter_t *writer, const char *format, ...)
+{
+    va_list args;
+    size_t before;
+    size_t room;
+    int length;
+
+    if (writer->fd < 0) return;
+    before = writer->used[writer->active];
+    room = LOGWRITER_BUFFER_SIZE - before;
+    va_start(args, format);
+    length = vsnprintf(writer->buffers[writer->active] + before, room, format, args);
+    va_end(args);
+    if (length < 0) return;
+
+    if ((size_t)length >= room) {
+        /* Did not fit: swap buffers and format again into the empty one. */
+        reserve(writer, (size_t)length + 1);
+        before = writer->used[writer->active];
+        room = LOGWRITER_BUFFER_SIZE - before;
+        va_start(args, format);
+        length = vsnprintf(writer->buffers[writer->active] + before, room, format, args);
+        va_end(args);
+        if (length < 0) return;
+        if ((size_t)length >= room) length = (int)room - 1;
+    }
+    writer->used[writer->active] += (size_t)length;
+    mark_buffered(writer, before);
+}
+
+void logwriter_alert(logwriter_t *writer)
+{
+    /* A non-blocking flush is a no-op while the previous buffer is still in flight. */
+    if (writer->policy.flush_on_alert) {
+        logwriter_flush(writer, true);
+    }
+}
+
+int logwriter_next_deadline_ms(const logwriter_t *writer)
+{
+    long remaining;
+
+    if (writer->fd < 0) return -1;
+    if (writer->pending >= 0) return 1;     /* keep retrying the hand-off soon */
+    if (writer->used[writer->active] == 0 || writer->policy.flush_ms <= 0) return -1;
+    remaining = writer->policy.flush_ms - elapsed_ms(&writer->first_unflushed);
+    return remaining < 0 ? 0 : (int)remaining;
+}
+
+void logwriter_poll(logwriter_t *writer)
+{
+    if (writer->fd < 0) return;
+    if (writer->pending >= 0) {
+        (void)drain_pending(writer, false);
+    }
+    if (writer->used[writer->active] == 0) return;
+    if (writer->used[writer->active] >= writer->policy.flush_bytes ||
+        (writer->policy.flush_ms > 0 && elapsed_ms(&writer->first_unflushed) >= writer->policy.flush_ms)) {
+        logwriter_flush(writer, false);
+    }
+}
+
+void logwriter_close(logwriter_t *writer)
+{
+    if (writer->fd >= 0) {
+        logwriter_flush(writer, true);
+        close(writer->fd);
+        writer->fd = -1;
+    }
+    if (writer->writer_pid > 0) {
+        while (waitpid(writer->writer_pid, NULL, 0) < 0 && errno == EINTR) {
+        }
+        writer->writer_pid = -1;
+    }
+    free(writer->buffers[0]);
+    free(writer->buffers[1]);
+    writer->buffers[0] = writer->buffers[1] = NULL;
+}
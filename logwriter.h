@@ -0,0 +1,101 @@
+/**
+ * \author Yongkai Zhang
+ */
+
+#ifndef _LOGWRITER_H_
+#define _LOGWRITER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+#define LOGWRITER_BUFFER_SIZE (256 * 1024)  // size of each of the two buffers
+
+#ifndef LOGWRITER_FLUSH_BYTES
+#define LOGWRITER_FLUSH_BYTES (64 * 1024)
+#endif
+
+#ifndef LOGWRITER_FLUSH_MS
+#define LOGWRITER_FLUSH_MS 200
+#endif
+
+/**
+ * When buffered output is handed to the writer stage
+ */
+typedef struct {
+    size_t flush_bytes;         /**< flush once this many bytes are buffered */
+    int flush_ms;               /**< flush buffered bytes older than this, 0 = only on size/alert */
+    bool flush_on_alert;        /**< logwriter_alert() flushes immediately */
+    bool whole_lines;           /**< text file: every write ends on a newline, so other appenders never split a line */
+} logwriter_policy_t;
+
+/**
+ * Double-buffered log output. Lines are formatted into the active buffer while
+ * the other buffer drains through a non-blocking pipe into a dedicated writer
+ * process that owns the file, so formatting and disk I/O overlap.
+ */
+typedef struct {
+    int fd;                     /**< pipe to the writer stage (or the file itself as fallback) */
+    pid_t writer_pid;           /**< writer stage process, -1 when writing directly */
+    char *buffers[2];
+    size_t used[2];             /**< bytes formatted into each buffer */
+    size_t sent[2];             /**< bytes of each buffer already handed off */
+    int active;                 /**< buffer being filled */
+    int pending;                /**< buffer being drained, -1 when idle */
+    logwriter_policy_t policy;
+    struct timespec first_unflushed; /**< time the oldest buffered byte was written */
+} logwriter_t;
+
+/**
+ * Fills 'policy' with the compile-time defaults (LOGWRITER_FLUSH_BYTES / LOGWRITER_FLUSH_MS, flush on alert,
+ * whole lines)
+ */
+void logwriter_default_policy(logwriter_policy_t *policy);
+
+/**
+ * Opens 'path' for appending and starts the writer stage process
+ * If the writer process cannot be started, output is written synchronously instead.
+ * \return zero on success, -1 if the file cannot be opened
+ */
+int logwriter_open(logwriter_t *writer, const char *path, const logwriter_policy_t *policy);
+
+/**
+ * Appends raw bytes to the active buffer
+ */
+void logwriter_write(logwriter_t *writer, const void *data, size_t size);
+
+/**
+ * Formats one entry into the active buffer (printf-style)
+ */
+void logwriter_printf(logwriter_t *writer, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * Marks that an alert was just written; when the policy says so, hands everything
+ * buffered (the alert included) to the writer stage before returning, waiting for
+ * a previous hand-off that is still in flight
+ */
+void logwriter_alert(logwriter_t *writer);
+
+/**
+ * Applies the size and age policy; call after each batch and on idle ticks
+ */
+void logwriter_poll(logwriter_t *writer);
+
+/**
+ * Hands all buffered bytes to the writer stage
+ * \param wait block until everything has been handed off
+ */
+void logwriter_flush(logwriter_t *writer, bool wait);
+
+/**
+ * \return milliseconds until the age policy needs a flush, -1 when nothing is buffered
+ */
+int logwriter_next_deadline_ms(const logwriter_t *writer);
+
+/**
+ * Flushes everything, stops the writer stage and waits for it to finish writing
+ */
+void logwriter_close(logwriter_t *writer);
+
+#endif /* _LOGWRITER_H_ */
@@ -1,16 +1,47 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <errno.h>
+#include <math.h>
 #include <signal.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #include "config.h"
 #include "connmgr.h"
 #include "datamgr.h"
+#include "eventlog.h"
+#include "sensor_db.h"
+#include "storagemgr.h"
+#include "thresholds.h"
 
 typedef struct {
     int port;
     int timeout_seconds;
+    int avg_window;
+    int summary_interval;
+    int shards;
+    logwriter_policy_t log_policy;
+    int log_format;
+    int data_log_mode;
+    double data_log_parameter;
+    int shed_depth;
+    int reorder_watermark;
+    const char *thresholds_path;
+    liveness_config_t liveness;
+    const char *checkpoint_path;
+    int checkpoint_interval;
+    int checkpoint_max_age;
+    const char *query_socket;
+    bool storage;
+    int storage_commit_rows;
+    int storage_commit_ms;
+    const char *db_profile;
+    int db_partition_seconds;
+    int db_retention_hours;
+    const char *db_archive;
 } app_context_t;
 
 static int parse_int_in_range(const char *text, int min_value, int max_value)
@@ -29,51 +60,297 @@ static int parse_int_in_range(const char *text, int min_value, int max_value)
     return (int)value;
 }
 
+static void print_usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [options] [port] [idle_timeout_seconds]\n", program);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  --avg-window=N   running average window in samples (default %d)\n", RUN_AVG_LENGTH);
+    fprintf(stderr, "  --summary-interval=SEC  seconds between SUMMARY lines, 0 = only at exit (default %d)\n",
+            STATS_SUMMARY_INTERVAL);
+    fprintf(stderr, "  --shards=N       datamgr processes, readings routed by room_id (default 1, max %d)\n",
+            DATAMGR_MAX_SHARDS);
+    fprintf(stderr, "  --log-flush-bytes=N  buffered gateway.log bytes that trigger a write (default %d)\n",
+            LOGWRITER_FLUSH_BYTES);
+    fprintf(stderr, "  --log-flush-ms=MS    oldest buffered line age that triggers a write, 0 = off (default %d)\n",
+            LOGWRITER_FLUSH_MS);
+    fprintf(stderr, "  --log-flush-on-alert=0|1  write ALERT/RECOVERY lines immediately (default 1)\n");
+    fprintf(stderr, "  --log-format=text|binary  binary writes per-reading events to %s (default text)\n",
+            EVENTLOG_FILE);
+    fprintf(stderr, "  --data-log=MODE  all | every:N | delta:X | alerts (default all)\n");
+    fprintf(stderr, "  --shed-depth=N   queued readings that suspend DATA output, 0 = never (default %d)\n",
+            DATA_LOG_SHED_DEPTH);
+    fprintf(stderr, "  --reorder-watermark=SEC  reorder each sensor's readings by timestamp, allowing SEC seconds\n"
+                    "                   of lateness; older readings are logged as LATE (default off)\n");
+    fprintf(stderr, "  --thresholds=FILE  per-sensor/per-room alert bands, reloaded on change (default %s)\n",
+            THRESHOLDS_FILE);
+    fprintf(stderr, "  --silence-seconds=SEC  minimum silence before a sensor is reported SILENT (default %d)\n",
+            LIVENESS_SILENCE_MIN);
+    fprintf(stderr, "  --stuck-seconds=SEC    identical readings this long are reported STUCK, 0 = off (default %d)\n",
+            LIVENESS_STUCK_SECONDS);
+    fprintf(stderr, "  --checkpoint=FILE      sensor state snapshot for warm restarts (default %s)\n", CHECKPOINT_FILE);
+    fprintf(stderr, "  --checkpoint-interval=SEC  seconds between snapshot writebacks, 0 = no snapshot (default %d)\n",
+            CHECKPOINT_INTERVAL);
+    fprintf(stderr, "  --checkpoint-max-age=SEC  older snapshots start cold, 0 = any age (default %d)\n",
+            CHECKPOINT_MAX_AGE);
+    fprintf(stderr, "  --query-socket=PATH|off  Unix socket for GET/HOT_ROOMS/TOP state queries (default %s)\n",
+            QUERY_SOCKET);
+    fprintf(stderr, "  --storage=0|1    store every accepted reading in Sensor.db through the storage manager (default 1)\n");
+    fprintf(stderr, "  --storage-commit-rows=N  readings per group commit (default %d)\n", STORAGE_COMMIT_ROWS);
+    fprintf(stderr, "  --storage-commit-ms=MS   max wait of a reading before its group commits (default %d)\n",
+            STORAGE_COMMIT_MS);
+    fprintf(stderr, "  --db-profile=NAME  SQLite tuning: sqlite | ssd | hdd | durable (default %s)\n", DB_PROFILE);
+    fprintf(stderr, "  --db-partition=hour|day  time span of one Sensor.db partition table (default %d s)\n",
+            DB_PARTITION_SECONDS);
+    fprintf(stderr, "  --db-retention-hours=N   drop partitions older than N hours, 0 = keep all (default %d)\n",
+            DB_RETENTION_HOURS);
+    fprintf(stderr, "  --db-archive=FILE|off    compressed archive of dropped partitions (default %s)\n", DB_ARCHIVE_FILE);
+}
+
+/* Returns the text after "name=" when 'arg' is that option, NULL otherwise. */
+static const char *option_value(const char *arg, const char *name)
+{
+    size_t length = strlen(name);
+
+    if (strncmp(arg, name, length) != 0 || arg[length] != '=') return NULL;
+    return arg + length + 1;
+}
+
+/* Parses "all", "alerts", "every:N" or "delta:X". */
+static int parse_data_log_mode(const char *text, app_context_t *context)
+{
+    char *endptr = NULL;
+
+    context->data_log_parameter = 0;
+    if (strcmp(text, "all") == 0) {
+        context->data_log_mode = DATAMGR_DATA_LOG_ALL;
+        return 0;
+    }
+    if (strcmp(text, "alerts") == 0) {
+        context->data_log_mode = DATAMGR_DATA_LOG_ALERTS;
+        return 0;
+    }
+    if (strncmp(text, "every:", 6) == 0) {
+        context->data_log_mode = DATAMGR_DATA_LOG_EVERY;
+        context->data_log_parameter = parse_int_in_range(text + 6, 1, 1000000);
+        return context->data_log_parameter < 0 ? -1 : 0;
+    }
+    if (strncmp(text, "delta:", 6) == 0) {
+        errno = 0;
+        context->data_log_mode = DATAMGR_DATA_LOG_DELTA;
+        context->data_log_parameter = strtod(text + 6, &endptr);
+        if (errno != 0 || endptr == text + 6 || *endptr != '\0' || !(context->data_log_parameter >= 0)) return -1;
+        return 0;
+    }
+    return -1;
+}
+
+static int parse_option(const char *arg, app_context_t *context)
+{
+    const char *value;
+
+    if ((value = option_value(arg, "--avg-window")) != NULL) {
+        context->avg_window = parse_int_in_range(value, 1, RUN_AVG_LENGTH_MAX);
+        return context->avg_window < 0 ? -1 : 0;
+    }
+    if ((value = option_value(arg, "--summary-interval")) != NULL) {
+        context->summary_interval = parse_int_in_range(value, 0, 86400);
+        return context->summary_interval < 0 ? -1 : 0;
+    }
+    if ((value = option_value(arg, "--shards")) != NULL) {
+        context->shards = parse_int_in_range(value, 1, DATAMGR_MAX_SHARDS);
+        return context->shards < 0 ? -1 : 0;
+    }
+    if ((value = option_value(arg, "--log-flush-bytes")) != NULL) {
+        int bytes = parse_int_in_range(value, 1, LOGWRITER_BUFFER_SIZE);
+
+        context->log_policy.flush_bytes = (size_t)bytes;
+        return bytes < 0 ? -1 : 0;
+    }
+    if ((value = option_value(arg, "--log-flush-ms")) != NULL) {
+        context->log_policy.flush_ms = parse_int_in_range(value, 0, 60000);
+        return context->log_policy.flush_ms < 0 ? -1 : 0;
+    }
+    if ((value = option_value(arg, "--log-flush-on-alert")) != NULL) {
+        int enabled = parse_int_in_range(value, 0, 1);
+
+        context->log_policy.flush_on_alert = enabled == 1;
+        return enabled < 0 ? -1 : 0;
+    }
+    if ((value = option_value(arg, "--data-log")) != NULL) {
+        return parse_data_log_mode(value, context);
+    }
+    if ((value = option_value(arg, "--shed-depth")) != NULL) {
+        context->shed_depth = parse_int_in_range(value, 0, 1000000);
+        return context->shed_depth < 0 ? -1 : 0;
+    }
+    if ((value = option_value(arg, "--reorder-watermark")) != NULL) {
+        context->reorder_watermark = parse_int_in_range(value, 0, 3600);
+        return context->reorder_watermark < 0 ? -1 : 0;
+    }
+    if ((value = option_value(arg, "--thresholds")) != NULL) {
+        if (*value == '\0') return -1;
+        context->thresholds_path = value;
+        return 0;
+    }
+    if ((value = option_value(arg, "--silence-seconds")) != NULL) {
+        context->liveness.silence_min = parse_int_in_range(value, 1, 86400);
+        return context->liveness.silence_min < 0 ? -1 : 0;
+    }
+    if ((value = option_value(arg, "--stuck-seconds")) != NULL) {
+        context->liveness.stuck_seconds = parse_int_in_range(value, 0, 7 * 86400);
+        return context->liveness.stuck_seconds < 0 ? -1 : 0;
+    }
+    if ((value = option_value(arg, "--checkpoint")) != NULL) {
+        if (*value == '\0') return -1;
+        context->checkpoint_path = value;
+        return 0;
+    }
+    if ((value = option_value(arg, "--checkpoint-interval")) != NULL) {
+        context->checkpoint_interval = parse_int_in_range(value, 0, 86400);
+        return context->checkpoint_interval < 0 ? -1 : 0;
+    }
+    if ((value = option_value(arg, "--checkpoint-max-age")) != NULL) {
+        context->checkpoint_max_age = parse_int_in_range(value, 0, 7 * 86400);
+        return context->checkpoint_max_age < 0 ? -1 : 0;
+    }
+    if ((value = option_value(arg, "--query-socket")) != NULL) {
+        if (*value == '\0') return -1;
+        context->query_socket = strcmp(value, "off") == 0 ? "" : value;
+        return 0;
+    }
+    if ((value = option_value(arg, "--storage")) != NULL) {
+        int enabled = parse_int_in_range(value, 0, 1);
+
+        context->storage = enabled == 1;
+        return enabled < 0 ? -1 : 0;
+    }
+    if ((value = option_value(arg, "--storage-commit-rows")) != NULL) {
+        context->storage_commit_rows = parse_int_in_range(value, 1, STORAGEMGR_QUEUE_CAPACITY);
+        return context->storage_commit_rows < 0 ? -1 : 0;
+    }
+    if ((value = option_value(arg, "--storage-commit-ms")) != NULL) {
+        context->storage_commit_ms = parse_int_in_range(value, 0, 60000);
+        return context->storage_commit_ms < 0 ? -1 : 0;
+    }
+    if ((value = option_value(arg, "--db-profile")) != NULL) {
+        if (sensor_db_find_profile(value) == NULL) return -1;
+        context->db_profile = value;
+        return 0;
+    }
+    if ((value = option_value(arg, "--db-partition")) != NULL) {
+        if (strcmp(value, "hour") == 0) {
+            context->db_partition_seconds = 3600;
+        } else if (strcmp(value, "day") == 0) {
+            context->db_partition_seconds = 86400;
+        } else {
+            return -1;
+        }
+        return 0;
+    }
+    if ((value = option_value(arg, "--db-retention-hours")) != NULL) {
+        context->db_retention_hours = parse_int_in_range(value, 0, 24 * 365 * 100);
+        return context->db_retention_hours < 0 ? -1 : 0;
+    }
+    if ((value = option_value(arg, "--db-archive")) != NULL) {
+        if (*value == '\0') return -1;
+        context->db_archive = strcmp(value, "off") == 0 ? "" : value;
+        return 0;
+    }
+    if ((value = option_value(arg, "--log-format")) != NULL) {
+        if (strcmp(value, "text") == 0) {
+            context->log_format = DATAMGR_LOG_TEXT;
+        } else if (strcmp(value, "binary") == 0) {
+            context->log_format = DATAMGR_LOG_BINARY;
+        } else {
+            return -1;
+        }
+        return 0;
+    }
+    return -1;
+}
+
 static int parse_runtime_args(int argc, char *argv[], app_context_t *context)
 {
+    char *positional[2];
+    int positional_count = 0;
+
     if (context == NULL) return -1;
     context->timeout_seconds = TIMEOUT;
+    context->avg_window = RUN_AVG_LENGTH;
+    context->summary_interval = STATS_SUMMARY_INTERVAL;
+    context->shards = 1;
+    logwriter_default_policy(&context->log_policy);
+    context->log_format = DATAMGR_LOG_TEXT;
+    context->data_log_mode = DATAMGR_DATA_LOG_ALL;
+    context->data_log_parameter = 0;
+    context->shed_depth = DATA_LOG_SHED_DEPTH;
+    context->reorder_watermark = REORDER_WATERMARK;
+    context->thresholds_path = THRESHOLDS_FILE;
+    liveness_default_config(&context->liveness);
+    context->checkpoint_path = CHECKPOINT_FILE;
+    context->checkpoint_interval = CHECKPOINT_INTERVAL;
+    context->checkpoint_max_age = CHECKPOINT_MAX_AGE;
+    context->query_socket = QUERY_SOCKET;
+    context->storage = true;
+    context->storage_commit_rows = STORAGE_COMMIT_ROWS;
+    context->storage_commit_ms = STORAGE_COMMIT_MS;
+    context->db_profile = DB_PROFILE;
+    context->db_partition_seconds = DB_PARTITION_SECONDS;
+    context->db_retention_hours = DB_RETENTION_HOURS;
+    context->db_archive = DB_ARCHIVE_FILE;
 
-    if (argc == 2) {
-        context->port = parse_int_in_range(argv[1], 1, 65535);
+    for (int index = 1; index < argc; index++) {
+        if (strncmp(argv[index], "--", 2) == 0) {
+            if (parse_option(argv[index], context) != 0) {
+                fprintf(stderr, "Invalid option: %s\n", argv[index]);
+                print_usage(argv[0]);
+                return -1;
+            }
+            continue;
+        }
+        if (positional_count == 2) {
+            print_usage(argv[0]);
+            return -1;
+        }
+        positional[positional_count++] = argv[index];
+    }
+
+    if (positional_count == 1) {
+        context->port = parse_int_in_range(positional[0], 1, 65535);
         if (context->port < 0) {
-            fprintf(stderr, "Invalid port: %s\n", argv[1]);
-            fprintf(stderr, "Usage: %s [port] [idle_timeout_seconds]\n", argv[0]);
+            fprintf(stderr, "Invalid port: %s\n", positional[0]);
+            print_usage(argv[0]);
             return -1;
         }
         return 0;
     }
 
-    if (argc == 3) {
-        context->port = parse_int_in_range(argv[1], 1, 65535);
-        context->timeout_seconds = parse_int_in_range(argv[2], 0, 86400);
+    if (positional_count == 2) {
+        context->port = parse_int_in_range(positional[0], 1, 65535);
+        context->timeout_seconds = parse_int_in_range(positional[1], 0, 86400);
         if (context->port < 0 || context->timeout_seconds < 0) {
-            fprintf(stderr, "Invalid arguments: port=%s timeout=%s\n", argv[1], argv[2]);
-            fprintf(stderr, "Usage: %s [port] [idle_timeout_seconds]\n", argv[0]);
+            fprintf(stderr, "Invalid arguments: port=%s timeout=%s\n", positional[0], positional[1]);
+            print_usage(argv[0]);
             fprintf(stderr, "idle_timeout_seconds=0 means listen forever\n");
             return -1;
         }
         return 0;
     }
 
-    if (argc == 1) {
-        fprintf(stderr, "Usage: %s [port] [idle_timeout_seconds]\n", argv[0]);
-        return -1;
-    }
-
-    fprintf(stderr, "Usage: %s [port] [idle_timeout_seconds]\n", argv[0]);
+    print_usage(argv[0]);
     return -1;
 }
 
-static int run_connmgr_child(const app_context_t *context, int pipe_write_fd)
+static int run_connmgr_child(const app_context_t *context, const int *pipe_write_fds, int storage_write_fd)
 {
     if (context == NULL) return EXIT_FAILURE;
 
     signal(SIGPIPE, SIG_IGN);
-    return connmgr_listen(pipe_write_fd, context->port, context->timeout_seconds);
+    connmgr_set_storage_fd(storage_write_fd);
+    return connmgr_listen(pipe_write_fds, context->shards, context->port, context->timeout_seconds);
 }
 
-static int run_datamgr_child(const app_context_t *context, int pipe_read_fd)
+static int run_datamgr_child(const app_context_t *context, int shard, int pipe_read_fd, int summary_write_fd)
 {
     FILE *map_file = fopen("room_sensor.map", "r");
 
@@ -84,6 +361,25 @@ static int run_datamgr_child(const app_context_t *context, int pipe_read_fd)
     }
 
     datamgr_set_listen_port(context->port);
+    datamgr_set_summary_interval(context->summary_interval);
+    datamgr_set_shard(shard, context->shards);
+    datamgr_set_summary_fd(summary_write_fd);
+    datamgr_set_log_policy(&context->log_policy);
+    datamgr_set_log_format(context->log_format);
+    datamgr_set_shed_depth(context->shed_depth);
+    datamgr_set_reorder_watermark(context->reorder_watermark);
+    datamgr_set_thresholds_file(context->thresholds_path);
+    datamgr_set_liveness(&context->liveness);
+    datamgr_set_checkpoint(context->checkpoint_path, context->checkpoint_interval, context->checkpoint_max_age);
+    datamgr_set_query_socket(context->query_socket);
+    if (datamgr_set_data_log(context->data_log_mode, context->data_log_parameter) != 0) {
+        fclose(map_file);
+        return EXIT_FAILURE;
+    }
+    if (datamgr_set_avg_window((size_t)context->avg_window) != 0) {
+        fclose(map_file);
+        return EXIT_FAILURE;
+    }
     /* Child side: pipe input -> running averages -> gateway.log. */
     if (datamgr_parse_sensor_pipe(pipe_read_fd, map_file) != 0) {
         fclose(map_file);
@@ -95,6 +391,81 @@ static int run_datamgr_child(const app_context_t *context, int pipe_read_fd)
     return EXIT_SUCCESS;
 }
 
+static int run_storagemgr_child(const app_context_t *context, int pipe_read_fd)
+{
+    if (context == NULL) return EXIT_FAILURE;
+
+    /* Child side: pipe input -> group commits -> Sensor.db. */
+    storagemgr_set_commit_policy((size_t)context->storage_commit_rows, context->storage_commit_ms);
+    storagemgr_set_report_interval(context->summary_interval);
+    storagemgr_set_retention((sensor_ts_t)context->db_retention_hours * 3600);
+    storagemgr_set_archive(context->db_archive);
+    if (storagemgr_run(pipe_read_fd) != 0) {
+        fprintf(stderr, "storagemgr: database unavailable, readings are not stored\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static void close_pipes(int pipes[][2], int count)
+{
+    for (int index = 0; index < count; index++) {
+        if (pipes[index][0] >= 0) close(pipes[index][0]);
+        if (pipes[index][1] >= 0) close(pipes[index][1]);
+        pipes[index][0] = -1;
+        pipes[index][1] = -1;
+    }
+}
+
+/*
+ * Reads one datamgr_summary_t per shard until every shard closed its end of
+ * the summary pipe, then appends the merged GATEWAY_SUMMARY to gateway.log.
+ */
+static void write_gateway_summary(int summary_read_fd, int shards)
+{
+    datamgr_summary_t merged = {0};
+    datamgr_summary_t summary;
+    int reported = 0;
+    FILE *log_file;
+
+    while (true) {
+        ssize_t rc = read(summary_read_fd, &summary, sizeof(summary));
+
+        if (rc < 0 && errno == EINTR) continue;
+        if (rc != (ssize_t)sizeof(summary)) break;
+        merged.sensors += summary.sensors;
+        merged.readings += summary.readings;
+        merged.invalid += summary.invalid;
+        merged.alerts += summary.alerts;
+        merged.late += summary.late;
+        stats_merge(&merged.stats, &summary.stats);
+        reported++;
+    }
+
+    log_file = fopen(FIFO_LOG, "a");
+    if (log_file == NULL) return;
+    fprintf(
+        log_file,
+        "GATEWAY_SUMMARY shards=%d/%d sensors=%u readings=%llu invalid=%llu alerts=%llu late=%llu "
+        "min=%.2f max=%.2f mean=%.2f stddev=%.2f p50=%.2f p95=%.2f p99=%.2f\n",
+        reported,
+        shards,
+        merged.sensors,
+        (unsigned long long)merged.readings,
+        (unsigned long long)merged.invalid,
+        (unsigned long long)merged.alerts,
+        (unsigned long long)merged.late,
+        merged.stats.min,
+        merged.stats.max,
+        merged.stats.mean,
+        sqrt(stats_variance(&merged.stats)),
+        stats_quantile(&merged.stats, 0.50),
+        stats_quantile(&merged.stats, 0.95),
+        stats_quantile(&merged.stats, 0.99)
+    );
+    fclose(log_file);
+}
+
 static int wait_for_child(pid_t pid, const char *label)
 {
     int status;
@@ -120,12 +491,16 @@ static int wait_for_child(pid_t pid, const char *label)
 int main(int argc, char *argv[])
 {
     app_context_t context = {0};
-    int data_pipe[2];
-    pid_t datamgr_pid;
+    int data_pipes[DATAMGR_MAX_SHARDS][2];
+    int pipe_write_fds[DATAMGR_MAX_SHARDS];
+    int summary_pipe[2] = {-1, -1};
+    int storage_pipe[2] = {-1, -1};
+    pid_t datamgr_pids[DATAMGR_MAX_SHARDS];
+    pid_t storagemgr_pid = -1;
     pid_t connmgr_pid;
     FILE *log_file;
     int connmgr_status;
-    int datamgr_status;
+    int datamgr_status = EXIT_SUCCESS;
 
     if (parse_runtime_args(argc, argv, &context) != 0) {
         return EXIT_FAILURE;
@@ -134,50 +509,129 @@ int main(int argc, char *argv[])
         perror("room_sensor.map");
         return EXIT_FAILURE;
     }
+    /* Inherited by every forked child that opens Sensor.db. */
+    sensor_db_set_profile(context.db_profile);
+    sensor_db_set_partition_seconds(context.db_partition_seconds);
 
     log_file = fopen(FIFO_LOG, "w");
     if (log_file != NULL) {
         fclose(log_file);
     }
+    for (int shard = 0; shard < context.shards && context.shards > 1; shard++) {
+        char shard_log[64];
+
+        snprintf(shard_log, sizeof(shard_log), "%s.%d", FIFO_LOG, shard);
+        log_file = fopen(shard_log, "w");
+        if (log_file != NULL) {
+            fclose(log_file);
+        }
+    }
 
-    if (pipe(data_pipe) != 0) {
+    for (int shard = 0; shard < DATAMGR_MAX_SHARDS; shard++) {
+        data_pipes[shard][0] = -1;
+        data_pipes[shard][1] = -1;
+    }
+    for (int shard = 0; shard < context.shards; shard++) {
+        if (pipe(data_pipes[shard]) != 0) {
+            perror("pipe");
+            close_pipes(data_pipes, context.shards);
+            return EXIT_FAILURE;
+        }
+        pipe_write_fds[shard] = data_pipes[shard][1];
+    }
+    if (pipe(summary_pipe) != 0) {
         perror("pipe");
+        close_pipes(data_pipes, context.shards);
         return EXIT_FAILURE;
     }
 
-    /* Start the consumer child first so the pipe reader is ready. */
-    datamgr_pid = fork();
-    if (datamgr_pid < 0) {
-        perror("fork");
-        close(data_pipe[0]);
-        close(data_pipe[1]);
-        return EXIT_FAILURE;
+    /* Start the consumer children first so the pipe readers are ready. */
+    for (int shard = 0; shard < context.shards; shard++) {
+        datamgr_pids[shard] = fork();
+        if (datamgr_pids[shard] < 0) {
+            perror("fork");
+            close_pipes(data_pipes, context.shards);
+            close_pipes(&summary_pipe, 1);
+            for (int started = 0; started < shard; started++) {
+                kill(datamgr_pids[started], SIGTERM);
+                waitpid(datamgr_pids[started], NULL, 0);
+            }
+            return EXIT_FAILURE;
+        }
+        if (datamgr_pids[shard] == 0) {
+            int read_fd = data_pipes[shard][0];
+
+            /* Keep only this shard's read end, or EOF would never arrive. */
+            data_pipes[shard][0] = -1;
+            close_pipes(data_pipes, context.shards);
+            close(summary_pipe[0]);
+            exit(run_datamgr_child(&context, shard, read_fd, summary_pipe[1]));
+        }
     }
-    if (datamgr_pid == 0) {
-        close(data_pipe[1]);
-        exit(run_datamgr_child(&context, data_pipe[0]));
+
+    /*
+     * The storage manager gets its own pipe, created after the datamgr forks so
+     * no shard holds a write end. A disk that cannot keep up drops readings at
+     * the pipe instead of slowing connmgr down.
+     */
+    if (context.storage && storagemgr_open_pipe(storage_pipe) != 0) {
+        perror("storage pipe");
+        storage_pipe[0] = storage_pipe[1] = -1;
     }
+    if (storage_pipe[0] >= 0) {
+        storagemgr_pid = fork();
+        if (storagemgr_pid < 0) {
+            perror("fork");
+            close_pipes(&storage_pipe, 1);
+        } else if (storagemgr_pid == 0) {
+            int read_fd = storage_pipe[0];
 
-    /* Then start the TCP receiver child that feeds the pipe. */
+            close(storage_pipe[1]);
+            close_pipes(data_pipes, context.shards);
+            close_pipes(&summary_pipe, 1);
+            exit(run_storagemgr_child(&context, read_fd));
+        }
+    }
+
+    /* Then start the TCP receiver child that feeds the pipes. */
     connmgr_pid = fork();
     if (connmgr_pid < 0) {
         perror("fork");
-        close(data_pipe[0]);
-        close(data_pipe[1]);
-        kill(datamgr_pid, SIGTERM);
-        waitpid(datamgr_pid, NULL, 0);
+        close_pipes(data_pipes, context.shards);
+        close_pipes(&summary_pipe, 1);
+        close_pipes(&storage_pipe, 1);
+        for (int shard = 0; shard < context.shards; shard++) {
+            kill(datamgr_pids[shard], SIGTERM);
+            waitpid(datamgr_pids[shard], NULL, 0);
+        }
+        if (storagemgr_pid > 0) waitpid(storagemgr_pid, NULL, 0);
         return EXIT_FAILURE;
     }
     if (connmgr_pid == 0) {
-        close(data_pipe[0]);
-        exit(run_connmgr_child(&context, data_pipe[1]));
+        for (int shard = 0; shard < context.shards; shard++) {
+            close(data_pipes[shard][0]);
+        }
+        close_pipes(&summary_pipe, 1);
+        if (storage_pipe[0] >= 0) close(storage_pipe[0]);
+        exit(run_connmgr_child(&context, pipe_write_fds, storage_pipe[1]));
     }
 
-    close(data_pipe[0]);
-    close(data_pipe[1]);
+    close_pipes(data_pipes, context.shards);
+    close_pipes(&storage_pipe, 1);
+    close(summary_pipe[1]);
 
     connmgr_status = wait_for_child(connmgr_pid, "connmgr child");
-    datamgr_status = wait_for_child(datamgr_pid, "datamgr child");
+    write_gateway_summary(summary_pipe[0], context.shards);
+    close(summary_pipe[0]);
+    for (int shard = 0; shard < context.shards; shard++) {
+        if (wait_for_child(datamgr_pids[shard], "datamgr child") != EXIT_SUCCESS) {
+            datamgr_status = EXIT_FAILURE;
+        }
+    }
+
+    if (storagemgr_pid > 0 && wait_for_child(storagemgr_pid, "storagemgr child") != EXIT_SUCCESS) {
+        datamgr_status = EXIT_FAILURE;
+    }
 
     if (connmgr_status != EXIT_SUCCESS || datamgr_status != EXIT_SUCCESS) {
         return EXIT_FAILURE;
@@ -0,0 +1,228 @@
+/**
+ * \author Yongkai Zhang
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "query.h"
+
+#define QUERY_REPLY_INITIAL 4096
+
+static int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+
+    return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+int query_server_open(query_server_t *server, const char *path)
+{
+    struct sockaddr_un address;
+
+    memset(server, 0, sizeof(*server));
+    server->listen_fd = -1;
+    for (size_t index = 0; index < QUERY_MAX_CLIENTS; index++) {
+        server->clients[index].fd = -1;
+    }
+    if (strlen(path) >= sizeof(address.sun_path)) return -1;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path, strlen(path) + 1);
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server->listen_fd < 0) return -1;
+    unlink(path);
+    if (bind(server->listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(server->listen_fd, QUERY_MAX_CLIENTS) != 0 || set_nonblocking(server->listen_fd) != 0) {
+        close(server->listen_fd);
+        server->listen_fd = -1;
+        return -1;
+    }
+    snprintf(server->path, sizeof(server->path), "%s", path);
+    return 0;
+}
+
+static void drop_client(query_client_t *client)
+{
+    close(client->fd);
+    free(client->request);
+    free(client->reply.data);
+    memset(client, 0, sizeof(*client));
+    client->fd = -1;
+}
+
+void query_server_close(query_server_t *server)
+{
+    if (server->listen_fd < 0) return;
+    for (size_t index = 0; index < QUERY_MAX_CLIENTS; index++) {
+        if (server->clients[index].fd >= 0) {
+            drop_client(&server->clients[index]);
+        }
+    }
+    close(server->listen_fd);
+    server->listen_fd = -1;
+    unlink(server->path);
+}
+
+size_t query_server_pollfds(const query_server_t *server, struct pollfd *fds, size_t max)
+{
+    size_t count = 0;
+
+    if (server->listen_fd < 0 || max == 0) return 0;
+    fds[count++] = (struct pollfd){ .fd = server->listen_fd, .events = POLLIN };
+    for (size_t index = 0; index < QUERY_MAX_CLIENTS && count < max; index++) {
+        const query_client_t *client = &server->clients[index];
+
+        if (client->fd < 0) continue;
+        fds[count++] = (struct pollfd){
+            .fd = client->fd,
+            .events = (short)((client->closing ? 0 : POLLIN) | (client->sent < client->reply.used ? POLLOUT : 0))
+        };
+    }
+    return count;
+}
+
+void query_reply_printf(query_reply_t *reply, const char *format, ...)
+{
+    va_list args;
+    int length;
+
+    if (reply->overflow) return;
+    while (true) {
+        size_t room = reply->capacity - reply->used;
+        size_t capacity;
+        char *grown;
+
+        va_start(args, format);
+        length = vsnprintf(reply->data == NULL ? NULL : reply->data + reply->used, room, format, args);
+        va_end(args);
+        if (length < 0) return;
+        if ((size_t)length < room) break;
+
+        /* Grow to fit the line, then format it again. */
+        capacity = reply->capacity == 0 ? QUERY_REPLY_INITIAL : reply->capacity;
+        while (capacity - reply->used <= (size_t)length) capacity *= 2;
+        if (capacity > QUERY_REPLY_MAX || (grown = realloc(reply->data, capacity)) == NULL) {
+            reply->overflow = true;
+            return;
+        }
+        reply->data = grown;
+        reply->capacity = capacity;
+    }
+    reply->used += (size_t)length;
+}
+
+static void accept_clients(query_server_t *server)
+{
+    while (true) {
+        query_client_t *client = NULL;
+        int fd = accept(server->listen_fd, NULL, NULL);
+
+        if (fd < 0) return;     // EAGAIN: backlog empty
+        for (size_t index = 0; index < QUERY_MAX_CLIENTS && client == NULL; index++) {
+            if (server->clients[index].fd < 0) client = &server->clients[index];
+        }
+        if (client == NULL || set_nonblocking(fd) != 0 || (client->request = malloc(QUERY_LINE_MAX)) == NULL) {
+            close(fd);
+            continue;
+        }
+        client->fd = fd;
+        client->request_used = 0;
+        client->sent = 0;
+    }
+}
+
+/*
+ * Answers every complete line in the request buffer.
+ * Returns 1 once the client shut down its side, -1 when it must go.
+ */
+static int read_requests(query_client_t *client, query_handler_t handler, void *context)
+{
+    while (true) {
+        ssize_t rc = read(client->fd, client->request + client->request_used,
+                          QUERY_LINE_MAX - client->request_used);
+        size_t start = 0;
+
+        if (rc == 0) return 1;
+        if (rc < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        client->request_used += (size_t)rc;
+
+        for (size_t index = 0; index < client->request_used; index++) {
+            if (client->request[index] != '\n') continue;
+            client->request[index] = '\0';
+            if (index > start && client->request[index - 1] == '\r') client->request[index - 1] = '\0';
+            handler(client->request + start, &client->reply, context);
+            start = index + 1;
+        }
+        if (start == 0 && client->request_used == QUERY_LINE_MAX) {
+            query_reply_printf(&client->reply, "ERR request longer than %d bytes\n", QUERY_LINE_MAX);
+            client->request_used = 0;
+            return 0;
+        }
+        client->request_used -= start;
+        memmove(client->request, client->request + start, client->request_used);
+        if (client->reply.overflow) return -1;
+    }
+}
+
+static int write_replies(query_client_t *client)
+{
+    while (client->sent < client->reply.used) {
+        ssize_t rc = send(client->fd, client->reply.data + client->sent, client->reply.used - client->sent,
+                          MSG_NOSIGNAL);
+
+        if (rc < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        client->sent += (size_t)rc;
+    }
+    client->reply.used = 0;
+    client->sent = 0;
+    return 0;
+}
+
+void query_server_dispatch(query_server_t *server, const struct pollfd *fds, size_t count, query_handler_t handler,
+                           void *context)
+{
+    bool pending_accept = false;
+
+    for (size_t entry = 0; entry < count; entry++) {
+        if (fds[entry].revents == 0) continue;
+        if (fds[entry].fd == server->listen_fd) {
+            pending_accept = true;
+            continue;
+        }
+        for (size_t index = 0; index < QUERY_MAX_CLIENTS; index++) {
+            query_client_t *client = &server->clients[index];
+
+            int rc = 0;
+
+            if (client->fd != fds[entry].fd) continue;
+            if (!client->closing && (fds[entry].revents & (POLLIN | POLLHUP | POLLERR)) != 0) {
+                rc = read_requests(client, handler, context);
+                client->closing = rc == 1;
+            }
+            /* A client that shut down its side still gets the replies to what it sent. */
+            if (rc < 0 || write_replies(client) != 0 || (client->closing && client->reply.used == 0)) {
+                drop_client(client);
+            }
+            break;
+        }
+    }
+    if (pending_accept) {
+        accept_clients(server);
+    }
+}
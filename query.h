@@ -0,0 +1,79 @@
+/**
+ * \author Yongkai Zhang
+ */
+
+#ifndef _QUERY_H_
+#define _QUERY_H_
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define QUERY_MAX_CLIENTS 16
+#define QUERY_LINE_MAX (64 * 1024)          // one request line, e.g. GET with thousands of ids
+#define QUERY_REPLY_MAX (16 * 1024 * 1024)  // unsent reply bytes before a client is dropped
+
+/**
+ * Reply text of one client, grown on demand
+ */
+typedef struct {
+    char *data;
+    size_t used;
+    size_t capacity;
+    bool overflow;              /**< QUERY_REPLY_MAX was exceeded; the client is dropped */
+} query_reply_t;
+
+typedef struct {
+    int fd;                     /**< -1 when the entry is free */
+    char *request;              /**< QUERY_LINE_MAX bytes, partial line at the front */
+    size_t request_used;
+    query_reply_t reply;
+    size_t sent;                /**< bytes of 'reply' already written */
+    bool closing;               /**< peer shut down writing; dropped once the reply is out */
+} query_client_t;
+
+/**
+ * Non-blocking line-oriented server on a Unix stream socket; it never blocks
+ * the caller's poll loop on a slow or stalled client.
+ */
+typedef struct {
+    int listen_fd;
+    char path[108];
+    query_client_t clients[QUERY_MAX_CLIENTS];
+} query_server_t;
+
+/**
+ * Answers one request line (newline stripped, NUL terminated) by appending to 'reply'
+ */
+typedef void (*query_handler_t)(char *request, query_reply_t *reply, void *context);
+
+/**
+ * Binds and listens on 'path'; a stale socket file left by a previous run is replaced
+ * \return zero on success, -1 on failure (the server stays closed)
+ */
+int query_server_open(query_server_t *server, const char *path);
+
+/**
+ * Closes every connection and removes the socket file
+ */
+void query_server_close(query_server_t *server);
+
+/**
+ * Adds the listening socket and every client to 'fds'
+ * \return number of entries written, at most 'max'
+ */
+size_t query_server_pollfds(const query_server_t *server, struct pollfd *fds, size_t max);
+
+/**
+ * Accepts, reads and answers whatever poll() reported ready in 'fds'
+ * (entries produced by query_server_pollfds()), then writes pending replies
+ */
+void query_server_dispatch(query_server_t *server, const struct pollfd *fds, size_t count, query_handler_t handler,
+                           void *context);
+
+/**
+ * Appends formatted text to a reply, like printf
+ */
+void query_reply_printf(query_reply_t *reply, const char *format, ...);
+
+#endif /* _QUERY_H_ */
@@ -0,0 +1,126 @@
+/**
+ * \author Yongkai Zhang
+ */
+
+#include <string.h>
+#include "reorder.h"
+
+#define RING_MASK (REORDER_CAPACITY - 1)
+
+_Static_assert((REORDER_CAPACITY & RING_MASK) == 0, "REORDER_CAPACITY must be a power of two");
+
+void reorder_init(reorder_buffer_t *buffer)
+{
+    memset(buffer, 0, sizeof(*buffer));
+}
+
+static void release_oldest(reorder_buffer_t *buffer, reorder_sink_t sink, void *context)
+{
+    const sensor_data_t *oldest = &buffer->readings[buffer->head];
+
+    buffer->released_ts = oldest->timestamp;
+    buffer->has_released = true;
+    buffer->head = (uint8_t)((buffer->head + 1) & RING_MASK);
+    buffer->count--;
+    sink(oldest, context);
+}
+
+int reorder_push(reorder_buffer_t *buffer, const sensor_data_t *reading, sensor_ts_t watermark,
+                 sensor_ts_t now, reorder_sink_t sink, void *context)
+{
+    size_t position;
+
+    buffer->arrived_at = now;
+    if (buffer->has_released && reading->timestamp < buffer->released_ts) return REORDER_LATE;
+
+    if (buffer->count == REORDER_CAPACITY) {
+        release_oldest(buffer, sink, context);
+        if (reading->timestamp < buffer->released_ts) return REORDER_LATE;
+    }
+
+    /* Insertion from the tail: in-order arrivals do not move anything. */
+    position = buffer->count;
+    while (position > 0) {
+        const sensor_data_t *previous = &buffer->readings[(buffer->head + position - 1) & RING_MASK];
+
+        if (previous->timestamp <= reading->timestamp) break;
+        buffer->readings[(buffer->head + position) & RING_MASK] = *previous;
+        position--;
+    }
+    buffer->readings[(buffer->head + position) & RING_MASK] = *reading;
+    buffer->count++;
+    if (reading->timestamp > buffer->newest_ts) {
+        buffer->newest_ts = reading->timestamp;
+    }
+
+    reorder_release_until(buffer, buffer->newest_ts - watermark, sink, context);
+    return 0;
+}
+
+void reorder_release_until(reorder_buffer_t *buffer, sensor_ts_t limit, reorder_sink_t sink, void *context)
+{
+    while (buffer->count > 0 && buffer->readings[buffer->head].timestamp <= limit) {
+        release_oldest(buffer, sink, context);
+    }
+}
+
+void reorder_flush(reorder_buffer_t *buffer, reorder_sink_t sink, void *context)
+{
+    while (buffer->count > 0) {
+        release_oldest(buffer, sink, context);
+    }
+}
+
+void reorder_queue_init(reorder_queue_t *queue)
+{
+    queue->head = -1;
+    queue->tail = -1;
+}
+
+static void queue_unlink(reorder_queue_t *queue, reorder_buffer_t *buffers, int32_t index)
+{
+    reorder_buffer_t *buffer = &buffers[index];
+
+    if (buffer->queue_prev < 0) {
+        queue->head = buffer->queue_next;
+    } else {
+        buffers[buffer->queue_prev].queue_next = buffer->queue_next;
+    }
+    if (buffer->queue_next < 0) {
+        queue->tail = buffer->queue_prev;
+    } else {
+        buffers[buffer->queue_next].queue_prev = buffer->queue_prev;
+    }
+    buffer->queued = false;
+}
+
+void reorder_queue_touch(reorder_queue_t *queue, reorder_buffer_t *buffers, int32_t index)
+{
+    reorder_buffer_t *buffer = &buffers[index];
+
+    if (buffer->queued) {
+        if (queue->tail == index && buffer->count > 0) return;
+        queue_unlink(queue, buffers, index);
+    }
+    if (buffer->count == 0) return;
+    buffer->queue_prev = queue->tail;
+    buffer->queue_next = -1;
+    if (queue->tail < 0) {
+        queue->head = index;
+    } else {
+        buffers[queue->tail].queue_next = index;
+    }
+    queue->tail = index;
+    buffer->queued = true;
+}
+
+void reorder_queue_release_idle(reorder_queue_t *queue, reorder_buffer_t *buffers, sensor_ts_t now,
+                                sensor_ts_t idle, reorder_sink_t sink, void *context)
+{
+    while (queue->head >= 0 && now - buffers[queue->head].arrived_at >= idle) {
+        int32_t index = queue->head;
+
+        queue_unlink(queue, buffers, index);
+        reorder_flush(&buffers[index], sink, context);
+    }
+}
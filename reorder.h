@@ -0,0 +1,89 @@
+/**
+ * \author Yongkai Zhang
+ */
+
+#ifndef _REORDER_H_
+#define _REORDER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "config.h"
+
+#define REORDER_CAPACITY 8          // readings held per sensor, power of two
+#define REORDER_LATE 1
+
+/**
+ * Readings of one sensor held back until the watermark passes them,
+ * kept sorted by timestamp in a small ring (oldest at 'head').
+ */
+typedef struct {
+    sensor_data_t readings[REORDER_CAPACITY];
+    uint8_t head;
+    uint8_t count;
+    bool has_released;
+    sensor_ts_t newest_ts;      /**< newest timestamp seen so far */
+    sensor_ts_t released_ts;    /**< timestamp of the last released reading */
+    sensor_ts_t arrived_at;     /**< wall-clock time of the last push */
+    bool queued;                /**< linked in a reorder_queue_t */
+    int32_t queue_prev;
+    int32_t queue_next;
+} reorder_buffer_t;
+
+/**
+ * The buffers of an array that hold readings, in the order of their last push.
+ * Pushes happen at non-decreasing wall-clock times, so the buffers that went
+ * idle are always at the front and are found without visiting the others.
+ */
+typedef struct {
+    int32_t head;               /**< index of the least recently pushed buffer, -1 when empty */
+    int32_t tail;
+} reorder_queue_t;
+
+/**
+ * Receives readings in timestamp order
+ */
+typedef void (*reorder_sink_t)(const sensor_data_t *reading, void *context);
+
+/**
+ * Empties the buffer
+ */
+void reorder_init(reorder_buffer_t *buffer);
+
+/**
+ * Buffers one reading that arrived at wall-clock time 'now' and releases every reading that is at least 'watermark'
+ * seconds older than the newest one seen. Readings with equal timestamps keep
+ * arrival order. When the buffer is full the oldest reading is released early.
+ * In-order arrivals cost O(1); a late one shifts at most REORDER_CAPACITY entries.
+ * \return 0 when accepted, REORDER_LATE when the reading is older than one already
+ *         released (it is not buffered and the caller routes it elsewhere)
+ */
+int reorder_push(reorder_buffer_t *buffer, const sensor_data_t *reading, sensor_ts_t watermark,
+                 sensor_ts_t now, reorder_sink_t sink, void *context);
+
+/**
+ * Releases every buffered reading with a timestamp <= 'limit'
+ */
+void reorder_release_until(reorder_buffer_t *buffer, sensor_ts_t limit, reorder_sink_t sink, void *context);
+
+/**
+ * Releases everything that is buffered (used at shutdown)
+ */
+void reorder_flush(reorder_buffer_t *buffer, reorder_sink_t sink, void *context);
+
+void reorder_queue_init(reorder_queue_t *queue);
+
+/**
+ * Moves buffers[index] to the back of the queue after a push, or takes it out when
+ * the push left it empty. O(1).
+ */
+void reorder_queue_touch(reorder_queue_t *queue, reorder_buffer_t *buffers, int32_t index);
+
+/**
+ * Releases everything held by the buffers whose sensor has been quiet for 'idle'
+ * seconds of wall-clock time, so a sensor that stops sending is not held back
+ * forever. Visits only those buffers plus the first one that is not idle.
+ */
+void reorder_queue_release_idle(reorder_queue_t *queue, reorder_buffer_t *buffers, sensor_ts_t now,
+                                sensor_ts_t idle, reorder_sink_t sink, void *context);
+
+#endif /* _REORDER_H_ */
@@ -0,0 +1,74 @@
+/**
+ * \author Yongkai Zhang
+ */
+
+#include "config.h"
+#include "rollup.h"
+
+static const int32_t resolutions[ROLLUP_RESOLUTION_COUNT] = {1, 60, 3600};
+
+int32_t rollup_resolution(int index)
+{
+    if (index < 0 || index >= ROLLUP_RESOLUTION_COUNT) return 0;
+    return resolutions[index];
+}
+
+void rollup_init(sensor_rollup_t *rollup, sensor_id_t sensor_id, uint16_t room_id)
+{
+    for (int index = 0; index < ROLLUP_RESOLUTION_COUNT; index++) {
+        rollup_record_t *window = &rollup->open[index];
+
+        window->sensor_id = sensor_id;
+        window->room_id = room_id;
+        window->resolution = resolutions[index];
+        window->window_start = 0;
+        window->count = 0;
+        window->sum = 0;
+        window->min = 0;
+        window->max = 0;
+    }
+}
+
+static sensor_ts_t align_down(sensor_ts_t ts, int32_t resolution)
+{
+    sensor_ts_t remainder = ts % resolution;
+
+    if (remainder < 0) remainder += resolution;
+    return ts - remainder;
+}
+
+void rollup_add(sensor_rollup_t *rollup, sensor_ts_t ts, sensor_value_t value,
+                rollup_sink_t sink, void *context)
+{
+    for (int index = 0; index < ROLLUP_RESOLUTION_COUNT; index++) {
+        rollup_record_t *window = &rollup->open[index];
+        sensor_ts_t start = align_down(ts, window->resolution);
+
+        if (window->count > 0 && start > window->window_start) {
+            if (sink != NULL) sink(window, context);
+            window->count = 0;
+        }
+        if (window->count == 0) {
+            window->window_start = start;
+            window->sum = 0;
+            window->min = value;
+            window->max = value;
+        }
+
+        window->count++;
+        window->sum += value;
+        if (value < window->min) window->min = value;
+        if (value > window->max) window->max = value;
+    }
+}
+
+void rollup_close_all(sensor_rollup_t *rollup, rollup_sink_t sink, void *context)
+{
+    for (int index = 0; index < ROLLUP_RESOLUTION_COUNT; index++) {
+        rollup_record_t *window = &rollup->open[index];
+
+        if (window->count == 0) continue;
+        if (sink != NULL) sink(window, context);
+        window->count = 0;
+    }
+}
@@ -0,0 +1,62 @@
+/**
+ * \author Yongkai Zhang
+ */
+
+#ifndef _ROLLUP_H_
+#define _ROLLUP_H_
+
+#include <stdint.h>
+#include "config.h"
+
+#define ROLLUP_RESOLUTION_COUNT 3   // 1 s, 1 min, 1 h tumbling windows
+
+/**
+ * Aggregate of one closed (or open) tumbling window of one sensor
+ */
+typedef struct {
+    sensor_id_t sensor_id;
+    uint16_t room_id;
+    int32_t resolution;         /**< window length in seconds */
+    sensor_ts_t window_start;   /**< aligned to a multiple of 'resolution' */
+    uint32_t count;
+    double sum;
+    double min;
+    double max;
+} rollup_record_t;
+
+/**
+ * Open windows of one sensor, one per resolution
+ */
+typedef struct {
+    rollup_record_t open[ROLLUP_RESOLUTION_COUNT];
+} sensor_rollup_t;
+
+/**
+ * Receives every window that closes
+ */
+typedef void (*rollup_sink_t)(const rollup_record_t *record, void *context);
+
+/**
+ * \return the window length in seconds of resolution 'index'
+ */
+int32_t rollup_resolution(int index);
+
+/**
+ * Prepares the open windows of one sensor
+ */
+void rollup_init(sensor_rollup_t *rollup, sensor_id_t sensor_id, uint16_t room_id);
+
+/**
+ * Folds one reading into all resolutions in O(1). A reading whose timestamp is
+ * past an open window closes it (the window is handed to 'sink') and opens the
+ * next one. Late readings are folded into the window that is currently open.
+ */
+void rollup_add(sensor_rollup_t *rollup, sensor_ts_t ts, sensor_value_t value,
+                rollup_sink_t sink, void *context);
+
+/**
+ * Hands every non-empty open window to 'sink' and clears it (used at shutdown)
+ */
+void rollup_close_all(sensor_rollup_t *rollup, rollup_sink_t sink, void *context);
+
+#endif /* _ROLLUP_H_ */
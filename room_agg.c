@@ -0,0 +1,168 @@
+/**
+ * \author Yongkai Zhang
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "room_agg.h"
+
+#define ROOM_ID_SPACE 65536
+
+int room_index_build(room_index_t *index, const sensor_table_t *table)
+{
+    uint32_t *fill;
+    size_t capacity = table->count == 0 ? 1 : table->count;
+
+    memset(index, 0, sizeof(*index));
+    index->room_lookup = malloc(ROOM_ID_SPACE * sizeof(*index->room_lookup));
+    index->rooms = calloc(capacity, sizeof(*index->rooms));
+    index->members = calloc(capacity, sizeof(*index->members));
+    index->room_of_slot = calloc(capacity, sizeof(*index->room_of_slot));
+    index->contribution = calloc(capacity, sizeof(*index->contribution));
+    index->contributing = calloc(capacity, sizeof(*index->contributing));
+    fill = calloc(capacity, sizeof(*fill));
+    if (index->room_lookup == NULL || index->rooms == NULL || index->members == NULL ||
+        index->room_of_slot == NULL || index->contribution == NULL || index->contributing == NULL ||
+        fill == NULL) {
+        free(fill);
+        room_index_free(index);
+        return -1;
+    }
+    for (size_t room_id = 0; room_id < ROOM_ID_SPACE; room_id++) {
+        index->room_lookup[room_id] = ROOM_NONE;
+    }
+
+    /* Pass 1: assign room indexes and count members. */
+    for (size_t slot = 0; slot < table->count; slot++) {
+        uint16_t room_id = table->room_ids[slot];
+        int room = index->room_lookup[room_id];
+
+        if (room == ROOM_NONE) {
+            room = (int)index->count++;
+            index->room_lookup[room_id] = room;
+            index->rooms[room].room_id = room_id;
+            index->rooms[room].hottest = -1;
+            index->rooms[room].coldest = -1;
+        }
+        index->room_of_slot[slot] = room;
+        index->rooms[room].member_count++;
+    }
+
+    /* Pass 2: lay members out contiguously per room. */
+    for (size_t room = 1; room < index->count; room++) {
+        index->rooms[room].first_member = index->rooms[room - 1].first_member + index->rooms[room - 1].member_count;
+    }
+    for (size_t slot = 0; slot < table->count; slot++) {
+        room_state_t *state = &index->rooms[index->room_of_slot[slot]];
+
+        index->members[state->first_member + fill[index->room_of_slot[slot]]++] = (uint32_t)slot;
+    }
+    free(fill);
+    return 0;
+}
+
+void room_index_free(room_index_t *index)
+{
+    if (index == NULL) return;
+    free(index->rooms);
+    free(index->members);
+    free(index->room_of_slot);
+    free(index->contribution);
+    free(index->contributing);
+    free(index->room_lookup);
+    memset(index, 0, sizeof(*index));
+}
+
+/* Recomputes sum and extremes of one room from its members: O(room size). */
+static void rescan_room(room_index_t *index, room_state_t *room)
+{
+    room->avg_sum = 0;
+    room->hottest = -1;
+    room->coldest = -1;
+    room->updates = 0;
+    for (uint32_t member = 0; member < room->member_count; member++) {
+        int slot = (int)index->members[room->first_member + member];
+        double value = index->contribution[slot];
+
+        if (!index->contributing[slot]) continue;
+        room->avg_sum += value;
+        if (room->hottest < 0 || value > index->contribution[room->hottest]) room->hottest = slot;
+        if (room->coldest < 0 || value < index->contribution[room->coldest]) room->coldest = slot;
+    }
+}
+
+int room_update(room_index_t *index, int slot, double average, bool warm, double min_temp, double max_temp,
+                double hysteresis)
+{
+    int room_number = index->room_of_slot[slot];
+    room_state_t *room = &index->rooms[room_number];
+    bool was_contributing = index->contributing[slot];
+    double previous = index->contribution[slot];
+    bool rescan = false;
+    int8_t new_state = 0;
+
+    if (!warm) {
+        if (!was_contributing) return ROOM_NONE;
+        /* Sensor left the room aggregate (window restarted). */
+        index->contributing[slot] = false;
+        room->warm_count--;
+        rescan = true;
+    } else {
+        index->contribution[slot] = average;
+        index->contributing[slot] = true;
+        if (was_contributing) {
+            room->avg_sum += average - previous;
+        } else {
+            room->avg_sum += average;
+            room->warm_count++;
+        }
+
+        if (room->hottest < 0 || average >= index->contribution[room->hottest]) {
+            room->hottest = slot;
+        } else if (room->hottest == slot) {
+            rescan = true;      /* the hottest sensor cooled down */
+        }
+        if (room->coldest < 0 || average <= index->contribution[room->coldest]) {
+            room->coldest = slot;
+        } else if (room->coldest == slot) {
+            rescan = true;      /* the coldest sensor warmed up */
+        }
+    }
+
+    /* Recompute the sum every 64 updates per member so drift stays bounded (amortized O(1)). */
+    if (rescan || ++room->updates >= room->member_count * 64) {
+        rescan_room(index, room);
+    }
+
+    if (room->warm_count > 0) {
+        double mean = room->avg_sum / (double)room->warm_count;
+
+        if (room->state == 1 && mean > max_temp - hysteresis) {
+            new_state = 1;
+        } else if (room->state == -1 && mean < min_temp + hysteresis) {
+            new_state = -1;
+        } else if (mean < min_temp) {
+            new_state = -1;
+        } else if (mean > max_temp) {
+            new_state = 1;
+        }
+    }
+    if (new_state == room->state) return ROOM_NONE;
+    room->state = new_state;
+    return room_number;
+}
+
+double room_mean(const room_index_t *index, int room)
+{
+    const room_state_t *state = &index->rooms[room];
+
+    if (state->warm_count == 0) return 0;
+    return state->avg_sum / (double)state->warm_count;
+}
+
+int room_find(const room_index_t *index, uint16_t room_id)
+{
+    if (index->room_lookup == NULL) return ROOM_NONE;
+    return index->room_lookup[room_id];
+}
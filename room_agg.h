@@ -0,0 +1,78 @@
+/**
+ * \author Yongkai Zhang
+ */
+
+#ifndef _ROOM_AGG_H_
+#define _ROOM_AGG_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "config.h"
+#include "sensor_table.h"
+
+#define ROOM_NONE -1
+
+/**
+ * Incremental aggregate of one room over the running averages of its sensors.
+ * Only sensors with a full window contribute.
+ */
+typedef struct {
+    uint16_t room_id;
+    uint32_t first_member;      /**< offset of the room's sensors in room_index_t.members */
+    uint32_t member_count;
+    uint32_t warm_count;        /**< sensors currently contributing */
+    double avg_sum;             /**< sum of contributing sensor averages */
+    int hottest;                /**< sensor slot with the highest average, -1 if none */
+    int coldest;                /**< sensor slot with the lowest average, -1 if none */
+    int8_t state;               /**< -1 COLD, 0 NORMAL, 1 HOT (room mean vs thresholds) */
+    uint32_t updates;           /**< updates since avg_sum was last recomputed */
+} room_state_t;
+
+/**
+ * Room -> sensors index built from the sensor table (map order)
+ */
+typedef struct {
+    size_t count;
+    room_state_t *rooms;
+    uint32_t *members;          /**< sensor slots grouped by room */
+    int *room_of_slot;          /**< sensor slot -> room index */
+    double *contribution;       /**< sensor slot -> average the room currently holds */
+    bool *contributing;         /**< sensor slot -> counted in its room */
+    int *room_lookup;           /**< room_id -> room index, -1 when unknown */
+} room_index_t;
+
+/**
+ * Builds the room index for every sensor registered in 'table'
+ * \return zero on success, -1 on allocation failure
+ */
+int room_index_build(room_index_t *index, const sensor_table_t *table);
+
+/**
+ * Frees all memory owned by the index
+ */
+void room_index_free(room_index_t *index);
+
+/**
+ * Applies a new running average of sensor 'slot' to its room.
+ * Mean and member count are O(1); hottest/coldest are O(1) unless the current
+ * extreme sensor moves inward, which triggers a rescan of that room only.
+ * \param warm whether the sensor window is full (only warm sensors contribute)
+ * \param min_temp room COLD threshold
+ * \param max_temp room HOT threshold
+ * \param hysteresis a room alert clears only once the mean is back inside the band by this much
+ * \return the room index when the room state changed, ROOM_NONE otherwise
+ */
+int room_update(room_index_t *index, int slot, double average, bool warm, double min_temp, double max_temp,
+                double hysteresis);
+
+/**
+ * \return the mean of the contributing sensor averages of room 'room', 0 when none
+ */
+double room_mean(const room_index_t *index, int room);
+
+/**
+ * \return the index of 'room_id', ROOM_NONE when the room is not in the map
+ */
+int room_find(const room_index_t *index, uint16_t room_id);
+
+#endif /* _ROOM_AGG_H_ */
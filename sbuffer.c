@@ -13,29 +13,108 @@
 #error Unsupported SBUFFER_FULL_POLICY
 #endif
 
-static void pop_head_unsafe(sbuffer_t *buffer, sensor_data_t *data)
+static void lane_append(sbuffer_lane_t *lane, sbuffer_node_t *node)
+{
+    node->next = NULL;
+    node->prev = lane->tail;
+    if (lane->tail == NULL) {
+        lane->head = node;
+    } else {
+        lane->tail->next = node;
+    }
+    lane->tail = node;
+    lane->size++;
+}
+
+static void lane_unlink(sbuffer_lane_t *lane, sbuffer_node_t *node)
+{
+    if (node->prev == NULL) {
+        lane->head = node->next;
+    } else {
+        node->prev->next = node->next;
+    }
+    if (node->next == NULL) {
+        lane->tail = node->prev;
+    } else {
+        node->next->prev = node->prev;
+    }
+    node->next = NULL;
+    node->prev = NULL;
+    lane->size--;
+}
+
+/*
+ * Moves every pending normal-lane reading of 'sensor_id' to the tail of the
+ * express lane. Called before an express reading of that sensor is queued so
+ * the sensor's readings are still handed out in arrival order. Each node is
+ * moved at most once, so the cost is amortized O(1) per insert.
+ */
+static void promote_sensor_chain(sbuffer_t *buffer, sensor_id_t sensor_id)
 {
-    sbuffer_node_t *dummy = buffer->head;
+    sbuffer_chain_t *chain = &buffer->chains[sensor_id];
+    sbuffer_node_t *node = chain->head;
+
+    while (node != NULL) {
+        sbuffer_node_t *next = node->sensor_next;
+
+        lane_unlink(&buffer->lanes[SBUFFER_LANE_NORMAL], node);
+        node->sensor_next = NULL;
+        lane_append(&buffer->lanes[SBUFFER_LANE_EXPRESS], node);
+        node = next;
+    }
+    chain->head = NULL;
+    chain->tail = NULL;
+}
+
+static void pop_lane_head_unsafe(sbuffer_t *buffer, int lane_index, sensor_data_t *data)
+{
+    sbuffer_lane_t *lane = &buffer->lanes[lane_index];
+    sbuffer_node_t *dummy = lane->head;
 
     if (dummy == NULL) return;
     if (data != NULL) {
         *data = dummy->data;
     }
 
-    buffer->head = dummy->next;
-    if (buffer->head == NULL) {
-        buffer->tail = NULL;
+    lane_unlink(lane, dummy);
+    if (lane_index == SBUFFER_LANE_NORMAL) {
+        /* The oldest normal node is always the oldest node of its sensor chain. */
+        sbuffer_chain_t *chain = &buffer->chains[dummy->data.sensor_id];
+
+        chain->head = dummy->sensor_next;
+        if (chain->head == NULL) {
+            chain->tail = NULL;
+        }
     }
     free(dummy);
 }
 
+static void pop_head_unsafe(sbuffer_t *buffer, sensor_data_t *data)
+{
+    if (buffer->lanes[SBUFFER_LANE_EXPRESS].head != NULL) {
+        pop_lane_head_unsafe(buffer, SBUFFER_LANE_EXPRESS, data);
+    } else {
+        pop_lane_head_unsafe(buffer, SBUFFER_LANE_NORMAL, data);
+    }
+}
+
 int sbuffer_init(sbuffer_t **buffer)
 {
     *buffer = malloc(sizeof(sbuffer_t));
     if (*buffer == NULL) return SBUFFER_FAILURE;
 
-    (*buffer)->head = NULL;
-    (*buffer)->tail = NULL;
+    /* Zeroed pages are mapped lazily, so untouched sensor ids cost nothing. */
+    (*buffer)->chains = calloc(SBUFFER_SENSOR_SLOTS, sizeof(sbuffer_chain_t));
+    if ((*buffer)->chains == NULL) {
+        free(*buffer);
+        *buffer = NULL;
+        return SBUFFER_FAILURE;
+    }
+    for (int lane = 0; lane < SBUFFER_LANE_COUNT; lane++) {
+        (*buffer)->lanes[lane].head = NULL;
+        (*buffer)->lanes[lane].tail = NULL;
+        (*buffer)->lanes[lane].size = 0;
+    }
     (*buffer)->size = 0;
     (*buffer)->capacity = SBUFFER_CAPACITY;
     (*buffer)->closed = false;
@@ -60,13 +139,17 @@ int sbuffer_free(sbuffer_t **buffer)
     }
 
     sbuffer_close(*buffer);
-    while ((*buffer)->head != NULL) {
-        dummy = (*buffer)->head;
-        (*buffer)->head = (*buffer)->head->next;
-        free(dummy);
+    for (int lane = 0; lane < SBUFFER_LANE_COUNT; lane++) {
+        while ((*buffer)->lanes[lane].head != NULL) {
+            dummy = (*buffer)->lanes[lane].head;
+            (*buffer)->lanes[lane].head = dummy->next;
+            free(dummy);
+        }
+        (*buffer)->lanes[lane].tail = NULL;
+        (*buffer)->lanes[lane].size = 0;
     }
-    (*buffer)->tail = NULL;
     (*buffer)->size = 0;
+    free((*buffer)->chains);
     free(*buffer);
     *buffer = NULL;
     return SBUFFER_SUCCESS;
@@ -107,7 +190,12 @@ int sbuffer_insert(sbuffer_t *buffer, sensor_data_t *data)
     }
 #elif SBUFFER_FULL_POLICY == SBUFFER_FULL_DROP_OLDEST
     if (buffer->size >= buffer->capacity) {
-        pop_head_unsafe(buffer, NULL);
+        /* Shed routine readings before anything in the express lane. */
+        if (buffer->lanes[SBUFFER_LANE_NORMAL].head != NULL) {
+            pop_lane_head_unsafe(buffer, SBUFFER_LANE_NORMAL, NULL);
+        } else {
+            pop_lane_head_unsafe(buffer, SBUFFER_LANE_EXPRESS, NULL);
+        }
         buffer->size--;
         buffer->dropped_count++;
         result = SBUFFER_DROPPED;
@@ -119,13 +207,22 @@ int sbuffer_insert(sbuffer_t *buffer, sensor_data_t *data)
         return SBUFFER_FAILURE;
     }
     dummy->data = *data;
-    dummy->next = NULL;
+    dummy->sensor_next = NULL;
 
-    if (buffer->tail == NULL) {
-        buffer->head = buffer->tail = dummy;
+    if (data->lane == SBUFFER_LANE_EXPRESS) {
+        promote_sensor_chain(buffer, data->sensor_id);
+        lane_append(&buffer->lanes[SBUFFER_LANE_EXPRESS], dummy);
     } else {
-        buffer->tail->next = dummy;
-        buffer->tail = dummy;
+        sbuffer_chain_t *chain = &buffer->chains[data->sensor_id];
+
+        dummy->data.lane = SBUFFER_LANE_NORMAL;
+        lane_append(&buffer->lanes[SBUFFER_LANE_NORMAL], dummy);
+        if (chain->tail == NULL) {
+            chain->head = dummy;
+        } else {
+            chain->tail->sensor_next = dummy;
+        }
+        chain->tail = dummy;
     }
 
     buffer->size++;
@@ -152,9 +249,12 @@ void *sbuffer_getdataIndex(sbuffer_t *buffer, int index)
 
     if (buffer == NULL || index < 0) return NULL;
 
-    for (dummy = buffer->head; dummy != NULL; dummy = dummy->next, count++) {
-        if (count == index) {
-            return &dummy->data;
+    /* Index follows drain order: express lane first, then normal lane. */
+    for (int lane = 0; lane < SBUFFER_LANE_COUNT; lane++) {
+        for (dummy = buffer->lanes[lane].head; dummy != NULL; dummy = dummy->next, count++) {
+            if (count == index) {
+                return &dummy->data;
+            }
         }
     }
     return NULL;
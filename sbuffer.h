@@ -37,7 +37,9 @@ int sbuffer_free(sbuffer_t **buffer);
 int sbuffer_close(sbuffer_t *buffer);
 
 /**
- * Removes the first sensor data in 'buffer' (at the 'head') and returns this sensor data as '*data'
+ * Removes the next sensor data in 'buffer' and returns this sensor data as '*data'
+ * The express lane is drained before the normal lane; readings of one sensor always
+ * come out in the order they were inserted.
  * If queue is empty and still open, SBUFFER_NO_DATA is returned.
  * If queue is closed and empty, SBUFFER_CLOSED is returned.
  * \param buffer a pointer to the buffer that is used
@@ -47,7 +49,9 @@ int sbuffer_close(sbuffer_t *buffer);
 int sbuffer_remove(sbuffer_t *buffer, sensor_data_t *data);
 
 /**
- * Inserts the sensor data in 'data' at the end of 'buffer' (at the 'tail')
+ * Inserts the sensor data in 'data' at the tail of the lane given by 'data->lane'
+ * An express reading first pulls the pending normal-lane readings of the same sensor
+ * into the express lane so per-sensor order is preserved.
  * \param buffer a pointer to the buffer that is used
  * \param data a pointer to sensor_data_t data, that will be copied into the buffer
  * \return SBUFFER_SUCCESS on success and SBUFFER_FAILURE if an error occured
@@ -60,6 +64,7 @@ int sbuffer_insert(sbuffer_t *buffer, sensor_data_t *data);
  * \return number of dropped items
  */
 unsigned long long sbuffer_get_drop_count(sbuffer_t *buffer);
+
 /**
  * Get the length of the buffer
  * \param buffer a pointer to the buffer that is used
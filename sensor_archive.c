@@ -0,0 +1,237 @@
+/**
+ * \author Yongkai Zhang
+ *
+ * Packs Sensor.db readings into a compressed archive (see tsarchive.h) and scans
+ * an archive for a time range, optionally timing the same range on Sensor.db.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "sensor_db.h"
+#include "tsarchive.h"
+
+#define ARCHIVE_FETCH_ROWS 1024
+
+typedef struct {
+    const char *path;
+    bool pack;
+    bool print;
+    bool compare;
+    int sensor_id;              /**< -1 = every sensor */
+    long long from;
+    long long to;
+} archive_options_t;
+
+static void print_usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [--archive=FILE] [--pack] [--sensor=ID] [--from=TS] [--to=TS] [--print] [--compare]\n",
+            program);
+    fprintf(stderr, "  --pack     append the readings of %s in [from, to] to the archive (default %s)\n"
+            "  otherwise  scan the archive for [from, to]; --print lists the points,\n"
+            "             --compare times the same range on %s\n", TO_STRING(DB_NAME), DB_ARCHIVE_FILE,
+            TO_STRING(DB_NAME));
+}
+
+static int parse_number(const char *text, long long min_value, long long max_value, long long *value)
+{
+    char *endptr = NULL;
+
+    errno = 0;
+    *value = strtoll(text, &endptr, 10);
+    if (errno != 0 || endptr == text || *endptr != '\0' || *value < min_value || *value > max_value) return -1;
+    return 0;
+}
+
+static int parse_args(int argc, char *argv[], archive_options_t *options)
+{
+    long long value;
+
+    options->path = DB_ARCHIVE_FILE;
+    options->pack = false;
+    options->print = false;
+    options->compare = false;
+    options->sensor_id = -1;
+    options->from = LLONG_MIN;
+    options->to = LLONG_MAX;
+
+    for (int index = 1; index < argc; index++) {
+        const char *arg = argv[index];
+
+        if (strncmp(arg, "--archive=", 10) == 0 && arg[10] != '\0') {
+            options->path = arg + 10;
+        } else if (strcmp(arg, "--pack") == 0) {
+            options->pack = true;
+        } else if (strcmp(arg, "--print") == 0) {
+            options->print = true;
+        } else if (strcmp(arg, "--compare") == 0) {
+            options->compare = true;
+        } else if (strncmp(arg, "--sensor=", 9) == 0) {
+            if (parse_number(arg + 9, 0, UINT16_MAX, &value) != 0) return -1;
+            options->sensor_id = (int)value;
+        } else if (strncmp(arg, "--from=", 7) == 0) {
+            if (parse_number(arg + 7, LLONG_MIN, LLONG_MAX, &options->from) != 0) return -1;
+        } else if (strncmp(arg, "--to=", 5) == 0) {
+            if (parse_number(arg + 5, LLONG_MIN, LLONG_MAX, &options->to) != 0) return -1;
+        } else {
+            return -1;
+        }
+    }
+    return options->from <= options->to ? 0 : -1;
+}
+
+static double elapsed_ms(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) * 1000.0 + (double)(now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static double per_second(unsigned long long count, double ms)
+{
+    return ms > 0 ? (double)count * 1000.0 / ms : 0.0;
+}
+
+static long long file_size(const char *path)
+{
+    struct stat info;
+
+    return stat(path, &info) == 0 ? (long long)info.st_size : 0;
+}
+
+/* Opens a cursor over [from, to] of one sensor, or of every sensor. */
+static int open_range(DBCONN *conn, sensor_db_cursor_t *cursor, const archive_options_t *options)
+{
+    if (options->sensor_id < 0) {
+        return sensor_db_cursor_open(conn, cursor, SENSOR_DB_QUERY_TS_RANGE, 0, 0, options->from, options->to);
+    }
+    return sensor_db_cursor_open(conn, cursor, SENSOR_DB_QUERY_SENSOR_RANGE, (uint16_t)options->sensor_id, 0,
+                                 options->from, options->to);
+}
+
+static int pack(const archive_options_t *options)
+{
+    sensor_data_t rows[ARCHIVE_FETCH_ROWS];
+    sensor_db_cursor_t cursor;
+    tsarchive_writer_t writer;
+    struct timespec start;
+    ssize_t count = 0;
+    int rc = 0;
+    DBCONN *conn;
+
+    conn = init_connection("0");
+    if (conn == NULL) return -1;
+    if (tsarchive_writer_open(&writer, options->path, 0) != 0) {
+        disconnect(conn);
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (open_range(conn, &cursor, options) != 0) {
+        rc = -1;
+    } else {
+        while (rc == 0 && (count = sensor_db_cursor_next(&cursor, rows, ARCHIVE_FETCH_ROWS)) > 0) {
+            for (ssize_t index = 0; index < count && rc == 0; index++) {
+                rc = tsarchive_writer_append(&writer, &rows[index]);
+            }
+        }
+        sensor_db_cursor_close(&cursor);
+        if (count < 0) rc = -1;
+    }
+    if (rc == 0) rc = tsarchive_writer_commit(&writer);
+    printf("ARCHIVE_PACK file=%s points=%llu blocks=%llu bytes=%llu bytes_per_point=%.2f db_bytes=%lld "
+           "seconds=%.2f status=%s\n",
+           options->path, writer.points, writer.blocks, writer.bytes,
+           writer.points == 0 ? 0.0 : (double)writer.bytes / (double)writer.points, file_size(TO_STRING(DB_NAME)),
+           elapsed_ms(&start) / 1000.0, rc == 0 ? "OK" : "FAILED");
+    tsarchive_writer_close(&writer);
+    disconnect(conn);
+    return rc;
+}
+
+static int scan_archive(const archive_options_t *options)
+{
+    sensor_data_t rows[ARCHIVE_FETCH_ROWS];
+    tsarchive_reader_t reader;
+    tsarchive_scan_t scan;
+    struct timespec start;
+    unsigned long long points = 0;
+    unsigned long long total = 0;
+    double scan_ms;
+    ssize_t count;
+
+    if (tsarchive_reader_open(&reader, options->path) != 0) return -1;
+    for (size_t index = 0; index < reader.block_count; index++) {
+        total += reader.blocks[index].count;
+    }
+    printf("ARCHIVE_STATS file=%s blocks=%zu points=%llu bytes=%llu bytes_per_point=%.2f\n", options->path,
+           reader.block_count, total, (unsigned long long)reader.header.data_bytes,
+           total == 0 ? 0.0 : (double)reader.header.data_bytes / (double)total);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    tsarchive_scan_open(&scan, &reader, options->sensor_id, options->from, options->to);
+    while ((count = tsarchive_scan_next(&scan, rows, ARCHIVE_FETCH_ROWS)) > 0) {
+        points += (unsigned long long)count;
+        if (!options->print) continue;
+        for (ssize_t index = 0; index < count; index++) {
+            printf("%u %u %g %lld\n", rows[index].sensor_id, rows[index].room_id, rows[index].value,
+                   (long long)rows[index].timestamp);
+        }
+    }
+    scan_ms = elapsed_ms(&start);
+    printf("ARCHIVE_SCAN points=%llu blocks_read=%llu ms=%.2f points_per_s=%.0f status=%s\n", points,
+           scan.blocks_read, scan_ms, per_second(points, scan_ms), count < 0 ? "FAILED" : "OK");
+    tsarchive_reader_close(&reader);
+    return count < 0 ? -1 : 0;
+}
+
+static int scan_database(const archive_options_t *options)
+{
+    sensor_data_t rows[ARCHIVE_FETCH_ROWS];
+    sensor_db_cursor_t cursor;
+    struct timespec start;
+    unsigned long long points = 0;
+    ssize_t count = -1;
+    double scan_ms;
+    DBCONN *conn;
+
+    conn = init_connection("0");
+    if (conn == NULL) return -1;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (open_range(conn, &cursor, options) == 0) {
+        while ((count = sensor_db_cursor_next(&cursor, rows, ARCHIVE_FETCH_ROWS)) > 0) {
+            points += (unsigned long long)count;
+        }
+        sensor_db_cursor_close(&cursor);
+    }
+    scan_ms = elapsed_ms(&start);
+    disconnect(conn);
+    printf("DB_SCAN points=%llu ms=%.2f points_per_s=%.0f db_bytes=%lld status=%s\n", points, scan_ms,
+           per_second(points, scan_ms), file_size(TO_STRING(DB_NAME)), count < 0 ? "FAILED" : "OK");
+    return count < 0 ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    archive_options_t options;
+    int rc;
+
+    if (parse_args(argc, argv, &options) != 0) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (options.pack) {
+        rc = pack(&options);
+    } else {
+        rc = scan_archive(&options);
+        if (rc == 0 && options.compare) rc = scan_database(&options);
+    }
+    return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,10 +1,37 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <assert.h>
+#include <fcntl.h>
+#include <math.h>
 #include <sqlite3.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "config.h"
 #include "sensor_db.h"
 
+#define SENSOR_DB_CURSOR_BATCH 256  // rows fetched per step of the find_* callbacks
+#define SENSOR_DB_IMPORT_ROWS_PER_INSERT 64     // rows bound to one multi-row INSERT (6 parameters each)
+#define SENSOR_DB_IMPORT_CHUNK 16384            // records decoded per step of a bulk import
+#define SENSOR_DB_IMPORT_TXN_ROWS 262144        // rows per bulk import transaction
+#define PARTITION_NAME_MAX 96                   // TABLE_NAME_<start> plus an index suffix
+
+/*
+ * Who numbered a row's seq, kept in the high half of its 'source' column; the low
+ * half is the run within that kind, so two writers never share a (source, seq) key.
+ */
+#define SOURCE_SENDER 0         // live reading, low half = the sender's epoch
+#define SOURCE_CONNECTION 1     // insert_sensor(), low half = random id of the connection
+#define SOURCE_IMPORT 2         // imported record, low half = hash of the record
+#define SOURCE_LEGACY 3         // row migrated from schema version 3 or older
+
+/* Statement kinds of the cache beyond the sensor_db_query_t values */
+#define STMT_INSERT SENSOR_DB_QUERY_COUNT           // single-row INSERT
+#define STMT_IMPORT (SENSOR_DB_QUERY_COUNT + 1)     // SENSOR_DB_IMPORT_ROWS_PER_INSERT-row INSERT
+
 #define MALLOC_NO_ERROR 0
 #define MALLOC_MEMORY_ERROR 1
 #define MALLOC_INVALID_ERROR 2
@@ -29,7 +56,7 @@
         assert(!(condition));                     \
     } while (0)
 
-static int exec_sql(DBCONN *conn, char *sql, callback_t callback)
+static int exec_sql(sqlite3 *conn, const char *sql, callback_t callback)
 {
     char *error_message = NULL;
     int rc = sqlite3_exec(conn, sql, callback, NULL, &error_message);
@@ -44,81 +71,994 @@ static int exec_sql(DBCONN *conn, char *sql, callback_t callback)
     return 0;
 }
 
+static const sensor_db_profile_t profiles[] = {
+    /* SQLite as compiled: rollback journal, synchronous=FULL, 2 MB cache. */
+    { "sqlite", NULL, NULL, -1, -1, -1, NULL, -1 },
+    /* Cheap syncs and random reads: WAL with one sync per checkpoint, reads through mmap. */
+    { "ssd", "WAL", "NORMAL", 256LL << 20, 16384, 4096, "MEMORY", 1000 },
+    /* Seeks are expensive: larger pages and cache, and fewer, longer checkpoints. */
+    { "hdd", "WAL", "NORMAL", 64LL << 20, 65536, 16384, "MEMORY", 8000 },
+    /* WAL for concurrent readers, but every commit is synced. */
+    { "durable", "WAL", "FULL", 0, 8192, 4096, "DEFAULT", 1000 },
+};
+
+static const sensor_db_profile_t *active_profile = NULL;
+
+const sensor_db_profile_t *sensor_db_profiles(size_t *count)
+{
+    if (count != NULL) *count = sizeof(profiles) / sizeof(profiles[0]);
+    return profiles;
+}
+
+const sensor_db_profile_t *sensor_db_find_profile(const char *name)
+{
+    if (name == NULL) return NULL;
+    for (size_t index = 0; index < sizeof(profiles) / sizeof(profiles[0]); index++) {
+        if (strcmp(profiles[index].name, name) == 0) return &profiles[index];
+    }
+    return NULL;
+}
+
+int sensor_db_set_profile(const char *name)
+{
+    const sensor_db_profile_t *profile = sensor_db_find_profile(name);
+
+    if (profile == NULL) return -1;
+    active_profile = profile;
+    return 0;
+}
+
+const sensor_db_profile_t *sensor_db_get_profile(void)
+{
+    if (active_profile == NULL) active_profile = sensor_db_find_profile(DB_PROFILE);
+    return active_profile != NULL ? active_profile : &profiles[0];
+}
+
+static void apply_pragma(sqlite3 *db, char *sql)
+{
+    /* Tuning is best effort: a setting that cannot be applied leaves SQLite's default. */
+    if (sql != NULL) (void)exec_sql(db, sql, NULL);
+    sqlite3_free(sql);
+}
+
+/* page_size goes first: WAL mode fixes the page size of a new database. */
+static void apply_profile(sqlite3 *db, const sensor_db_profile_t *profile)
+{
+    if (profile->page_size > 0) {
+        apply_pragma(db, sqlite3_mprintf("PRAGMA page_size=%d;", profile->page_size));
+    }
+    if (profile->journal_mode != NULL) {
+        apply_pragma(db, sqlite3_mprintf("PRAGMA journal_mode=%s;", profile->journal_mode));
+    }
+    if (profile->synchronous != NULL) {
+        apply_pragma(db, sqlite3_mprintf("PRAGMA synchronous=%s;", profile->synchronous));
+    }
+    if (profile->mmap_size >= 0) {
+        apply_pragma(db, sqlite3_mprintf("PRAGMA mmap_size=%lld;", profile->mmap_size));
+    }
+    if (profile->cache_size_kib >= 0) {
+        apply_pragma(db, sqlite3_mprintf("PRAGMA cache_size=-%d;", profile->cache_size_kib));
+    }
+    if (profile->temp_store != NULL) {
+        apply_pragma(db, sqlite3_mprintf("PRAGMA temp_store=%s;", profile->temp_store));
+    }
+    if (profile->wal_autocheckpoint >= 0) {
+        apply_pragma(db, sqlite3_mprintf("PRAGMA wal_autocheckpoint=%d;", profile->wal_autocheckpoint));
+    }
+}
+
+static int exec_format(sqlite3 *db, char *sql)
+{
+    int rc = sql == NULL ? -1 : exec_sql(db, sql, NULL);
+
+    sqlite3_free(sql);
+    return rc;
+}
+
+static int read_user_version(sqlite3 *db)
+{
+    sqlite3_stmt *stmt = NULL;
+    int version = -1;
+
+    if (sqlite3_prepare_v2(db, "PRAGMA user_version;", -1, &stmt, NULL) != SQLITE_OK) return -1;
+    if (sqlite3_step(stmt) == SQLITE_ROW) version = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+    return version;
+}
+
+static int table_exists(sqlite3 *db, const char *name)
+{
+    sqlite3_stmt *stmt = NULL;
+    int exists;
+
+    if (sqlite3_prepare_v2(db, "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = ?;", -1, &stmt,
+                           NULL) != SQLITE_OK) {
+        return -1;
+    }
+    sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+    exists = sqlite3_step(stmt) == SQLITE_ROW;
+    sqlite3_finalize(stmt);
+    return exists;
+}
+
+static sensor_ts_t partition_seconds = DB_PARTITION_SECONDS;
+
+int sensor_db_set_partition_seconds(sensor_ts_t seconds)
+{
+    if (seconds < 60) return -1;
+    partition_seconds = seconds;
+    return 0;
+}
+
+/* Start of the aligned partition holding 'ts' (rounded down, also for negative timestamps). */
+static sensor_ts_t partition_floor(sensor_ts_t ts)
+{
+    sensor_ts_t offset = ts % partition_seconds;
+
+    return ts - (offset < 0 ? offset + partition_seconds : offset);
+}
+
+static void partition_name(char *name, size_t size, sensor_ts_t start)
+{
+    snprintf(name, size, "%s_%lld", TO_STRING(TABLE_NAME), (long long)start);
+}
+
+/* Creates the table of partition [start, end) unless it exists, and lists it in the catalog. */
+static int create_partition(sqlite3 *db, sensor_ts_t start, sensor_ts_t end)
+{
+    char table[PARTITION_NAME_MAX];
+
+    partition_name(table, sizeof(table), start);
+    /* Index entries also carry the key columns, so both indexes cover every column. */
+    return exec_format(db, sqlite3_mprintf(
+        "CREATE TABLE IF NOT EXISTS \"%w\" ("
+        "sensor_id INTEGER NOT NULL,"
+        "timestamp INTEGER NOT NULL,"
+        "source INTEGER NOT NULL,"
+        "seq INTEGER NOT NULL,"
+        "room_id INTEGER NOT NULL,"
+        "sensor_value REAL NOT NULL,"
+        "PRIMARY KEY (sensor_id, timestamp, source, seq)) WITHOUT ROWID;"
+        "CREATE INDEX IF NOT EXISTS \"%w_by_time\" ON \"%w\" (timestamp, room_id, sensor_value);"
+        "CREATE INDEX IF NOT EXISTS \"%w_by_room\" ON \"%w\" (room_id, timestamp, sensor_value);"
+        "INSERT OR IGNORE INTO %s (start_ts, end_ts) VALUES (%lld, %lld);",
+        table, table, table, table, table, TO_STRING(PARTITION_TABLE_NAME), (long long)start, (long long)end));
+}
+
+/*
+ * Runs a catalog query with ?1 = 'key' and reads the first one or two columns of its
+ * first row. Returns 1 for a row, 0 for none, -1 on error.
+ */
+static int read_bounds(sqlite3 *db, char *sql, sqlite3_int64 key, sensor_ts_t *first, sensor_ts_t *second)
+{
+    sqlite3_stmt *stmt = NULL;
+    int found = -1;
+    int rc;
+
+    if (sql == NULL) return -1;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+        sqlite3_free(sql);
+        return -1;
+    }
+    sqlite3_free(sql);
+    sqlite3_bind_int64(stmt, 1, key);
+    rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW) {
+        *first = (sensor_ts_t)sqlite3_column_int64(stmt, 0);
+        if (second != NULL) *second = (sensor_ts_t)sqlite3_column_int64(stmt, 1);
+        found = 1;
+    } else if (rc == SQLITE_DONE) {
+        found = 0;
+    } else {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+    }
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+/*
+ * Finds the partition holding 'ts', creating it when there is none. A new partition
+ * is aligned to partition_seconds and clipped so it never overlaps its neighbours,
+ * which keeps the partitions disjoint when the length changes between runs.
+ */
+static int route_partition(sqlite3 *db, sensor_ts_t ts, sensor_ts_t *start, sensor_ts_t *end)
+{
+    sensor_ts_t prev_start;
+    sensor_ts_t prev_end;
+    sensor_ts_t next_start;
+    int found;
+
+    found = read_bounds(db, sqlite3_mprintf("SELECT start_ts, end_ts FROM %s WHERE start_ts <= ?1 "
+                                            "ORDER BY start_ts DESC LIMIT 1;", TO_STRING(PARTITION_TABLE_NAME)),
+                        ts, &prev_start, &prev_end);
+    if (found < 0) return -1;
+    if (found && ts < prev_end) {
+        *start = prev_start;
+        *end = prev_end;
+        return 0;
+    }
+    *start = partition_floor(ts);
+    *end = *start + partition_seconds;
+    if (found && *start < prev_end) *start = prev_end;
+    found = read_bounds(db, sqlite3_mprintf("SELECT start_ts FROM %s WHERE start_ts > ?1 ORDER BY start_ts LIMIT 1;",
+                                            TO_STRING(PARTITION_TABLE_NAME)), ts, &next_start, NULL);
+    if (found < 0) return -1;
+    if (found && next_start < *end) *end = next_start;
+    return create_partition(db, *start, *end);
+}
+
+/*
+ * Version 1: readings clustered on (sensor_id, timestamp, seq) with the room stored,
+ * plus covering indexes for time-range and room-range queries.
+ * Version 0 tables (autoincrement id, no room) are copied over with room_id 0 and
+ * their id as seq, which keeps every old row distinct.
+ */
+static int upgrade_to_v1(sqlite3 *db)
+{
+    int exists = table_exists(db, TO_STRING(TABLE_NAME));
+
+    if (exists < 0) return -1;
+    if (exists && exec_format(db, sqlite3_mprintf("ALTER TABLE %s RENAME TO %s_v0;", TO_STRING(TABLE_NAME),
+                                                  TO_STRING(TABLE_NAME))) != 0) {
+        return -1;
+    }
+    if (exec_format(db, sqlite3_mprintf(
+            "CREATE TABLE %s ("
+            "sensor_id INTEGER NOT NULL,"
+            "timestamp INTEGER NOT NULL,"
+            "seq INTEGER NOT NULL,"
+            "room_id INTEGER NOT NULL,"
+            "sensor_value REAL NOT NULL,"
+            "PRIMARY KEY (sensor_id, timestamp, seq)) WITHOUT ROWID;",
+            TO_STRING(TABLE_NAME))) != 0) {
+        return -1;
+    }
+    if (exists) {
+        /* Copy in key order so the clustered B-tree is appended to, then index once. */
+        if (exec_format(db, sqlite3_mprintf(
+                "INSERT OR IGNORE INTO %s (sensor_id, timestamp, seq, room_id, sensor_value) "
+                "SELECT sensor_id, timestamp, id, 0, sensor_value FROM %s_v0 ORDER BY sensor_id, timestamp, id;"
+                "DROP TABLE %s_v0;",
+                TO_STRING(TABLE_NAME), TO_STRING(TABLE_NAME), TO_STRING(TABLE_NAME))) != 0) {
+            return -1;
+        }
+    }
+    /* Index entries also carry the key columns, so both indexes cover every column. */
+    return exec_format(db, sqlite3_mprintf(
+        "CREATE INDEX %s_by_time ON %s (timestamp, room_id, sensor_value);"
+        "CREATE INDEX %s_by_room ON %s (room_id, timestamp, sensor_value);",
+        TO_STRING(TABLE_NAME), TO_STRING(TABLE_NAME), TO_STRING(TABLE_NAME), TO_STRING(TABLE_NAME)));
+}
+
+/*
+ * Version 2: readings move from TABLE_NAME into one table per time partition, listed
+ * in PARTITION_TABLE_NAME, so retention can drop whole tables.
+ */
+static int upgrade_to_v2(sqlite3 *db)
+{
+    sqlite3_stmt *stmt = NULL;
+    char *sql;
+    int exists = table_exists(db, TO_STRING(TABLE_NAME));
+    int rc = 0;
+
+    if (exists <= 0) return exists;
+    sql = sqlite3_mprintf("SELECT DISTINCT timestamp - ((timestamp %% %lld) + %lld) %% %lld FROM %s;",
+                          (long long)partition_seconds, (long long)partition_seconds,
+                          (long long)partition_seconds, TO_STRING(TABLE_NAME));
+    if (sql == NULL) return -1;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+        sqlite3_free(sql);
+        return -1;
+    }
+    sqlite3_free(sql);
+    while (rc == 0 && sqlite3_step(stmt) == SQLITE_ROW) {
+        sensor_ts_t start = (sensor_ts_t)sqlite3_column_int64(stmt, 0);
+        char table[PARTITION_NAME_MAX];
+
+        partition_name(table, sizeof(table), start);
+        rc = create_partition(db, start, start + partition_seconds);
+        /* Copy in key order so the clustered B-tree is appended to. */
+        if (rc == 0) {
+            rc = exec_format(db, sqlite3_mprintf(
+                "INSERT OR IGNORE INTO \"%w\" (sensor_id, timestamp, source, seq, room_id, sensor_value) "
+                "SELECT sensor_id, timestamp, %lld, seq, room_id, sensor_value FROM %s "
+                "WHERE timestamp >= %lld AND timestamp < %lld ORDER BY sensor_id, timestamp, seq;",
+                table, (long long)SOURCE_LEGACY << 32, TO_STRING(TABLE_NAME), (long long)start,
+                (long long)(start + partition_seconds)));
+        }
+    }
+    if (sqlite3_finalize(stmt) != SQLITE_OK && rc == 0) {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+        rc = -1;
+    }
+    if (rc != 0) return -1;
+    return exec_format(db, sqlite3_mprintf("DROP TABLE %s;", TO_STRING(TABLE_NAME)));
+}
+
+/* Version 3: partitions carry the mark of sensor_db_set_partition_mark(), NULL until one is set. */
+static int upgrade_to_v3(sqlite3 *db)
+{
+    return exec_format(db, sqlite3_mprintf("ALTER TABLE %s ADD COLUMN archive_mark INTEGER;",
+                                           TO_STRING(PARTITION_TABLE_NAME)));
+}
+
+/*
+ * Version 4: the key gains 'source', so readings numbered by different writers never
+ * collide. Every partition is rebuilt; its old rows come from an unknown writer and
+ * get SOURCE_LEGACY.
+ */
+static int upgrade_to_v4(sqlite3 *db)
+{
+    sensor_ts_t start = INT64_MIN;
+    sensor_ts_t end;
+    int found;
+
+    while ((found = read_bounds(db, sqlite3_mprintf("SELECT start_ts, end_ts FROM %s WHERE start_ts > ?1 "
+                                                    "ORDER BY start_ts LIMIT 1;", TO_STRING(PARTITION_TABLE_NAME)),
+                                start, &start, &end)) > 0) {
+        char table[PARTITION_NAME_MAX];
+        int exists;
+
+        partition_name(table, sizeof(table), start);
+        exists = table_exists(db, table);
+        if (exists < 0) return -1;
+        if (exists && exec_format(db, sqlite3_mprintf("DROP INDEX \"%w_by_time\"; DROP INDEX \"%w_by_room\";"
+                                                      "ALTER TABLE \"%w\" RENAME TO \"%w_v3\";",
+                                                      table, table, table, table)) != 0) {
+            return -1;
+        }
+        if (create_partition(db, start, end) != 0) return -1;
+        /* Copy in key order so the clustered B-tree is appended to. */
+        if (exists && exec_format(db, sqlite3_mprintf(
+                "INSERT INTO \"%w\" (sensor_id, timestamp, source, seq, room_id, sensor_value) "
+                "SELECT sensor_id, timestamp, %lld, seq, room_id, sensor_value FROM \"%w_v3\" "
+                "ORDER BY sensor_id, timestamp, seq;"
+                "DROP TABLE \"%w_v3\";",
+                table, (long long)SOURCE_LEGACY << 32, table, table)) != 0) {
+            return -1;
+        }
+    }
+    return found;
+}
+
+/* Brings the schema to SENSOR_DB_SCHEMA_VERSION; concurrent openers serialise on BEGIN IMMEDIATE. */
+static int migrate_schema(sqlite3 *db)
+{
+    int version;
+
+    if (exec_sql(db, "BEGIN IMMEDIATE;", NULL) != 0) return -1;
+    version = read_user_version(db);
+    if (version > SENSOR_DB_SCHEMA_VERSION) {
+        fprintf(stderr, "Database schema version %d is newer than this build (%d)\n", version,
+                SENSOR_DB_SCHEMA_VERSION);
+        version = -1;
+    }
+    if (version >= 0 && exec_format(db, sqlite3_mprintf(
+            "CREATE TABLE IF NOT EXISTS %s (start_ts INTEGER PRIMARY KEY, end_ts INTEGER NOT NULL);",
+            TO_STRING(PARTITION_TABLE_NAME))) != 0) {
+        version = -1;
+    }
+    if (version == 0 && upgrade_to_v1(db) != 0) version = -1;
+    if (version >= 0 && version < 2 && upgrade_to_v2(db) != 0) version = -1;
+    if (version >= 0 && version < 3 && upgrade_to_v3(db) != 0) version = -1;
+    /* Partitions written by upgrade_to_v2() above already have the version 4 layout. */
+    if (version >= 2 && version < 4 && upgrade_to_v4(db) != 0) version = -1;
+    if (version >= 0 && exec_format(db, sqlite3_mprintf(
+            "CREATE TABLE IF NOT EXISTS %s ("
+            "sensor_id INTEGER NOT NULL,"
+            "room_id INTEGER NOT NULL,"
+            "resolution INTEGER NOT NULL,"
+            "window_start INTEGER NOT NULL,"
+            "count INTEGER NOT NULL,"
+            "sum REAL NOT NULL,"
+            "min REAL NOT NULL,"
+            "max REAL NOT NULL,"
+            "PRIMARY KEY (sensor_id, resolution, window_start)) WITHOUT ROWID;"
+            "PRAGMA user_version = %d;",
+            TO_STRING(ROLLUP_TABLE_NAME), SENSOR_DB_SCHEMA_VERSION)) != 0) {
+        version = -1;
+    }
+    if (version < 0) {
+        (void)exec_sql(db, "ROLLBACK;", NULL);
+        return -1;
+    }
+    return exec_sql(db, "COMMIT;", NULL);
+}
+
+static const char *const query_filters[SENSOR_DB_QUERY_COUNT] = {
+    [SENSOR_DB_QUERY_ALL] = "",
+    [SENSOR_DB_QUERY_VALUE_EQ] = " WHERE sensor_value = ?1",
+    [SENSOR_DB_QUERY_VALUE_GT] = " WHERE sensor_value > ?1",
+    [SENSOR_DB_QUERY_TS_EQ] = " WHERE timestamp = ?2",
+    [SENSOR_DB_QUERY_TS_GT] = " WHERE timestamp > ?2 ORDER BY timestamp",
+    [SENSOR_DB_QUERY_SENSOR_RANGE] = " WHERE sensor_id = ?3 AND timestamp BETWEEN ?2 AND ?4 ORDER BY timestamp, seq",
+    [SENSOR_DB_QUERY_ROOM_RANGE] = " WHERE room_id = ?3 AND timestamp BETWEEN ?2 AND ?4 ORDER BY timestamp",
+    [SENSOR_DB_QUERY_TS_RANGE] = " WHERE timestamp BETWEEN ?2 AND ?4 ORDER BY sensor_id, timestamp, seq",
+};
+
+static char *statement_sql(int kind, sensor_ts_t partition)
+{
+    char table[PARTITION_NAME_MAX];
+    char *sql;
+
+    partition_name(table, sizeof(table), partition);
+    if (kind < SENSOR_DB_QUERY_COUNT) {
+        return sqlite3_mprintf("SELECT " SENSOR_DB_COLUMNS " FROM \"%w\"%s;", table, query_filters[kind]);
+    }
+    sql = sqlite3_mprintf("INSERT OR IGNORE INTO \"%w\" (sensor_id, timestamp, source, seq, room_id, sensor_value) "
+                          "VALUES (?, ?, ?, ?, ?, ?)", table);
+    for (int row = 1; kind == STMT_IMPORT && row < SENSOR_DB_IMPORT_ROWS_PER_INSERT && sql != NULL; row++) {
+        char *longer = sqlite3_mprintf("%s, (?, ?, ?, ?, ?, ?)", sql);
+
+        sqlite3_free(sql);
+        sql = longer;
+    }
+    return sql;
+}
+
+/* Prepares a statement of 'kind' on one partition; NULL on error, reported by the caller. */
+static sqlite3_stmt *prepare_statement(DBCONN *conn, int kind, sensor_ts_t partition, unsigned int flags)
+{
+    sqlite3_stmt *stmt = NULL;
+    char *sql = statement_sql(kind, partition);
+
+    if (sql == NULL) return NULL;
+    if (sqlite3_prepare_v3(conn->handle, sql, -1, flags, &stmt, NULL) != SQLITE_OK) stmt = NULL;
+    sqlite3_free(sql);
+    return stmt;
+}
+
+/*
+ * Returns the cache entry of ('kind', 'partition'), preparing the statement in a free
+ * entry or in place of one not held by a cursor (round robin). NULL when the statement
+ * is held by a cursor, every entry is held, or preparing fails.
+ */
+static sensor_db_stmt_t *cached_statement(DBCONN *conn, int kind, sensor_ts_t partition)
+{
+    sensor_db_stmt_t *entry = NULL;
+
+    for (size_t index = 0; index < SENSOR_DB_STMT_CACHE; index++) {
+        sensor_db_stmt_t *candidate = &conn->stmts[index];
+
+        if (candidate->stmt != NULL && candidate->kind == kind && candidate->partition == partition) {
+            return candidate->in_use ? NULL : candidate;
+        }
+        if (entry == NULL && candidate->stmt == NULL) entry = candidate;
+    }
+    for (size_t tries = 0; entry == NULL && tries < SENSOR_DB_STMT_CACHE; tries++) {
+        sensor_db_stmt_t *candidate = &conn->stmts[conn->stmt_victim];
+
+        conn->stmt_victim = (conn->stmt_victim + 1) % SENSOR_DB_STMT_CACHE;
+        if (candidate->in_use) continue;
+        sqlite3_finalize(candidate->stmt);
+        candidate->stmt = NULL;
+        entry = candidate;
+    }
+    if (entry == NULL) return NULL;
+    entry->stmt = prepare_statement(conn, kind, partition, SQLITE_PREPARE_PERSISTENT);
+    if (entry->stmt == NULL) return NULL;
+    entry->kind = kind;
+    entry->partition = partition;
+    entry->in_use = false;
+    return entry;
+}
+
+/* Finalizes the cached statements of one partition, or of every partition, not held by a cursor. */
+static void forget_statements(DBCONN *conn, bool all, sensor_ts_t partition)
+{
+    for (size_t index = 0; index < SENSOR_DB_STMT_CACHE; index++) {
+        sensor_db_stmt_t *entry = &conn->stmts[index];
+
+        if (entry->stmt == NULL || entry->in_use || (!all && entry->partition != partition)) continue;
+        sqlite3_finalize(entry->stmt);
+        entry->stmt = NULL;
+    }
+}
+
+/*
+ * Rolls back the open transaction; its rows count as discarded, and the
+ * partitions it created are gone, so routing starts over.
+ */
+static void rollback(DBCONN *conn)
+{
+    conn->discarded += conn->pending;
+    conn->pending = 0;
+    (void)exec_sql(conn->handle, "ROLLBACK;", NULL);
+    conn->route_end = conn->route_start;
+    forget_statements(conn, true, 0);
+}
+
+/* Cached INSERT of 'kind' into the partition holding 'ts', creating the partition on first use. */
+static sqlite3_stmt *insert_statement(DBCONN *conn, int kind, sensor_ts_t ts)
+{
+    sensor_db_stmt_t *entry;
+
+    if (ts < conn->route_start || ts >= conn->route_end) {
+        if (route_partition(conn->handle, ts, &conn->route_start, &conn->route_end) != 0) {
+            conn->route_end = conn->route_start;
+            return NULL;
+        }
+    }
+    entry = cached_statement(conn, kind, conn->route_start);
+    if (entry == NULL) {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(conn->handle));
+        return NULL;
+    }
+    return entry->stmt;
+}
+
+static int drop_partition(DBCONN *conn, sensor_ts_t start)
+{
+    char table[PARTITION_NAME_MAX];
+
+    forget_statements(conn, false, start);
+    if (conn->route_start == start) conn->route_end = conn->route_start;
+    partition_name(table, sizeof(table), start);
+    if (exec_format(conn->handle, sqlite3_mprintf("BEGIN IMMEDIATE; DROP TABLE IF EXISTS \"%w\";"
+                                                  "DELETE FROM %s WHERE start_ts = %lld; COMMIT;",
+                                                  table, TO_STRING(PARTITION_TABLE_NAME), (long long)start)) != 0) {
+        (void)exec_sql(conn->handle, "ROLLBACK;", NULL);
+        return -1;
+    }
+    return 0;
+}
+
+/* Mark stored with partition 'start', -1 when none was set; -2 on error. */
+static int64_t read_partition_mark(DBCONN *conn, sensor_ts_t start)
+{
+    sqlite3_stmt *stmt = NULL;
+    char *sql = sqlite3_mprintf("SELECT coalesce(archive_mark, -1) FROM %s WHERE start_ts = ?1;",
+                                TO_STRING(PARTITION_TABLE_NAME));
+    int64_t mark = -2;
+
+    if (sql == NULL) return -2;
+    if (sqlite3_prepare_v2(conn->handle, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(conn->handle));
+        sqlite3_free(sql);
+        return -2;
+    }
+    sqlite3_free(sql);
+    sqlite3_bind_int64(stmt, 1, (sqlite3_int64)start);
+    if (sqlite3_step(stmt) == SQLITE_ROW) mark = (int64_t)sqlite3_column_int64(stmt, 0);
+    sqlite3_finalize(stmt);
+    return mark;
+}
+
+int sensor_db_set_partition_mark(DBCONN *conn, sensor_ts_t start, int64_t mark)
+{
+    if (conn == NULL || sensor_db_flush(conn) != 0) return -1;
+    if (exec_format(conn->handle, sqlite3_mprintf("UPDATE %s SET archive_mark = %lld WHERE start_ts = %lld;",
+                                                  TO_STRING(PARTITION_TABLE_NAME), (long long)mark,
+                                                  (long long)start)) != 0) {
+        return -1;
+    }
+    return sqlite3_changes(conn->handle) == 1 ? 0 : -1;
+}
+
+static int drop_partitions_before(DBCONN *conn, sqlite3_int64 cutoff, sensor_db_partition_hook_t hook,
+                                  void *context)
+{
+    int dropped = 0;
+
+    if (conn == NULL || sensor_db_flush(conn) != 0) return -1;
+    for (;;) {
+        sensor_ts_t start;
+        sensor_ts_t end;
+        int found = read_bounds(conn->handle, sqlite3_mprintf("SELECT start_ts, end_ts FROM %s WHERE end_ts <= ?1 "
+                                                              "ORDER BY start_ts LIMIT 1;",
+                                                              TO_STRING(PARTITION_TABLE_NAME)),
+                                cutoff, &start, &end);
+
+        if (found < 0) return -1;
+        if (found == 0) break;
+        if (hook != NULL) {
+            int64_t mark = read_partition_mark(conn, start);
+
+            if (mark < -1) return -1;
+            if (hook(conn, start, end, mark, context) != 0) break;
+        }
+        if (drop_partition(conn, start) != 0) return -1;
+        dropped++;
+    }
+    return dropped;
+}
+
+int sensor_db_drop_partitions(DBCONN *conn, sensor_ts_t cutoff, sensor_db_partition_hook_t hook, void *context)
+{
+    return drop_partitions_before(conn, (sqlite3_int64)cutoff, hook, context);
+}
+
 DBCONN *init_connection(char *clear_up_flag)
 {
+    DBCONN *conn;
     sqlite3 *db = NULL;
-    char *sql = NULL;
 
     if (sqlite3_open(TO_STRING(DB_NAME), &db) != SQLITE_OK) {
         fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(db));
         sqlite3_close(db);
         return NULL;
     }
+    /* Several gateway processes (datamgr shards) may write at the same time. */
+    sqlite3_busy_timeout(db, 5000);
+    apply_profile(db, sensor_db_get_profile());
 
-    sql = sqlite3_mprintf(
-        "CREATE TABLE IF NOT EXISTS %s ("
-        "id INTEGER PRIMARY KEY AUTOINCREMENT,"
-        "sensor_id INTEGER NOT NULL,"
-        "sensor_value REAL NOT NULL,"
-        "timestamp INTEGER NOT NULL);",
-        TO_STRING(TABLE_NAME)
-    );
-    if (exec_sql(db, sql, NULL) != 0) {
-        sqlite3_free(sql);
+    if (migrate_schema(db) != 0) {
         sqlite3_close(db);
         return NULL;
     }
-    sqlite3_free(sql);
+
+    conn = calloc(1, sizeof(*conn));
+    if (conn == NULL) {
+        sqlite3_close(db);
+        return NULL;
+    }
+    conn->handle = db;
+    conn->batch_rows = DB_BATCH_ROWS;
+    conn->batch_ms = DB_BATCH_MS;
+    sqlite3_randomness(sizeof(conn->source_id), &conn->source_id);
 
     if (clear_up_flag != NULL && atoi(clear_up_flag) != 0) {
-        sql = sqlite3_mprintf("DELETE FROM %s;", TO_STRING(TABLE_NAME));
-        if (exec_sql(db, sql, NULL) != 0) {
-            sqlite3_free(sql);
-            sqlite3_close(db);
+        if (drop_partitions_before(conn, INT64_MAX, NULL, NULL) < 0 ||
+            exec_format(db, sqlite3_mprintf("DELETE FROM %s;", TO_STRING(ROLLUP_TABLE_NAME))) != 0) {
+            disconnect(conn);
             return NULL;
         }
-        sqlite3_free(sql);
     }
-
-    return db;
+    return conn;
 }
 
 void disconnect(DBCONN *conn)
 {
-    sqlite3_close(conn);
+    if (conn == NULL) return;
+    (void)sensor_db_flush(conn);
+    for (size_t index = 0; index < SENSOR_DB_STMT_CACHE; index++) {
+        sqlite3_finalize(conn->stmts[index].stmt);
+    }
+    sqlite3_close(conn->handle);
+    free(conn);
 }
 
-int insert_sensor(DBCONN *conn, sensor_id_t id, sensor_value_t value, sensor_ts_t ts)
+void sensor_db_set_busy_timeout(DBCONN *conn, int ms)
 {
-    char *sql = sqlite3_mprintf(
-        "INSERT INTO %s (sensor_id, sensor_value, timestamp) VALUES (%u, %f, %lld);",
-        TO_STRING(TABLE_NAME),
-        (unsigned)id,
-        value,
-        (long long)ts
-    );
+    if (conn == NULL) return;
+    sqlite3_busy_timeout(conn->handle, ms);
+}
+
+int sensor_db_flush(DBCONN *conn)
+{
+    if (conn == NULL) return -1;
+    if (conn->pending == 0) return 0;
+    if (exec_sql(conn->handle, "COMMIT;", NULL) != 0) {
+        rollback(conn);
+        return -1;
+    }
+    conn->pending = 0;
+    return 0;
+}
+
+static long batch_age_ms(const DBCONN *conn)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long)(now.tv_sec - conn->batch_started.tv_sec) * 1000 +
+           (now.tv_nsec - conn->batch_started.tv_nsec) / 1000000;
+}
+
+static double elapsed_since_ms(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) * 1000.0 + (double)(now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+int sensor_db_set_batch(DBCONN *conn, size_t batch_rows, int batch_ms)
+{
+    if (conn == NULL) return -1;
+    conn->batch_rows = batch_rows == 0 ? 1 : batch_rows;
+    conn->batch_ms = batch_ms < 0 ? 0 : batch_ms;
+    return conn->pending >= conn->batch_rows ? sensor_db_flush(conn) : 0;
+}
+
+/* Binds one reading numbered by a writer of 'kind' (run reading->epoch) to parameters first + 1 .. first + 6. */
+static void bind_reading(sqlite3_stmt *stmt, int first, const sensor_data_t *reading, int kind)
+{
+    sqlite3_bind_int(stmt, first + 1, reading->sensor_id);
+    sqlite3_bind_int64(stmt, first + 2, (sqlite3_int64)reading->timestamp);
+    sqlite3_bind_int64(stmt, first + 3, (sqlite3_int64)kind << 32 | reading->epoch);
+    sqlite3_bind_int64(stmt, first + 4, (sqlite3_int64)reading->seq);
+    sqlite3_bind_int(stmt, first + 5, reading->room_id);
+    sqlite3_bind_double(stmt, first + 6, reading->value);
+}
+
+static int store_reading(DBCONN *conn, const sensor_data_t *reading, int kind)
+{
+    sqlite3_stmt *stmt;
     int rc;
 
-    rc = exec_sql(conn, sql, NULL);
-    sqlite3_free(sql);
+    if (conn == NULL || reading == NULL) return -1;
+    /*
+     * One transaction (one journal sync) per batch instead of per row. IMMEDIATE takes
+     * the write lock up front, as creating a partition reads the catalog before writing.
+     */
+    if (conn->pending == 0) {
+        if (exec_sql(conn->handle, "BEGIN IMMEDIATE;", NULL) != 0) return -1;
+        clock_gettime(CLOCK_MONOTONIC, &conn->batch_started);
+    }
+
+    stmt = insert_statement(conn, STMT_INSERT, reading->timestamp);
+    if (stmt == NULL) {
+        rollback(conn);
+        return -1;
+    }
+    bind_reading(stmt, 0, reading, kind);
+    rc = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(conn->handle));
+        rollback(conn);
+        return -1;
+    }
+    conn->pending++;
+
+    if (conn->pending >= conn->batch_rows) return sensor_db_flush(conn);
+    if (conn->batch_ms > 0 && batch_age_ms(conn) >= conn->batch_ms) return sensor_db_flush(conn);
+    return 0;
+}
+
+int insert_reading(DBCONN *conn, const sensor_data_t *reading)
+{
+    return store_reading(conn, reading, SOURCE_SENDER);
+}
+
+int insert_sensor(DBCONN *conn, sensor_id_t id, sensor_value_t value, sensor_ts_t ts)
+{
+    sensor_data_t reading = { 0 };
+
+    if (conn == NULL) return -1;
+    reading.sensor_id = id;
+    reading.value = value;
+    reading.timestamp = ts;
+    reading.epoch = conn->source_id;
+    reading.seq = conn->next_seq++;
+    return store_reading(conn, &reading, SOURCE_CONNECTION);
+}
+
+typedef struct {
+    DBCONN *conn;
+    const uint16_t *rooms;
+    sensor_db_progress_t progress;
+    void *context;
+    sensor_db_import_stats_t stats;
+    struct timespec started;
+    size_t in_transaction;      /**< rows stored since the last COMMIT */
+    sensor_data_t *rows;        /**< SENSOR_DB_IMPORT_CHUNK decoded readings */
+} import_t;
+
+static int step_import(import_t *import, sqlite3_stmt *stmt)
+{
+    int rc = sqlite3_step(stmt);
+
+    sqlite3_reset(stmt);
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(import->conn->handle));
+        return -1;
+    }
+    import->stats.stored += (unsigned long long)sqlite3_changes(import->conn->handle);
+    return 0;
+}
+
+/* FNV-1a of one packed record: a different record at the same index is a different reading. */
+static uint32_t record_hash(const unsigned char *record)
+{
+    uint32_t hash = 2166136261u;
+
+    for (size_t index = 0; index < SENSOR_DB_RECORD_SIZE; index++) {
+        hash = (hash ^ record[index]) * 16777619u;
+    }
+    return hash;
+}
+
+/* Decodes 'count' packed records into import->rows, dropping invalid ones; returns the rows kept. */
+static size_t decode_records(import_t *import, const unsigned char *bytes, size_t count)
+{
+    size_t kept = 0;
+
+    for (size_t index = 0; index < count; index++) {
+        const unsigned char *record = bytes + index * SENSOR_DB_RECORD_SIZE;
+        sensor_data_t *row = &import->rows[kept];
+
+        memset(row, 0, sizeof(*row));
+        memcpy(&row->sensor_id, record, sizeof(sensor_id_t));
+        memcpy(&row->value, record + sizeof(sensor_id_t), sizeof(sensor_value_t));
+        memcpy(&row->timestamp, record + sizeof(sensor_id_t) + sizeof(sensor_value_t), sizeof(sensor_ts_t));
+        row->seq = (uint32_t)(import->stats.records + index);
+        row->epoch = record_hash(record);
+        if (!isfinite(row->value) || row->timestamp < 0) {
+            import->stats.invalid++;
+            continue;
+        }
+        row->room_id = import->rooms == NULL ? 0 : import->rooms[row->sensor_id];
+        kept++;
+    }
+    import->stats.records += count;
+    return kept;
+}
+
+/* Stores decoded rows, each run of rows of one partition through that partition's INSERTs. */
+static int store_rows(import_t *import, size_t count)
+{
+    DBCONN *conn = import->conn;
+    size_t index = 0;
+
+    while (index < count) {
+        size_t end = index;
+
+        if (insert_statement(conn, STMT_INSERT, import->rows[index].timestamp) == NULL) return -1;
+        while (end < count && import->rows[end].timestamp >= conn->route_start &&
+               import->rows[end].timestamp < conn->route_end) {
+            end++;
+        }
+        for (; index + SENSOR_DB_IMPORT_ROWS_PER_INSERT <= end; index += SENSOR_DB_IMPORT_ROWS_PER_INSERT) {
+            sqlite3_stmt *stmt = insert_statement(conn, STMT_IMPORT, import->rows[index].timestamp);
+
+            if (stmt == NULL) return -1;
+            for (int row = 0; row < SENSOR_DB_IMPORT_ROWS_PER_INSERT; row++) {
+                bind_reading(stmt, row * 6, &import->rows[index + (size_t)row], SOURCE_IMPORT);
+            }
+            if (step_import(import, stmt) != 0) return -1;
+        }
+        for (; index < end; index++) {
+            sqlite3_stmt *stmt = insert_statement(conn, STMT_INSERT, import->rows[index].timestamp);
+
+            if (stmt == NULL) return -1;
+            bind_reading(stmt, 0, &import->rows[index], SOURCE_IMPORT);
+            if (step_import(import, stmt) != 0) return -1;
+        }
+    }
+    return 0;
+}
+
+/* Decodes and stores 'count' whole records, committing every SENSOR_DB_IMPORT_TXN_ROWS rows. */
+static int import_records(import_t *import, const unsigned char *bytes, size_t count)
+{
+    while (count > 0) {
+        size_t chunk = count < SENSOR_DB_IMPORT_CHUNK ? count : SENSOR_DB_IMPORT_CHUNK;
+        size_t kept = decode_records(import, bytes, chunk);
+
+        if (store_rows(import, kept) != 0) return -1;
+        import->in_transaction += kept;
+        if (import->in_transaction >= SENSOR_DB_IMPORT_TXN_ROWS) {
+            if (exec_sql(import->conn->handle, "COMMIT; BEGIN IMMEDIATE;", NULL) != 0) return -1;
+            import->in_transaction = 0;
+        }
+        bytes += chunk * SENSOR_DB_RECORD_SIZE;
+        count -= chunk;
+        import->stats.bytes_done += chunk * SENSOR_DB_RECORD_SIZE;
+        import->stats.elapsed_ms = elapsed_since_ms(&import->started);
+        if (import->progress != NULL) import->progress(&import->stats, import->context);
+    }
+    return 0;
+}
+
+/* Reads whole chunks of records; a record split across reads waits for its tail. */
+static int import_stream(import_t *import, FILE *input)
+{
+    const size_t capacity = SENSOR_DB_IMPORT_CHUNK * SENSOR_DB_RECORD_SIZE;
+    unsigned char *buffer = malloc(capacity);
+    size_t used = 0;
+    int rc = 0;
+
+    if (buffer == NULL) return -1;
+    while (rc == 0) {
+        size_t got = fread(buffer + used, 1, capacity - used, input);
+        size_t count;
+
+        used += got;
+        count = used / SENSOR_DB_RECORD_SIZE;
+        if (count > 0) {
+            rc = import_records(import, buffer, count);
+            used -= count * SENSOR_DB_RECORD_SIZE;
+            memmove(buffer, buffer + count * SENSOR_DB_RECORD_SIZE, used);
+        }
+        if (got == 0) break;
+    }
+    import->stats.truncated = used;
+    free(buffer);
+    return rc == 0 && ferror(input) ? -1 : rc;
+}
+
+static int import_begin(import_t *import, DBCONN *conn, const uint16_t *rooms, sensor_db_progress_t progress,
+                        void *context)
+{
+    memset(import, 0, sizeof(*import));
+    import->conn = conn;
+    import->rooms = rooms;
+    import->progress = progress;
+    import->context = context;
+    clock_gettime(CLOCK_MONOTONIC, &import->started);
+    if (conn == NULL) return -1;
+    import->rows = malloc(SENSOR_DB_IMPORT_CHUNK * sizeof(*import->rows));
+    if (import->rows == NULL) return -1;
+    /* The import runs in its own large transactions; commit the insert batch first. */
+    if (sensor_db_flush(conn) != 0 || exec_sql(conn->handle, "BEGIN IMMEDIATE;", NULL) != 0) {
+        free(import->rows);
+        import->rows = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static int import_end(import_t *import, int rc, sensor_db_import_stats_t *stats)
+{
+    if (import->rows != NULL) {
+        if (rc == 0 && exec_sql(import->conn->handle, "COMMIT;", NULL) != 0) rc = -1;
+        if (rc != 0) rollback(import->conn);
+        free(import->rows);
+    }
+    import->stats.elapsed_ms = elapsed_since_ms(&import->started);
+    if (stats != NULL) *stats = import->stats;
     return rc;
 }
 
 int insert_sensor_from_file(DBCONN *conn, FILE *sensor_data)
 {
-    sensor_id_t sensor_id;
-    sensor_value_t temperature;
-    sensor_ts_t timestamp;
+    import_t import;
 
-    while (fread(&sensor_id, sizeof(sensor_id), 1, sensor_data) == 1 &&
-           fread(&temperature, sizeof(temperature), 1, sensor_data) == 1 &&
-           fread(&timestamp, sizeof(timestamp), 1, sensor_data) == 1) {
-        if (insert_sensor(conn, sensor_id, temperature, timestamp) != 0) {
-            return -1;
+    /* seq = position in the file, source = hash of the record: a file imported twice is stored once. */
+    if (import_begin(&import, conn, NULL, NULL, NULL) != 0) return import_end(&import, -1, NULL);
+    return import_end(&import, import_stream(&import, sensor_data), NULL);
+}
+
+int sensor_db_import_file(DBCONN *conn, const char *path, const uint16_t *rooms, sensor_db_progress_t progress,
+                          void *context, sensor_db_import_stats_t *stats)
+{
+    import_t import;
+    struct stat info;
+    void *map;
+    FILE *input;
+    int fd;
+    int rc;
+
+    if (import_begin(&import, conn, rooms, progress, context) != 0 || path == NULL) {
+        return import_end(&import, -1, stats);
+    }
+    if (strcmp(path, "-") == 0) return import_end(&import, import_stream(&import, stdin), stats);
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        perror(path);
+        if (fd >= 0) close(fd);
+        return import_end(&import, -1, stats);
+    }
+    if (S_ISREG(info.st_mode) && info.st_size > 0) {
+        size_t size = (size_t)info.st_size;
+
+        map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            close(fd);
+            (void)posix_madvise(map, size, POSIX_MADV_SEQUENTIAL);
+            import.stats.bytes_total = size;
+            rc = import_records(&import, map, size / SENSOR_DB_RECORD_SIZE);
+            import.stats.truncated = size % SENSOR_DB_RECORD_SIZE;
+            munmap(map, size);
+            return import_end(&import, rc, stats);
         }
     }
 
-    return ferror(sensor_data) ? -1 : 0;
+    /* Pipes, empty files and files that cannot be mapped are read in chunks. */
+    if (S_ISREG(info.st_mode)) import.stats.bytes_total = (unsigned long long)info.st_size;
+    input = fdopen(fd, "rb");
+    if (input == NULL) {
+        close(fd);
+        return import_end(&import, -1, stats);
+    }
+    rc = import_stream(&import, input);
+    fclose(input);
+    return import_end(&import, rc, stats);
 }
 
 int insert_from_sbuffer(DBCONN *conn, sbuffer_t *sbuffer)
@@ -127,71 +1067,337 @@ int insert_from_sbuffer(DBCONN *conn, sbuffer_t *sbuffer)
 
     if (conn == NULL || sbuffer == NULL) return -1;
 
-    for (node = sbuffer->head; node != NULL; node = node->next) {
-        if (insert_sensor(conn, node->data.sensor_id, node->data.value, node->data.timestamp) != 0) {
-            return -1;
+    for (int lane = 0; lane < SBUFFER_LANE_COUNT; lane++) {
+        for (node = sbuffer->lanes[lane].head; node != NULL; node = node->next) {
+            if (insert_reading(conn, &node->data) != 0) {
+                return -1;
+            }
         }
     }
 
-    return 0;
+    return sensor_db_flush(conn);
 }
 
-int find_sensor_all(DBCONN *conn, callback_t f)
+/* Time range [lo, hi] a query can match, to skip the partitions outside it. */
+static void query_time_range(const sensor_db_cursor_t *cursor, sqlite3_int64 *lo, sqlite3_int64 *hi)
 {
-    char *sql = sqlite3_mprintf("SELECT * FROM %s;", TO_STRING(TABLE_NAME));
-    int rc = exec_sql(conn, sql, f);
+    *lo = INT64_MIN;
+    *hi = INT64_MAX;
+    switch (cursor->query) {
+    case SENSOR_DB_QUERY_TS_EQ:
+        *lo = *hi = (sqlite3_int64)cursor->from;
+        break;
+    case SENSOR_DB_QUERY_TS_GT:
+        if ((sqlite3_int64)cursor->from < INT64_MAX) *lo = (sqlite3_int64)cursor->from + 1;
+        break;
+    case SENSOR_DB_QUERY_SENSOR_RANGE:
+    case SENSOR_DB_QUERY_ROOM_RANGE:
+    case SENSOR_DB_QUERY_TS_RANGE:
+        *lo = (sqlite3_int64)cursor->from;
+        *hi = (sqlite3_int64)cursor->to;
+        break;
+    default:
+        break;
+    }
+}
 
+/* Lists the partitions overlapping [lo, hi] in time order. */
+static int load_partitions(sensor_db_cursor_t *cursor, sqlite3_int64 lo, sqlite3_int64 hi)
+{
+    sqlite3 *db = cursor->conn->handle;
+    sqlite3_stmt *stmt = NULL;
+    size_t capacity = 0;
+    char *sql;
+    int rc;
+
+    sql = sqlite3_mprintf("SELECT start_ts FROM %s WHERE start_ts <= ?2 AND end_ts > ?1 ORDER BY start_ts;",
+                          TO_STRING(PARTITION_TABLE_NAME));
+    if (sql == NULL) return -1;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+        sqlite3_free(sql);
+        return -1;
+    }
     sqlite3_free(sql);
-    return rc;
+    sqlite3_bind_int64(stmt, 1, lo);
+    sqlite3_bind_int64(stmt, 2, hi);
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        if (cursor->partition_count == capacity) {
+            size_t larger = capacity == 0 ? 16 : capacity * 2;
+            sensor_ts_t *partitions = realloc(cursor->partitions, larger * sizeof(*partitions));
+
+            if (partitions == NULL) break;
+            cursor->partitions = partitions;
+            capacity = larger;
+        }
+        cursor->partitions[cursor->partition_count++] = (sensor_ts_t)sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    if (rc != SQLITE_DONE) {
+        if (rc != SQLITE_ROW) fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+        free(cursor->partitions);
+        cursor->partitions = NULL;
+        cursor->partition_count = 0;
+        return -1;
+    }
+    return 0;
 }
 
-int find_sensor_by_value(DBCONN *conn, sensor_value_t value, callback_t f)
+/* Hands the statement of the current partition back to the cache, or finalizes a private one. */
+static void cursor_release(sensor_db_cursor_t *cursor)
 {
-    char *sql = sqlite3_mprintf(
-        "SELECT * FROM %s WHERE sensor_value = %f;",
-        TO_STRING(TABLE_NAME),
-        value
-    );
-    int rc = exec_sql(conn, sql, f);
+    if (cursor->stmt == NULL) return;
+    if (cursor->entry != NULL) {
+        /* Resetting releases the read snapshot without waiting for close. */
+        sqlite3_reset(cursor->stmt);
+        cursor->entry->in_use = false;
+    } else {
+        sqlite3_finalize(cursor->stmt);
+    }
+    cursor->stmt = NULL;
+    cursor->entry = NULL;
+}
 
-    sqlite3_free(sql);
-    return rc;
+/* Starts the next partition; returns 1 when every partition was read, -1 on error. */
+static int cursor_advance(sensor_db_cursor_t *cursor)
+{
+    DBCONN *conn = cursor->conn;
+
+    while (cursor->next_partition < cursor->partition_count) {
+        sensor_ts_t partition = cursor->partitions[cursor->next_partition++];
+        sqlite3_stmt *stmt;
+        int params;
+
+        cursor->entry = cached_statement(conn, cursor->query, partition);
+        if (cursor->entry != NULL) {
+            cursor->entry->in_use = true;
+            stmt = cursor->entry->stmt;
+        } else {
+            stmt = prepare_statement(conn, cursor->query, partition, 0);
+        }
+        if (stmt == NULL) {
+            char table[PARTITION_NAME_MAX];
+
+            /* Retention may have dropped the partition since the cursor was opened. */
+            partition_name(table, sizeof(table), partition);
+            if (table_exists(conn->handle, table) == 0) continue;
+            fprintf(stderr, "SQL error: cannot read partition %s\n", table);
+            return -1;
+        }
+
+        /* ?1 value, ?2 from, ?3 id, ?4 to; each statement declares up to the last one it uses. */
+        params = sqlite3_bind_parameter_count(stmt);
+        if (params >= 1) sqlite3_bind_double(stmt, 1, cursor->value);
+        if (params >= 2) sqlite3_bind_int64(stmt, 2, (sqlite3_int64)cursor->from);
+        if (params >= 3) sqlite3_bind_int(stmt, 3, cursor->id);
+        if (params >= 4) sqlite3_bind_int64(stmt, 4, (sqlite3_int64)cursor->to);
+        cursor->stmt = stmt;
+        return 0;
+    }
+    return 1;
 }
 
-int find_sensor_exceed_value(DBCONN *conn, sensor_value_t value, callback_t f)
+int sensor_db_cursor_open(DBCONN *conn, sensor_db_cursor_t *cursor, sensor_db_query_t query, uint16_t id,
+                          sensor_value_t value, sensor_ts_t from, sensor_ts_t to)
 {
-    char *sql = sqlite3_mprintf(
-        "SELECT * FROM %s WHERE sensor_value > %f;",
-        TO_STRING(TABLE_NAME),
-        value
-    );
-    int rc = exec_sql(conn, sql, f);
+    sqlite3_int64 lo;
+    sqlite3_int64 hi;
 
-    sqlite3_free(sql);
+    if (conn == NULL || cursor == NULL || query < 0 || query >= SENSOR_DB_QUERY_COUNT) return -1;
+    memset(cursor, 0, sizeof(*cursor));
+    cursor->conn = conn;
+    cursor->query = query;
+    cursor->id = id;
+    cursor->value = value;
+    cursor->from = from;
+    cursor->to = to;
+
+    query_time_range(cursor, &lo, &hi);
+    if (lo > hi) return 0;
+    return load_partitions(cursor, lo, hi);
+}
+
+ssize_t sensor_db_cursor_next(sensor_db_cursor_t *cursor, sensor_data_t *rows, size_t max_rows)
+{
+    size_t count = 0;
+
+    if (cursor == NULL || cursor->conn == NULL || (rows == NULL && max_rows > 0)) return -1;
+    while (count < max_rows && !cursor->done) {
+        sensor_data_t *row;
+        int rc;
+
+        if (cursor->stmt == NULL) {
+            rc = cursor_advance(cursor);
+            if (rc != 0) {
+                cursor->done = true;
+                if (rc < 0) return -1;
+                break;
+            }
+        }
+        rc = sqlite3_step(cursor->stmt);
+        if (rc == SQLITE_DONE) {
+            cursor_release(cursor);
+            continue;
+        }
+        if (rc != SQLITE_ROW) {
+            fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(cursor->conn->handle));
+            cursor_release(cursor);
+            cursor->done = true;
+            return -1;
+        }
+        row = &rows[count++];
+        memset(row, 0, sizeof(*row));
+        row->sensor_id = (sensor_id_t)sqlite3_column_int(cursor->stmt, 0);
+        row->room_id = (uint16_t)sqlite3_column_int(cursor->stmt, 1);
+        row->value = sqlite3_column_double(cursor->stmt, 2);
+        row->timestamp = (sensor_ts_t)sqlite3_column_int64(cursor->stmt, 3);
+        row->seq = (uint32_t)sqlite3_column_int64(cursor->stmt, 4);
+    }
+    return (ssize_t)count;
+}
+
+void sensor_db_cursor_close(sensor_db_cursor_t *cursor)
+{
+    if (cursor == NULL) return;
+    cursor_release(cursor);
+    free(cursor->partitions);
+    cursor->partitions = NULL;
+    cursor->partition_count = 0;
+    cursor->done = true;
+}
+
+/* Runs a query through a cursor and hands every row to 'f' as text, like sqlite3_exec(). */
+static int run_callback_query(DBCONN *conn, sensor_db_query_t query, uint16_t id, sensor_value_t value,
+                              sensor_ts_t from, sensor_ts_t to, callback_t f)
+{
+    static char *names[] = { "sensor_id", "room_id", "sensor_value", "timestamp", "seq" };
+    sensor_data_t rows[SENSOR_DB_CURSOR_BATCH];
+    sensor_db_cursor_t cursor;
+    ssize_t count;
+    int rc = 0;
+
+    if (sensor_db_cursor_open(conn, &cursor, query, id, value, from, to) != 0) return -1;
+    while (rc == 0 && (count = sensor_db_cursor_next(&cursor, rows, SENSOR_DB_CURSOR_BATCH)) > 0) {
+        for (ssize_t index = 0; index < count && rc == 0 && f != NULL; index++) {
+            char text[5][32];
+            char *values[5] = { text[0], text[1], text[2], text[3], text[4] };
+
+            snprintf(text[0], sizeof(text[0]), "%u", (unsigned)rows[index].sensor_id);
+            snprintf(text[1], sizeof(text[1]), "%u", (unsigned)rows[index].room_id);
+            sqlite3_snprintf(sizeof(text[2]), text[2], "%!.15g", rows[index].value);
+            snprintf(text[3], sizeof(text[3]), "%lld", (long long)rows[index].timestamp);
+            snprintf(text[4], sizeof(text[4]), "%u", (unsigned)rows[index].seq);
+            if (f(NULL, 5, values, names) != 0) rc = -1;
+        }
+    }
+    if (rc == 0 && count < 0) rc = -1;
+    sensor_db_cursor_close(&cursor);
     return rc;
 }
 
+int find_sensor_all(DBCONN *conn, callback_t f)
+{
+    return run_callback_query(conn, SENSOR_DB_QUERY_ALL, 0, 0, 0, 0, f);
+}
+
+int find_sensor_by_value(DBCONN *conn, sensor_value_t value, callback_t f)
+{
+    return run_callback_query(conn, SENSOR_DB_QUERY_VALUE_EQ, 0, value, 0, 0, f);
+}
+
+int find_sensor_exceed_value(DBCONN *conn, sensor_value_t value, callback_t f)
+{
+    return run_callback_query(conn, SENSOR_DB_QUERY_VALUE_GT, 0, value, 0, 0, f);
+}
+
 int find_sensor_by_timestamp(DBCONN *conn, sensor_ts_t ts, callback_t f)
 {
-    char *sql = sqlite3_mprintf(
-        "SELECT * FROM %s WHERE timestamp = %lld;",
-        TO_STRING(TABLE_NAME),
-        (long long)ts
-    );
-    int rc = exec_sql(conn, sql, f);
+    return run_callback_query(conn, SENSOR_DB_QUERY_TS_EQ, 0, 0, ts, 0, f);
+}
 
+int find_sensor_after_timestamp(DBCONN *conn, sensor_ts_t ts, callback_t f)
+{
+    return run_callback_query(conn, SENSOR_DB_QUERY_TS_GT, 0, 0, ts, 0, f);
+}
+
+int find_sensor_in_range(DBCONN *conn, sensor_id_t id, sensor_ts_t from, sensor_ts_t to, callback_t f)
+{
+    return run_callback_query(conn, SENSOR_DB_QUERY_SENSOR_RANGE, id, 0, from, to, f);
+}
+
+int find_room_in_range(DBCONN *conn, uint16_t room_id, sensor_ts_t from, sensor_ts_t to, callback_t f)
+{
+    return run_callback_query(conn, SENSOR_DB_QUERY_ROOM_RANGE, room_id, 0, from, to, f);
+}
+
+int insert_rollups(DBCONN *conn, const rollup_record_t *rows, size_t count)
+{
+    sqlite3_stmt *stmt = NULL;
+    char *sql;
+    int rc = 0;
+
+    if (conn == NULL || (rows == NULL && count > 0)) return -1;
+    if (count == 0) return 0;
+    /* Rollups run in their own transaction; finish the insert batch first. */
+    if (sensor_db_flush(conn) != 0) return -1;
+
+    sql = sqlite3_mprintf(
+        "INSERT INTO %s (sensor_id, room_id, resolution, window_start, count, sum, min, max) "
+        "VALUES (?, ?, ?, ?, ?, ?, ?, ?) "
+        "ON CONFLICT (sensor_id, resolution, window_start) DO UPDATE SET "
+        "count = count + excluded.count, sum = sum + excluded.sum, "
+        "min = MIN(min, excluded.min), max = MAX(max, excluded.max);",
+        TO_STRING(ROLLUP_TABLE_NAME)
+    );
+    if (sqlite3_prepare_v2(conn->handle, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(conn->handle));
+        sqlite3_free(sql);
+        return -1;
+    }
     sqlite3_free(sql);
-    return rc;
+
+    /* IMMEDIATE like every other write path: a busy lock fails here, not halfway through. */
+    if (exec_sql(conn->handle, "BEGIN IMMEDIATE;", NULL) != 0) {
+        sqlite3_finalize(stmt);
+        return -1;
+    }
+    for (size_t index = 0; index < count; index++) {
+        const rollup_record_t *row = &rows[index];
+
+        sqlite3_bind_int(stmt, 1, row->sensor_id);
+        sqlite3_bind_int(stmt, 2, row->room_id);
+        sqlite3_bind_int(stmt, 3, row->resolution);
+        sqlite3_bind_int64(stmt, 4, (sqlite3_int64)row->window_start);
+        sqlite3_bind_int64(stmt, 5, (sqlite3_int64)row->count);
+        sqlite3_bind_double(stmt, 6, row->sum);
+        sqlite3_bind_double(stmt, 7, row->min);
+        sqlite3_bind_double(stmt, 8, row->max);
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(conn->handle));
+            rc = -1;
+            break;
+        }
+        sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+
+    if (rc == 0 && exec_sql(conn->handle, "COMMIT;", NULL) == 0) return 0;
+    (void)exec_sql(conn->handle, "ROLLBACK;", NULL);
+    return -1;
 }
 
-int find_sensor_after_timestamp(DBCONN *conn, sensor_ts_t ts, callback_t f)
+int find_rollups(DBCONN *conn, sensor_id_t id, int resolution, sensor_ts_t from, sensor_ts_t to, callback_t f)
 {
     char *sql = sqlite3_mprintf(
-        "SELECT * FROM %s WHERE timestamp > %lld;",
-        TO_STRING(TABLE_NAME),
-        (long long)ts
+        "SELECT * FROM %s WHERE sensor_id = %u AND resolution = %d "
+        "AND window_start BETWEEN %lld AND %lld ORDER BY window_start;",
+        TO_STRING(ROLLUP_TABLE_NAME),
+        (unsigned)id,
+        resolution,
+        (long long)from,
+        (long long)to
     );
-    int rc = exec_sql(conn, sql, f);
+    int rc = exec_sql(conn->handle, sql, f);
 
     sqlite3_free(sql);
     return rc;
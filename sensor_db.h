@@ -1,122 +1,444 @@
-/**
- * \author Yongkai Zhang
- */
-
-#ifndef _SENSOR_DB_H_
-#define _SENSOR_DB_H_
-
-#include <stdio.h>
-#include <stdlib.h>
-#include "config.h"
-#include <sqlite3.h>
-#include"sbuffer.h"
-//#include "main.h"
-
-
-// stringify preprocessor directives using 2-level preprocessor magic
-// this avoids using directives like -DDB_NAME=\"some_db_name\"
-#define REAL_TO_STRING(s) #s
-#define TO_STRING(s) REAL_TO_STRING(s)    //force macro-expansion on s before stringify s
-
-#ifndef DB_NAME
-#define DB_NAME Sensor.db
-#endif
-
-#ifndef TABLE_NAME
-#define TABLE_NAME SensorData
-#endif
-
-#define DBCONN sqlite3
-
-typedef int (*callback_t)(void *, int, char **, char **);
-
-/**
- * Make a connection to the database server
- * Create (open) a database with name DB_NAME having 1 table named TABLE_NAME  
- * \param clear_up_flag if the table existed, clear up the existing data when clear_up_flag is set to 1
- * \return the connection for success, NULL if an error occurs
- */
-DBCONN *init_connection(char* clear_up_flag);
-
-/**
- * Disconnect from the database server
- * \param conn pointer to the current connection
- */
-void disconnect(DBCONN *conn);
-
-/**
- * Write an INSERT query to insert a single sensor measurement
- * \param conn pointer to the current connection
- * \param id the sensor id
- * \param value the measurement value
- * \param ts the measurement timestamp
- * \return zero for success, and non-zero if an error occurs
- */
-int insert_sensor(DBCONN *conn, sensor_id_t id, sensor_value_t value, sensor_ts_t ts);
-
-/**
- * Write an INSERT query to insert all sensor measurements available in the file 'sensor_data'
- * \param conn pointer to the current connection
- * \param sensor_data a file pointer to binary file containing sensor data
- * \return zero for success, and non-zero if an error occurs
- */
-int insert_sensor_from_file(DBCONN *conn, FILE *sensor_data);
-
-/**
- *insert data from sbuffer into database
- *if fail, return 0;
- *\param conn pointer to the current connection
- *\param sbuffer pointer to the sbuffer
- */
-int insert_from_sbuffer(DBCONN *conn, sbuffer_t* sbuffer);
-
-/**
-  * Write a SELECT query to select all sensor measurements in the table 
-  * The callback function is applied to every row in the result
-  * \param conn pointer to the current connection
-  * \param f function pointer to the callback method that will handle the result set
-  * \return zero for success, and non-zero if an error occurs
-  */
-int find_sensor_all(DBCONN *conn, callback_t f);
-
-/**
- * Write a SELECT query to return all sensor measurements having a temperature of 'value'
- * The callback function is applied to every row in the result
- * \param conn pointer to the current connection
- * \param value the value to be queried
- * \param f function pointer to the callback method that will handle the result set
- * \return zero for success, and non-zero if an error occurs
- */
-int find_sensor_by_value(DBCONN *conn, sensor_value_t value, callback_t f);
-
-/**
- * Write a SELECT query to return all sensor measurements of which the temperature exceeds 'value'
- * The callback function is applied to every row in the result
- * \param conn pointer to the current connection
- * \param value the value to be queried
- * \param f function pointer to the callback method that will handle the result set
- * \return zero for success, and non-zero if an error occurs
- */
-int find_sensor_exceed_value(DBCONN *conn, sensor_value_t value, callback_t f);
-
-/**
- * Write a SELECT query to return all sensor measurements having a timestamp 'ts'
- * The callback function is applied to every row in the result
- * \param conn pointer to the current connection
- * \param ts the timestamp to be queried
- * \param f function pointer to the callback method that will handle the result set
- * \return zero for success, and non-zero if an error occurs
- */
-int find_sensor_by_timestamp(DBCONN *conn, sensor_ts_t ts, callback_t f);
-
-/**
- * Write a SELECT query to return all sensor measurements recorded after timestamp 'ts'
- * The callback function is applied to every row in the result
- * \param conn pointer to the current connection
- * \param ts the timestamp to be queried
- * \param f function pointer to the callback method that will handle the result set
- * \return zero for success, and non-zero if an error occurs
- */
-int find_sensor_after_timestamp(DBCONN *conn, sensor_ts_t ts, callback_t f);
-
-#endif /* _SENSOR_DB_H_ */
+/**
+ * \author Yongkai Zhang
+ */
+
+#ifndef _SENSOR_DB_H_
+#define _SENSOR_DB_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <time.h>
+#include "config.h"
+#include <sqlite3.h>
+#include"sbuffer.h"
+#include "rollup.h"
+//#include "main.h"
+
+
+// stringify preprocessor directives using 2-level preprocessor magic
+// this avoids using directives like -DDB_NAME=\"some_db_name\"
+#define REAL_TO_STRING(s) #s
+#define TO_STRING(s) REAL_TO_STRING(s)    //force macro-expansion on s before stringify s
+
+#ifndef DB_NAME
+#define DB_NAME Sensor.db
+#endif
+
+#ifndef TABLE_NAME
+#define TABLE_NAME SensorData
+#endif
+
+#ifndef ROLLUP_TABLE_NAME
+#define ROLLUP_TABLE_NAME SensorRollup
+#endif
+
+#ifndef PARTITION_TABLE_NAME
+#define PARTITION_TABLE_NAME SensorPartitions
+#endif
+
+#define SENSOR_DB_SCHEMA_VERSION 4  // PRAGMA user_version of the current schema
+#define SENSOR_DB_STMT_CACHE 32     // prepared statements kept per connection (per query type and partition)
+
+/** Columns returned for TABLE_NAME rows by the find_sensor_* and find_room_* queries, in order */
+#define SENSOR_DB_COLUMNS "sensor_id, room_id, sensor_value, timestamp, seq"
+
+/** One record of a sensor_data file (file_creator): packed sensor_id, value, timestamp */
+#define SENSOR_DB_RECORD_SIZE (sizeof(sensor_id_t) + sizeof(sensor_value_t) + sizeof(sensor_ts_t))
+
+/** Reading queries, served by sensor_db_cursor_open() and the find_sensor_* / find_room_* functions */
+typedef enum {
+    SENSOR_DB_QUERY_ALL,            /**< every reading, in key order */
+    SENSOR_DB_QUERY_VALUE_EQ,       /**< sensor_value = value */
+    SENSOR_DB_QUERY_VALUE_GT,       /**< sensor_value > value */
+    SENSOR_DB_QUERY_TS_EQ,          /**< timestamp = from */
+    SENSOR_DB_QUERY_TS_GT,          /**< timestamp > from, in time order */
+    SENSOR_DB_QUERY_SENSOR_RANGE,   /**< sensor_id = id, timestamp in [from, to], in time order */
+    SENSOR_DB_QUERY_ROOM_RANGE,     /**< room_id = id, timestamp in [from, to], in time order */
+    SENSOR_DB_QUERY_TS_RANGE,       /**< timestamp in [from, to], by sensor and then time */
+    SENSOR_DB_QUERY_COUNT
+} sensor_db_query_t;
+
+/** A prepared statement bound to one partition table */
+typedef struct {
+    int kind;                   /**< sensor_db_query_t, or an insert kind private to sensor_db.c */
+    sensor_ts_t partition;      /**< start of the partition */
+    sqlite3_stmt *stmt;         /**< NULL for a free entry */
+    bool in_use;                /**< held by an open cursor */
+} sensor_db_stmt_t;
+
+/**
+ * A database connection. Readings live in one TABLE_NAME_<start> table per time
+ * partition, listed in PARTITION_TABLE_NAME. Rows are inserted through cached
+ * prepared statements and grouped into transactions of up to 'batch_rows' rows;
+ * an insert that finds its transaction older than 'batch_ms' commits it too.
+ * A row is durable only once its transaction commits: a failed insert or commit
+ * rolls back every row of the open transaction and adds them to 'discarded'.
+ */
+typedef struct {
+    sqlite3 *handle;
+    size_t batch_rows;
+    int batch_ms;
+    size_t pending;             /**< rows in the open transaction, 0 when none is open */
+    uint64_t discarded;         /**< accepted rows lost to a rollback of their transaction */
+    struct timespec batch_started;
+    uint32_t next_seq;          /**< seq given to rows stored through insert_sensor() */
+    uint32_t source_id;         /**< random id of this connection, keeps its seq apart from other writers */
+    sensor_ts_t route_start;    /**< partition that received the last insert ... */
+    sensor_ts_t route_end;      /**< ... and its end (exclusive); route_end <= route_start when unknown */
+    sensor_db_stmt_t stmts[SENSOR_DB_STMT_CACHE];
+    size_t stmt_victim;         /**< next cache entry to consider for eviction */
+} DBCONN;
+
+/**
+ * A typed iterator over the rows of one query, visiting the partitions that can
+ * hold matching rows in time order. Each partition is read under its own snapshot,
+ * held until the cursor moves past it or is closed.
+ */
+typedef struct {
+    DBCONN *conn;
+    sensor_db_query_t query;
+    uint16_t id;
+    sensor_value_t value;
+    sensor_ts_t from;
+    sensor_ts_t to;
+    sensor_ts_t *partitions;    /**< starts of the partitions to visit */
+    size_t partition_count;
+    size_t next_partition;
+    sqlite3_stmt *stmt;         /**< statement of the current partition, NULL between partitions */
+    sensor_db_stmt_t *entry;    /**< cache entry of 'stmt', NULL when the cursor owns it */
+    bool done;
+} sensor_db_cursor_t;
+
+/**
+ * Called before a partition is dropped
+ * \param mark as last stored with sensor_db_set_partition_mark(), -1 if never
+ * \return zero to drop it, non-zero to keep it and stop dropping
+ */
+typedef int (*sensor_db_partition_hook_t)(DBCONN *conn, sensor_ts_t start, sensor_ts_t end, int64_t mark,
+                                          void *context);
+
+typedef int (*callback_t)(void *, int, char **, char **);
+
+/**
+ * Progress of a bulk import
+ */
+typedef struct {
+    unsigned long long records;     /**< complete records decoded */
+    unsigned long long stored;      /**< rows inserted; records already in the table are skipped */
+    unsigned long long invalid;     /**< records rejected (non-finite value, negative timestamp) */
+    unsigned long long bytes_done;
+    unsigned long long bytes_total; /**< 0 when the input size is unknown (pipe) */
+    unsigned long long truncated;   /**< trailing bytes that do not form a whole record */
+    double elapsed_ms;
+} sensor_db_import_stats_t;
+
+typedef void (*sensor_db_progress_t)(const sensor_db_import_stats_t *stats, void *context);
+
+/**
+ * PRAGMA settings applied by init_connection(). A NULL text or a negative number
+ * keeps SQLite's own default.
+ */
+typedef struct {
+    const char *name;
+    const char *journal_mode;   /**< e.g. "WAL"; WAL persists in the database file */
+    const char *synchronous;    /**< "OFF", "NORMAL" or "FULL" */
+    long long mmap_size;        /**< bytes of the file read through mmap, 0 = plain reads */
+    int cache_size_kib;         /**< page cache per connection */
+    int page_size;              /**< bytes; only takes effect on a database that has no tables yet */
+    const char *temp_store;     /**< "DEFAULT", "FILE" or "MEMORY" */
+    int wal_autocheckpoint;     /**< WAL pages that trigger a checkpoint, 0 = never */
+} sensor_db_profile_t;
+
+/**
+ * \param count receives the number of built-in profiles
+ * \return the built-in profiles ("sqlite", "ssd", "hdd", "durable")
+ */
+const sensor_db_profile_t *sensor_db_profiles(size_t *count);
+
+/**
+ * \return the built-in profile called 'name', NULL when there is none
+ */
+const sensor_db_profile_t *sensor_db_find_profile(const char *name);
+
+/**
+ * Selects the profile used by every later init_connection() of this process
+ * (and of children forked afterwards); the default is DB_PROFILE
+ * \return zero for success, -1 if 'name' is not a built-in profile
+ */
+int sensor_db_set_profile(const char *name);
+
+/**
+ * \return the profile init_connection() applies
+ */
+const sensor_db_profile_t *sensor_db_get_profile(void);
+
+/**
+ * Make a connection to the database server
+ * Create (open) a database with name DB_NAME having reading tables named TABLE_NAME_<start>
+ * and a rollup table named ROLLUP_TABLE_NAME, tuned with the selected profile
+ * (see sensor_db_set_profile)
+ * Readings are stored in time partitions (see sensor_db_set_partition_seconds); each
+ * partition table is clustered on (sensor_id, timestamp, source, seq), where 'source' names
+ * the writer that numbered seq, and indexed by time and by room.
+ * An older database is migrated to SENSOR_DB_SCHEMA_VERSION (tracked in PRAGMA user_version);
+ * rows migrated from the first schema get room_id 0 and their old id as seq, and rows from
+ * before version 4 share one legacy source.
+ * \param clear_up_flag if the tables existed, clear up the existing data (drop every partition) when
+ * clear_up_flag is set to 1
+ * \return the connection for success, NULL if an error occurs
+ */
+DBCONN *init_connection(char* clear_up_flag);
+
+/**
+ * Sets the length of the partitions created from now on in this process (and in
+ * children forked afterwards); default DB_PARTITION_SECONDS. Existing partitions
+ * keep their bounds, and a new one is shortened where it would overlap them.
+ * \return zero for success, -1 if 'seconds' is below 60
+ */
+int sensor_db_set_partition_seconds(sensor_ts_t seconds);
+
+/**
+ * Drops every partition that ends at or before 'cutoff', oldest first. Each drop
+ * removes a whole table, whatever the number of rows in it.
+ * \param hook called before each drop (e.g. to archive the partition), may be NULL
+ * \param context passed to 'hook'
+ * \return the number of partitions dropped, -1 if an error occurs
+ */
+int sensor_db_drop_partitions(DBCONN *conn, sensor_ts_t cutoff, sensor_db_partition_hook_t hook, void *context);
+
+/**
+ * Stores 'mark' with partition 'start' in PARTITION_TABLE_NAME, committed before
+ * returning, so a drop hook can tell after a crash how far it got (e.g. the
+ * archive length before the partition was archived)
+ * \return zero for success, -1 if an error occurs or the partition does not exist
+ */
+int sensor_db_set_partition_mark(DBCONN *conn, sensor_ts_t start, int64_t mark);
+
+/**
+ * Disconnect from the database server, committing the open insert transaction first
+ * Close every cursor of the connection before.
+ * \param conn pointer to the current connection
+ */
+void disconnect(DBCONN *conn);
+
+/**
+ * Sets how inserts are grouped into transactions (default DB_BATCH_ROWS / DB_BATCH_MS).
+ * batch_rows = 1 commits every row on its own.
+ * \param batch_rows rows per transaction, at least 1
+ * \param batch_ms commit an open transaction once it is this old, 0 = only when full
+ * \return zero for success, non-zero if the open transaction could not be committed
+ */
+int sensor_db_set_batch(DBCONN *conn, size_t batch_rows, int batch_ms);
+
+/**
+ * Sets how long a statement waits for another process's lock before failing
+ * (5000 ms after init_connection())
+ */
+void sensor_db_set_busy_timeout(DBCONN *conn, int ms);
+
+/**
+ * Commits the open insert transaction, if any. A writer that goes idle calls it,
+ * as the 'batch_ms' limit is only checked by the next insert.
+ * \return zero for success, non-zero if the commit failed and the open rows were discarded
+ */
+int sensor_db_flush(DBCONN *conn);
+
+/**
+ * Insert one reading (sensor_id, room_id, value, timestamp, seq) into the open batch
+ * (see sensor_db_set_batch). Its source is the sender run (reading->epoch); only a
+ * replay, stored before with the same sensor_id, timestamp, epoch and seq, is skipped.
+ * \param conn pointer to the current connection
+ * \param reading the reading
+ * \return zero when the row joined the open transaction (durable once it commits),
+ *         non-zero if an error occurs; the open transaction is then rolled back and
+ *         its rows accepted so far are counted in 'discarded'
+ */
+int insert_reading(DBCONN *conn, const sensor_data_t *reading);
+
+/**
+ * Insert a single sensor measurement into the open batch (see sensor_db_set_batch),
+ * with room_id 0 and the connection's next seq; the source is a random id of the
+ * connection, so the rows of other connections and writers are never taken for replays.
+ * The row is durable once its transaction commits; when an insert or commit fails
+ * the rows of that transaction are rolled back and counted in 'discarded'.
+ * \param conn pointer to the current connection
+ * \param id the sensor id
+ * \param value the measurement value
+ * \param ts the measurement timestamp
+ * \return zero for success, and non-zero if an error occurs
+ */
+int insert_sensor(DBCONN *conn, sensor_id_t id, sensor_value_t value, sensor_ts_t ts);
+
+/**
+ * Insert all sensor measurements available in the file 'sensor_data', in batches; commits before returning
+ * Each row's seq is its position in the file and its source a hash of the record, so a
+ * file imported twice is stored once while a different record is never skipped.
+ * Reads in chunks and stores them like sensor_db_import_file(), with room_id 0.
+ * \param conn pointer to the current connection
+ * \param sensor_data a file pointer to binary file containing sensor data
+ * \return zero for success, and non-zero if an error occurs
+ */
+int insert_sensor_from_file(DBCONN *conn, FILE *sensor_data);
+
+/**
+ * Bulk-loads a sensor_data file: the file is mapped (read in chunks when it is not a
+ * regular file), decoded and validated a chunk at a time, and stored through a
+ * multi-row INSERT in transactions of many thousand rows.
+ * Each row's seq is its record index and its source a hash of the record, so importing
+ * a file again stores nothing new, while a different record is never taken for a stored one.
+ * \param conn pointer to the current connection
+ * \param path the sensor_data file, "-" for standard input
+ * \param rooms room of every sensor_id (65536 entries, indexed by sensor_id), NULL stores room_id 0
+ * \param progress called after every chunk, may be NULL
+ * \param context passed to 'progress'
+ * \param stats receives the final counts, may be NULL
+ * \return zero for success, and non-zero if an error occurs; transactions committed
+ * before the error stay stored
+ */
+int sensor_db_import_file(DBCONN *conn, const char *path, const uint16_t *rooms, sensor_db_progress_t progress,
+                          void *context, sensor_db_import_stats_t *stats);
+
+/**
+ *insert data from sbuffer into database, in batches; commits before returning
+ *if fail, return -1;
+ *\param conn pointer to the current connection
+ *\param sbuffer pointer to the sbuffer
+ */
+int insert_from_sbuffer(DBCONN *conn, sbuffer_t* sbuffer);
+
+/**
+ * Starts a query through prepared statements; nothing is converted to text.
+ * Only partitions that overlap the query's time range are read. Each connection
+ * caches statements per query type and partition; a cursor that finds its statement
+ * in use by another cursor prepares its own.
+ * \param conn pointer to the current connection
+ * \param cursor the cursor to start
+ * \param query what to select, see sensor_db_query_t
+ * \param id sensor or room id (SENSOR_RANGE / ROOM_RANGE)
+ * \param value value bound (VALUE_EQ / VALUE_GT)
+ * \param from timestamp, or first timestamp of a range
+ * \param to last timestamp of a range (SENSOR_RANGE / ROOM_RANGE / TS_RANGE)
+ * \return zero for success, and non-zero if an error occurs
+ */
+int sensor_db_cursor_open(DBCONN *conn, sensor_db_cursor_t *cursor, sensor_db_query_t query, uint16_t id,
+                          sensor_value_t value, sensor_ts_t from, sensor_ts_t to);
+
+/**
+ * Fetches the next rows of the cursor. Only sensor_id, room_id, value, timestamp
+ * and seq are filled in; the other fields of sensor_data_t are zero.
+ * \param rows receives up to 'max_rows' readings
+ * \return the number of rows stored (fewer than 'max_rows' only at the end, 0 once exhausted),
+ * -1 if an error occurs
+ */
+ssize_t sensor_db_cursor_next(sensor_db_cursor_t *cursor, sensor_data_t *rows, size_t max_rows);
+
+/**
+ * Ends the query, also before its last row, and releases its read snapshot
+ */
+void sensor_db_cursor_close(sensor_db_cursor_t *cursor);
+
+/**
+  * Write a SELECT query to select all sensor measurements in the table 
+  * The callback function is applied to every row in the result, as text columns in
+  * SENSOR_DB_COLUMNS order; sensor_db_cursor_open() returns the same rows without the conversion
+  * \param conn pointer to the current connection
+  * \param f function pointer to the callback method that will handle the result set
+  * \return zero for success, and non-zero if an error occurs
+  */
+int find_sensor_all(DBCONN *conn, callback_t f);
+
+/**
+ * Write a SELECT query to return all sensor measurements having a temperature of 'value'
+ * (values are not indexed: this scans the table)
+ * The callback function is applied to every row in the result
+ * \param conn pointer to the current connection
+ * \param value the value to be queried
+ * \param f function pointer to the callback method that will handle the result set
+ * \return zero for success, and non-zero if an error occurs
+ */
+int find_sensor_by_value(DBCONN *conn, sensor_value_t value, callback_t f);
+
+/**
+ * Write a SELECT query to return all sensor measurements of which the temperature exceeds 'value'
+ * (values are not indexed: this scans the table)
+ * The callback function is applied to every row in the result
+ * \param conn pointer to the current connection
+ * \param value the value to be queried
+ * \param f function pointer to the callback method that will handle the result set
+ * \return zero for success, and non-zero if an error occurs
+ */
+int find_sensor_exceed_value(DBCONN *conn, sensor_value_t value, callback_t f);
+
+/**
+ * Write a SELECT query to return all sensor measurements having a timestamp 'ts'
+ * The callback function is applied to every row in the result
+ * \param conn pointer to the current connection
+ * \param ts the timestamp to be queried
+ * \param f function pointer to the callback method that will handle the result set
+ * \return zero for success, and non-zero if an error occurs
+ */
+int find_sensor_by_timestamp(DBCONN *conn, sensor_ts_t ts, callback_t f);
+
+/**
+ * Write a SELECT query to return all sensor measurements recorded after timestamp 'ts', in time order
+ * The callback function is applied to every row in the result
+ * \param conn pointer to the current connection
+ * \param ts the timestamp to be queried
+ * \param f function pointer to the callback method that will handle the result set
+ * \return zero for success, and non-zero if an error occurs
+ */
+int find_sensor_after_timestamp(DBCONN *conn, sensor_ts_t ts, callback_t f);
+
+/**
+ * Write a SELECT query to return the measurements of one sensor with a timestamp in [from, to],
+ * in time order; served from the clustered key
+ * The callback function is applied to every row in the result
+ * \param conn pointer to the current connection
+ * \param id the sensor id
+ * \param from first timestamp to include
+ * \param to last timestamp to include
+ * \param f function pointer to the callback method that will handle the result set
+ * \return zero for success, and non-zero if an error occurs
+ */
+int find_sensor_in_range(DBCONN *conn, sensor_id_t id, sensor_ts_t from, sensor_ts_t to, callback_t f);
+
+/**
+ * Write a SELECT query to return the measurements of one room with a timestamp in [from, to],
+ * in time order; served from the room index
+ * The callback function is applied to every row in the result
+ * \param conn pointer to the current connection
+ * \param room_id the room id
+ * \param from first timestamp to include
+ * \param to last timestamp to include
+ * \param f function pointer to the callback method that will handle the result set
+ * \return zero for success, and non-zero if an error occurs
+ */
+int find_room_in_range(DBCONN *conn, uint16_t room_id, sensor_ts_t from, sensor_ts_t to, callback_t f);
+
+/**
+ * Stores closed rollup windows in one transaction.
+ * A window that already exists (e.g. re-opened after a restart) is merged into the stored row.
+ * \param conn pointer to the current connection
+ * \param rows the closed windows
+ * \param count number of rows
+ * \return zero for success, non-zero if an error occurs (nothing is stored, the rows can be retried)
+ */
+int insert_rollups(DBCONN *conn, const rollup_record_t *rows, size_t count);
+
+/**
+ * Write a SELECT query to return the rollup windows of one sensor at one resolution
+ * whose start lies in [from, to]
+ * The callback function is applied to every row in the result
+ * \param conn pointer to the current connection
+ * \param id the sensor id
+ * \param resolution window length in seconds (1, 60 or 3600)
+ * \param from first window start to include
+ * \param to last window start to include
+ * \param f function pointer to the callback method that will handle the result set
+ * \return zero for success, and non-zero if an error occurs
+ */
+int find_rollups(DBCONN *conn, sensor_id_t id, int resolution, sensor_ts_t from, sensor_ts_t to, callback_t f);
+
+#endif /* _SENSOR_DB_H_ */
@@ -0,0 +1,124 @@
+/**
+ * \author Yongkai Zhang
+ *
+ * Bulk-loads sensor_data files (file_creator format) into Sensor.db, with the
+ * room of every sensor taken from room_sensor.map.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sensor_db.h"
+
+#define IMPORT_PROGRESS_MS 1000     // minimum time between progress lines
+
+typedef struct {
+    const char *map_path;       /**< NULL = store room_id 0 */
+    bool clear;
+    bool quiet;
+    const char *path;
+} import_options_t;
+
+typedef struct {
+    double last_report_ms;
+} progress_state_t;
+
+static uint16_t rooms[65536];
+
+static void print_usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [--map=FILE|--no-map] [--clear] [--quiet] [file|-]\n", program);
+    fprintf(stderr, "  file defaults to sensor_data; rooms come from room_sensor.map unless --no-map\n");
+}
+
+static int parse_args(int argc, char *argv[], import_options_t *options)
+{
+    options->map_path = "room_sensor.map";
+    options->clear = false;
+    options->quiet = false;
+    options->path = "sensor_data";
+
+    for (int index = 1; index < argc; index++) {
+        const char *arg = argv[index];
+
+        if (strncmp(arg, "--map=", 6) == 0 && arg[6] != '\0') {
+            options->map_path = arg + 6;
+        } else if (strcmp(arg, "--no-map") == 0) {
+            options->map_path = NULL;
+        } else if (strcmp(arg, "--clear") == 0) {
+            options->clear = true;
+        } else if (strcmp(arg, "--quiet") == 0) {
+            options->quiet = true;
+        } else if (arg[0] == '-' && arg[1] != '\0') {
+            return -1;
+        } else {
+            options->path = arg;
+        }
+    }
+    return 0;
+}
+
+static int load_rooms(const char *path)
+{
+    unsigned int room_id;
+    unsigned int sensor_id;
+    FILE *map_file = fopen(path, "r");
+
+    if (map_file == NULL) {
+        perror(path);
+        return -1;
+    }
+    while (fscanf(map_file, "%u %u", &room_id, &sensor_id) == 2) {
+        if (room_id > UINT16_MAX || sensor_id > UINT16_MAX) continue;
+        rooms[sensor_id] = (uint16_t)room_id;
+    }
+    fclose(map_file);
+    return 0;
+}
+
+static double records_per_second(const sensor_db_import_stats_t *stats)
+{
+    return stats->elapsed_ms > 0 ? (double)stats->records * 1000.0 / stats->elapsed_ms : 0.0;
+}
+
+static void report_progress(const sensor_db_import_stats_t *stats, void *context)
+{
+    progress_state_t *state = context;
+
+    if (stats->elapsed_ms - state->last_report_ms < IMPORT_PROGRESS_MS) return;
+    state->last_report_ms = stats->elapsed_ms;
+    fprintf(stderr, "IMPORT done=%.1f%% records=%llu stored=%llu invalid=%llu records_per_s=%.0f\n",
+            stats->bytes_total == 0 ? 0.0 : (double)stats->bytes_done * 100.0 / (double)stats->bytes_total,
+            stats->records, stats->stored, stats->invalid, records_per_second(stats));
+}
+
+int main(int argc, char *argv[])
+{
+    import_options_t options;
+    progress_state_t progress = { 0 };
+    sensor_db_import_stats_t stats;
+    DBCONN *conn;
+    int rc;
+
+    if (parse_args(argc, argv, &options) != 0) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (options.map_path != NULL && load_rooms(options.map_path) != 0) return EXIT_FAILURE;
+
+    conn = init_connection(options.clear ? "1" : "0");
+    if (conn == NULL) return EXIT_FAILURE;
+    rc = sensor_db_import_file(conn, options.path, options.map_path == NULL ? NULL : rooms,
+                               options.quiet ? NULL : report_progress, &progress, &stats);
+    disconnect(conn);
+
+    printf("IMPORT_SUMMARY file=%s records=%llu stored=%llu invalid=%llu truncated_bytes=%llu seconds=%.2f "
+           "records_per_s=%.0f status=%s\n",
+           options.path, stats.records, stats.stored, stats.invalid, stats.truncated, stats.elapsed_ms / 1000.0,
+           records_per_second(&stats), rc == 0 ? "OK" : "FAILED");
+    return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
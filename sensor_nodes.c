@@ -2,6 +2,8 @@
  * \author Luc Vandeurzen
  */
 
+#define _XOPEN_SOURCE 700 // drand48, nanosleep
+
 #include <inttypes.h>
 #include <errno.h>
 #include <arpa/inet.h>
@@ -133,6 +135,9 @@ int main(int argc, char *argv[])
          ^ ((long)data.sensor_id << 16)
          ^ (long)data.room_id;
     srand48(seed);
+    /* A new epoch tells the gateway that numbering restarts at 0; replays keep their old one. */
+    data.epoch = (uint32_t)mrand48();
+    data.seq = 0;
 
     if (tcp_active_open(&client, server_port, server_ip) != TCP_NO_ERROR) {
         fprintf(
@@ -230,9 +235,38 @@ int main(int argc, char *argv[])
             return EXIT_FAILURE;
         }
 
+        bytes = sizeof(data.seq);
+        if (tcp_send(client, &data.seq, &bytes) != TCP_NO_ERROR) {
+            fprintf(
+                stderr,
+                "sender stopped: room=%hu sensor=%hu field=seq send failed "
+                "(receiver may close invalid pair)\n",
+                data.room_id,
+                data.sensor_id
+            );
+            tcp_close(&client);
+            LOG_CLOSE();
+            return EXIT_FAILURE;
+        }
+
+        bytes = sizeof(data.epoch);
+        if (tcp_send(client, &data.epoch, &bytes) != TCP_NO_ERROR) {
+            fprintf(
+                stderr,
+                "sender stopped: room=%hu sensor=%hu field=epoch send failed "
+                "(receiver may close invalid pair)\n",
+                data.room_id,
+                data.sensor_id
+            );
+            tcp_close(&client);
+            LOG_CLOSE();
+            return EXIT_FAILURE;
+        }
+
         LOG_PRINTF(data.sensor_id, data.value, data.timestamp);
         sleep_for_seconds(sleep_time);
         sent_count++;
+        data.seq++;     // the gateway drops readings whose sequence number it has seen
     }
 
     if (configured_loops == 0) {
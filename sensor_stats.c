@@ -0,0 +1,112 @@
+/**
+ * \author Yongkai Zhang
+ */
+
+#include <string.h>
+#include "config.h"
+#include "sensor_stats.h"
+
+static int bucket_of(sensor_value_t value)
+{
+    double position = (value - STATS_SKETCH_MIN) / STATS_SKETCH_WIDTH;
+
+    if (!(position >= 0)) return 0;     /* also catches NaN */
+    if (position >= STATS_SKETCH_BUCKETS) return STATS_SKETCH_BUCKETS - 1;
+    return (int)position;
+}
+
+void stats_reset(sensor_stats_t *stats, bool keep_ewma)
+{
+    double ewma = stats->ewma;
+    bool has_ewma = stats->has_ewma;
+
+    memset(stats, 0, sizeof(*stats));
+    if (keep_ewma) {
+        stats->ewma = ewma;
+        stats->has_ewma = has_ewma;
+    }
+}
+
+void stats_update(sensor_stats_t *stats, sensor_value_t value)
+{
+    double delta;
+
+    if (stats->count == 0) {
+        stats->min = value;
+        stats->max = value;
+    } else {
+        if (value < stats->min) stats->min = value;
+        if (value > stats->max) stats->max = value;
+    }
+    if (stats->has_ewma) {
+        stats->ewma += STATS_EWMA_ALPHA * (value - stats->ewma);
+    } else {
+        stats->ewma = value;
+        stats->has_ewma = true;
+    }
+
+    stats->count++;
+    delta = value - stats->mean;
+    stats->mean += delta / (double)stats->count;
+    stats->m2 += delta * (value - stats->mean);
+
+    stats->buckets[bucket_of(value)]++;
+}
+
+void stats_merge(sensor_stats_t *dst, const sensor_stats_t *src)
+{
+    double delta;
+    double total;
+
+    if (src->count == 0) return;
+    if (dst->count == 0) {
+        *dst = *src;
+        return;
+    }
+
+    total = (double)dst->count + (double)src->count;
+    delta = src->mean - dst->mean;
+    dst->m2 += src->m2 + delta * delta * (double)dst->count * (double)src->count / total;
+    dst->mean += delta * (double)src->count / total;
+    dst->ewma = (dst->ewma * (double)dst->count + src->ewma * (double)src->count) / total;
+    dst->count += src->count;
+    if (src->min < dst->min) dst->min = src->min;
+    if (src->max > dst->max) dst->max = src->max;
+    for (int index = 0; index < STATS_SKETCH_BUCKETS; index++) {
+        dst->buckets[index] += src->buckets[index];
+    }
+}
+
+double stats_variance(const sensor_stats_t *stats)
+{
+    if (stats->count < 2) return 0;
+    return stats->m2 / (double)(stats->count - 1);
+}
+
+double stats_quantile(const sensor_stats_t *stats, double q)
+{
+    double rank;
+    double seen = 0;
+    double estimate = stats->max;
+
+    if (stats->count == 0) return 0;
+    if (q <= 0) return stats->min;
+    if (q >= 1) return stats->max;
+
+    rank = q * (double)stats->count;
+    for (int index = 0; index < STATS_SKETCH_BUCKETS; index++) {
+        double in_bucket = stats->buckets[index];
+
+        if (in_bucket > 0 && seen + in_bucket >= rank) {
+            double fraction = (rank - seen) / in_bucket;
+
+            estimate = STATS_SKETCH_MIN + ((double)index + fraction) * STATS_SKETCH_WIDTH;
+            break;
+        }
+        seen += in_bucket;
+    }
+
+    if (estimate < stats->min) return stats->min;
+    if (estimate > stats->max) return stats->max;
+    return estimate;
+}
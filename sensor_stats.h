@@ -0,0 +1,64 @@
+/**
+ * \author Yongkai Zhang
+ */
+
+#ifndef _SENSOR_STATS_H_
+#define _SENSOR_STATS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "config.h"
+
+#define STATS_SKETCH_BUCKETS 256
+#define STATS_SKETCH_MIN (-40.0)    // lower edge of the first bucket (degrees)
+#define STATS_SKETCH_WIDTH 0.5      // bucket width: the sketch covers -40 .. 88 degrees
+#ifndef STATS_EWMA_ALPHA
+#define STATS_EWMA_ALPHA 0.1
+#endif
+
+/**
+ * Constant-size streaming statistics of one sensor.
+ * count/mean/m2 follow Welford; the bucket histogram is the quantile sketch,
+ * and two sketches merge by adding buckets (used to combine sensors or shards).
+ * Values outside the sketch range are clamped into the edge buckets.
+ */
+typedef struct {
+    uint64_t count;
+    double mean;
+    double m2;                  /**< sum of squared deviations from the mean */
+    double min;
+    double max;
+    double ewma;
+    bool has_ewma;              /**< the EWMA survives interval resets */
+    uint32_t buckets[STATS_SKETCH_BUCKETS];
+} sensor_stats_t;
+
+/**
+ * Clears all statistics; the EWMA is kept unless 'keep_ewma' is false
+ */
+void stats_reset(sensor_stats_t *stats, bool keep_ewma);
+
+/**
+ * Adds one sample in O(1)
+ */
+void stats_update(sensor_stats_t *stats, sensor_value_t value);
+
+/**
+ * Merges 'src' into 'dst' (Chan et al. for mean/variance, bucket sum for the sketch).
+ * The merged EWMA is the count-weighted mean of both EWMAs.
+ */
+void stats_merge(sensor_stats_t *dst, const sensor_stats_t *src);
+
+/**
+ * \return the sample variance, 0 with fewer than 2 samples
+ */
+double stats_variance(const sensor_stats_t *stats);
+
+/**
+ * Estimates a quantile from the sketch, interpolating inside the bucket
+ * \param q quantile in [0, 1]
+ * \return the estimate, clamped to [min, max]; 0 when there are no samples
+ */
+double stats_quantile(const sensor_stats_t *stats, double q);
+
+#endif /* _SENSOR_STATS_H_ */
@@ -0,0 +1,219 @@
+/**
+ * \author Yongkai Zhang
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "sensor_table.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static size_t align_up(size_t size)
+{
+    return (size + SENSOR_TABLE_ALIGN - 1) & ~(size_t)(SENSOR_TABLE_ALIGN - 1);
+}
+
+/* Reserves one column in the arena and advances 'offset' past it. */
+static void *carve_column(unsigned char *arena, size_t *offset, size_t size)
+{
+    void *column = arena == NULL ? NULL : arena + *offset;
+
+    *offset += align_up(size);
+    return column;
+}
+
+static size_t layout_columns(sensor_table_t *table, unsigned char *arena)
+{
+    size_t offset = 0;
+    size_t n = table->capacity;
+
+    table->sensor_ids = carve_column(arena, &offset, n * sizeof(*table->sensor_ids));
+    table->room_ids = carve_column(arena, &offset, n * sizeof(*table->room_ids));
+    table->sums = carve_column(arena, &offset, n * sizeof(*table->sums));
+    table->compensations = carve_column(arena, &offset, n * sizeof(*table->compensations));
+    table->averages = carve_column(arena, &offset, n * sizeof(*table->averages));
+    table->last_values = carve_column(arena, &offset, n * sizeof(*table->last_values));
+    table->last_timestamps = carve_column(arena, &offset, n * sizeof(*table->last_timestamps));
+    table->sample_counts = carve_column(arena, &offset, n * sizeof(*table->sample_counts));
+    table->window_heads = carve_column(arena, &offset, n * sizeof(*table->window_heads));
+    table->alert_states = carve_column(arena, &offset, n * sizeof(*table->alert_states));
+    table->min_temps = carve_column(arena, &offset, n * sizeof(*table->min_temps));
+    table->max_temps = carve_column(arena, &offset, n * sizeof(*table->max_temps));
+    table->clear_min_temps = carve_column(arena, &offset, n * sizeof(*table->clear_min_temps));
+    table->clear_max_temps = carve_column(arena, &offset, n * sizeof(*table->clear_max_temps));
+    table->samples = carve_column(arena, &offset, n * table->window * sizeof(*table->samples));
+    return offset;
+}
+
+int sensor_table_init(sensor_table_t *table, size_t capacity, size_t window)
+{
+    if (table == NULL || window == 0) return -1;
+
+    memset(table, 0, sizeof(*table));
+    table->capacity = capacity == 0 ? 1 : capacity;
+    table->window = window;
+    table->arena_size = layout_columns(table, NULL);
+
+    table->slots = calloc(SENSOR_ID_SPACE, sizeof(*table->slots));
+    table->arena = aligned_alloc(SENSOR_TABLE_ALIGN, table->arena_size);
+    if (table->slots == NULL || table->arena == NULL) {
+        sensor_table_free(table);
+        return -1;
+    }
+    memset(table->arena, 0, table->arena_size);
+    layout_columns(table, table->arena);
+    return 0;
+}
+
+void sensor_table_free(sensor_table_t *table)
+{
+    if (table == NULL) return;
+    free(table->slots);
+    if (!table->arena_mapped) {
+        free(table->arena);
+    }
+    memset(table, 0, sizeof(*table));
+}
+
+int sensor_table_add(sensor_table_t *table, sensor_id_t sensor_id, uint16_t room_id)
+{
+    size_t slot;
+
+    if (table->slots[sensor_id] != 0) return (int)table->slots[sensor_id] - 1;
+    if (table->count == table->capacity) return -1;
+
+    slot = table->count++;
+    table->sensor_ids[slot] = sensor_id;
+    table->room_ids[slot] = room_id;
+    table->slots[sensor_id] = (uint32_t)table->count;
+    sensor_table_set_thresholds(table, (int)slot, (double)SET_MIN_TEMP, (double)SET_MAX_TEMP, 0);
+    return (int)slot;
+}
+
+void sensor_table_set_thresholds(sensor_table_t *table, int slot, double min_temp, double max_temp,
+                                 double hysteresis)
+{
+    table->min_temps[slot] = min_temp;
+    table->max_temps[slot] = max_temp;
+    table->clear_min_temps[slot] = min_temp + hysteresis;
+    table->clear_max_temps[slot] = max_temp - hysteresis;
+}
+
+void sensor_table_move_arena(sensor_table_t *table, void *arena, bool keep_contents)
+{
+    if (!keep_contents) {
+        memcpy(arena, table->arena, table->arena_size);
+    }
+    if (!table->arena_mapped) {
+        free(table->arena);
+    }
+    table->arena = arena;
+    table->arena_mapped = true;
+    layout_columns(table, arena);
+}
+
+static void compensated_add(double *sum, double *compensation, double value)
+{
+    double total = *sum + value;
+
+    if (fabs(*sum) >= fabs(value)) {
+        *compensation += (*sum - total) + value;
+    } else {
+        *compensation += (value - total) + *sum;
+    }
+    *sum = total;
+}
+
+void sensor_table_push_sample(sensor_table_t *table, int slot, sensor_value_t value, sensor_ts_t ts,
+                              double *sum_out, double *size_out)
+{
+    double *ring = &table->samples[(size_t)slot * table->window];
+    uint32_t head = table->window_heads[slot];
+    uint64_t count;
+
+    /* Ring buffer: once full, the slot at 'head' holds the oldest sample. */
+    if (table->sample_counts[slot] >= table->window) {
+        compensated_add(&table->sums[slot], &table->compensations[slot], -ring[head]);
+    }
+    ring[head] = value;
+    compensated_add(&table->sums[slot], &table->compensations[slot], value);
+    table->window_heads[slot] = (head + 1 == table->window) ? 0 : head + 1;
+    count = ++table->sample_counts[slot];
+    table->last_values[slot] = value;
+    table->last_timestamps[slot] = ts;
+
+    *sum_out = table->sums[slot] + table->compensations[slot];
+    *size_out = (double)(count < table->window ? count : table->window);
+}
+
+void sensor_table_rebuild_sums(sensor_table_t *table)
+{
+    for (size_t slot = 0; slot < table->count; slot++) {
+        const double *ring = &table->samples[slot * table->window];
+        uint64_t count = table->sample_counts[slot];
+        size_t size = count < table->window ? (size_t)count : table->window;
+
+        /* Until the ring is full its samples occupy the slots before 'head'. */
+        table->sums[slot] = 0;
+        table->compensations[slot] = 0;
+        if (table->window_heads[slot] >= table->window) {
+            table->window_heads[slot] = 0;
+        }
+        for (size_t index = 0; index < size; index++) {
+            compensated_add(&table->sums[slot], &table->compensations[slot], ring[index]);
+        }
+        table->averages[slot] = size == 0 ? 0 : (table->sums[slot] + table->compensations[slot]) / (double)size;
+    }
+}
+
+void sensor_table_batch_average(const double *sums, const double *sizes, double *averages, size_t n)
+{
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    for (; i + 2 <= n; i += 2) {
+        __m128d sum = _mm_loadu_pd(&sums[i]);
+        __m128d size = _mm_loadu_pd(&sizes[i]);
+
+        _mm_storeu_pd(&averages[i], _mm_div_pd(sum, size));
+    }
+#endif
+    for (; i < n; i++) {
+        averages[i] = sums[i] / sizes[i];
+    }
+}
+
+void sensor_table_batch_classify(const double *averages, const double *ready,
+                                 const double *mins, const double *maxs, int8_t *states, size_t n)
+{
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128d one = _mm_set1_pd(1.0);
+
+    for (; i + 2 <= n; i += 2) {
+        __m128d average = _mm_loadu_pd(&averages[i]);
+        __m128d hot = _mm_and_pd(_mm_cmpgt_pd(average, _mm_loadu_pd(&maxs[i])), one);
+        __m128d cold = _mm_and_pd(_mm_cmplt_pd(average, _mm_loadu_pd(&mins[i])), one);
+        __m128d state = _mm_mul_pd(_mm_sub_pd(hot, cold), _mm_loadu_pd(&ready[i]));
+        __m128i packed = _mm_cvttpd_epi32(state);
+
+        states[i] = (int8_t)_mm_cvtsi128_si32(packed);
+        states[i + 1] = (int8_t)_mm_cvtsi128_si32(_mm_srli_si128(packed, 4));
+    }
+#endif
+    for (; i < n; i++) {
+        int8_t state = 0;
+
+        if (averages[i] < mins[i]) {
+            state = -1;
+        } else if (averages[i] > maxs[i]) {
+            state = 1;
+        }
+        states[i] = ready[i] != 0 ? state : 0;
+    }
+}
@@ -0,0 +1,115 @@
+/**
+ * \author Yongkai Zhang
+ */
+
+#ifndef _SENSOR_TABLE_H_
+#define _SENSOR_TABLE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "config.h"
+
+#define SENSOR_ID_SPACE 65536
+#define SENSOR_TABLE_ALIGN 64   // every column starts on its own cache line
+
+/**
+ * Per-sensor state of datamgr in structure-of-arrays layout.
+ * Slot i of every column belongs to the same sensor; slots follow map order.
+ * All columns live in one aligned arena so batch kernels can stream them.
+ */
+typedef struct {
+    size_t count;               /**< number of registered sensors */
+    size_t capacity;            /**< number of slots allocated in every column */
+    size_t window;              /**< samples per averaging ring */
+    uint32_t *slots;            /**< sensor_id -> slot + 1, 0 when the sensor is unknown */
+    sensor_id_t *sensor_ids;
+    uint16_t *room_ids;
+    double *sums;               /**< running sum of the ring */
+    double *compensations;      /**< Neumaier compensation of 'sums' */
+    double *averages;           /**< last computed running average */
+    double *last_values;
+    sensor_ts_t *last_timestamps;
+    uint64_t *sample_counts;
+    uint32_t *window_heads;     /**< ring slot that receives the next sample */
+    int8_t *alert_states;
+    double *min_temps;          /**< COLD below this */
+    double *max_temps;          /**< HOT above this */
+    double *clear_min_temps;    /**< COLD clears at or above this (min + hysteresis) */
+    double *clear_max_temps;    /**< HOT clears at or below this (max - hysteresis) */
+    double *samples;            /**< capacity * window ring storage */
+    void *arena;
+    size_t arena_size;
+    bool arena_mapped;          /**< arena lives in a checkpoint mapping and is not freed here */
+} sensor_table_t;
+
+/**
+ * Allocates a table for at most 'capacity' sensors with rings of 'window' samples
+ * \param table the table to initialise
+ * \param capacity maximum number of sensors
+ * \param window running average window length
+ * \return zero on success, -1 on allocation failure
+ */
+int sensor_table_init(sensor_table_t *table, size_t capacity, size_t window);
+
+/**
+ * Frees all memory owned by the table
+ */
+void sensor_table_free(sensor_table_t *table);
+
+/**
+ * Registers a sensor; a sensor that is already present keeps its first room
+ * \return the slot of the sensor, -1 when the table is full
+ */
+int sensor_table_add(sensor_table_t *table, sensor_id_t sensor_id, uint16_t room_id);
+
+/**
+ * Sets the alert band of 'slot'; new slots start with SET_MIN_TEMP/SET_MAX_TEMP and no hysteresis
+ */
+void sensor_table_set_thresholds(sensor_table_t *table, int slot, double min_temp, double max_temp,
+                                 double hysteresis);
+
+/**
+ * Moves every column into 'arena' (arena_size bytes, SENSOR_TABLE_ALIGN aligned,
+ * owned by the caller)
+ * \param keep_contents true: 'arena' already holds this table's columns (a restored
+ * snapshot); false: the current contents are copied into it
+ */
+void sensor_table_move_arena(sensor_table_t *table, void *arena, bool keep_contents);
+
+/**
+ * Recomputes every sum and average from the sample rings, e.g. after the arena
+ * was restored from a snapshot that may have been cut mid-update
+ */
+void sensor_table_rebuild_sums(sensor_table_t *table);
+
+/**
+ * \return the slot of 'sensor_id', -1 when it is not registered
+ */
+static inline int sensor_table_lookup(const sensor_table_t *table, sensor_id_t sensor_id)
+{
+    return (int)table->slots[sensor_id] - 1;
+}
+
+/**
+ * Pushes one sample into the ring of 'slot' (scalar, must follow arrival order)
+ * \param sum_out compensated window sum after the push
+ * \param size_out number of samples currently in the window
+ */
+void sensor_table_push_sample(sensor_table_t *table, int slot, sensor_value_t value, sensor_ts_t ts,
+                              double *sum_out, double *size_out);
+
+/**
+ * Batch kernel: averages[i] = sums[i] / sizes[i]
+ */
+void sensor_table_batch_average(const double *sums, const double *sizes, double *averages, size_t n);
+
+/**
+ * Batch kernel: states[i] = -1 when averages[i] < mins[i], 1 when > maxs[i], else 0.
+ * Readings with ready[i] == 0 (window not yet full) are always 0.
+ * Run once with the alert band and once with the clear band to apply hysteresis.
+ */
+void sensor_table_batch_classify(const double *averages, const double *ready,
+                                 const double *mins, const double *maxs, int8_t *states, size_t n);
+
+#endif /* _SENSOR_TABLE_H_ */
@@ -0,0 +1,437 @@
+/**
+ * \author Yongkai Zhang
+ */
+
+#define _GNU_SOURCE     // F_SETPIPE_SZ
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "sensor_db.h"
+#include "storagemgr.h"
+#include "tsarchive.h"
+
+#define STORAGEMGR_READ_CHUNK 256           // records per read()
+#define STORAGEMGR_IDLE_TICK_MS 1000
+#define STORAGEMGR_RETENTION_CHECK_MS 60000 // how often expired partitions are looked for
+#define STORAGEMGR_ARCHIVE_STEP_ROWS 4096   // readings archived between two group commits
+#define LATENCY_BUCKETS 32                  // bucket i: latencies below 2^i microseconds
+
+/* Log2 histogram of latencies; constant memory, mergeable, good to a factor of two. */
+typedef struct {
+    uint64_t count;
+    double total_ms;
+    double max_ms;
+    uint64_t buckets[LATENCY_BUCKETS];
+} latency_stats_t;
+
+typedef struct {
+    uint64_t rows;              /**< readings committed */
+    uint64_t failed;            /**< readings lost to a failed insert or commit */
+    uint64_t commits;
+    size_t queue_max;
+    latency_stats_t commit;     /**< duration of one group commit */
+    latency_stats_t latency;    /**< arrival in the storage manager -> committed, per reading */
+} storage_metrics_t;
+
+static size_t commit_rows = STORAGE_COMMIT_ROWS;
+static int commit_ms = STORAGE_COMMIT_MS;
+static int report_interval = STATS_SUMMARY_INTERVAL;
+static sensor_ts_t retention_seconds = (sensor_ts_t)DB_RETENTION_HOURS * 3600;
+static const char *archive_path = DB_ARCHIVE_FILE;
+
+/* Archive that receives the partitions dropped by retention, opened on first use. */
+static tsarchive_writer_t archive;
+static bool archive_open = false;
+static bool archive_failed = false;
+static unsigned long long archive_committed = 0; // archive.points when the last partition was committed
+static unsigned long long archive_reported = 0;  // archive_committed in the last RETENTION line
+
+/* Partition being archived step by step, and the cursor that resumes it. */
+static sensor_db_cursor_t archive_cursor;
+static bool archive_cursor_open = false;
+static sensor_ts_t archive_start;
+
+/* Ring of queued readings and their arrival times. */
+static sensor_data_t queue[STORAGEMGR_QUEUE_CAPACITY];
+static double queued_at[STORAGEMGR_QUEUE_CAPACITY];
+static size_t queue_head = 0;
+static size_t queue_count = 0;
+
+int storagemgr_open_pipe(int fds[2])
+{
+    int flags;
+
+    if (pipe(fds) != 0) return -1;
+#ifdef F_SETPIPE_SZ
+    (void)fcntl(fds[1], F_SETPIPE_SZ, STORAGEMGR_PIPE_SIZE);
+#endif
+    flags = fcntl(fds[1], F_GETFL, 0);
+    if (flags < 0 || fcntl(fds[1], F_SETFL, flags | O_NONBLOCK) != 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    return 0;
+}
+
+void storagemgr_set_commit_policy(size_t rows, int ms)
+{
+    commit_rows = rows == 0 ? 1 : (rows > STORAGEMGR_QUEUE_CAPACITY ? STORAGEMGR_QUEUE_CAPACITY : rows);
+    commit_ms = ms < 0 ? 0 : ms;
+}
+
+void storagemgr_set_report_interval(int seconds)
+{
+    report_interval = seconds < 0 ? 0 : seconds;
+}
+
+void storagemgr_set_retention(sensor_ts_t seconds)
+{
+    retention_seconds = seconds < 0 ? 0 : seconds;
+}
+
+void storagemgr_set_archive(const char *path)
+{
+    archive_path = path != NULL && path[0] != '\0' ? path : NULL;
+}
+
+static double monotonic_ms(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1000.0 + (double)now.tv_nsec / 1e6;
+}
+
+static void latency_add(latency_stats_t *stats, double ms)
+{
+    uint64_t micros = ms <= 0 ? 0 : (uint64_t)(ms * 1000.0);
+    int bucket = 0;
+
+    while (bucket < LATENCY_BUCKETS - 1 && micros >= ((uint64_t)1 << bucket)) bucket++;
+    stats->buckets[bucket]++;
+    stats->count++;
+    stats->total_ms += ms;
+    if (ms > stats->max_ms) stats->max_ms = ms;
+}
+
+static void latency_merge(latency_stats_t *dst, const latency_stats_t *src)
+{
+    dst->count += src->count;
+    dst->total_ms += src->total_ms;
+    if (src->max_ms > dst->max_ms) dst->max_ms = src->max_ms;
+    for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+        dst->buckets[bucket] += src->buckets[bucket];
+    }
+}
+
+/* Upper edge of the bucket holding quantile 'q', in milliseconds. */
+static double latency_quantile(const latency_stats_t *stats, double q)
+{
+    uint64_t rank = (uint64_t)(q * (double)stats->count);
+    uint64_t seen = 0;
+
+    if (stats->count == 0) return 0;
+    for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+        seen += stats->buckets[bucket];
+        if (seen > rank) {
+            double edge = (double)((uint64_t)1 << bucket) / 1000.0;
+
+            return edge < stats->max_ms ? edge : stats->max_ms;
+        }
+    }
+    return stats->max_ms;
+}
+
+static void metrics_merge(storage_metrics_t *dst, const storage_metrics_t *src)
+{
+    dst->rows += src->rows;
+    dst->failed += src->failed;
+    dst->commits += src->commits;
+    if (src->queue_max > dst->queue_max) dst->queue_max = src->queue_max;
+    latency_merge(&dst->commit, &src->commit);
+    latency_merge(&dst->latency, &src->latency);
+}
+
+static void append_log(const char *line, int length)
+{
+    int fd;
+
+    if (length <= 0) return;
+    /* One O_APPEND write per line, like the other processes sharing gateway.log. */
+    fd = open(FIFO_LOG, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) return;
+    if (write(fd, line, (size_t)length) < 0) {
+        perror("storagemgr: gateway.log");
+    }
+    close(fd);
+}
+
+static void write_report(const char *tag, const storage_metrics_t *metrics)
+{
+    char line[384];
+    int length;
+
+    length = snprintf(
+        line,
+        sizeof(line),
+        "%s rows=%llu failed=%llu commits=%llu queue=%zu queue_max=%zu commit_ms_avg=%.2f commit_ms_max=%.2f "
+        "latency_ms_avg=%.2f latency_ms_p50=%.2f latency_ms_p99=%.2f latency_ms_max=%.2f profile=%s\n",
+        tag,
+        (unsigned long long)metrics->rows,
+        (unsigned long long)metrics->failed,
+        (unsigned long long)metrics->commits,
+        queue_count,
+        metrics->queue_max,
+        metrics->commit.count == 0 ? 0.0 : metrics->commit.total_ms / (double)metrics->commit.count,
+        metrics->commit.max_ms,
+        metrics->latency.count == 0 ? 0.0 : metrics->latency.total_ms / (double)metrics->latency.count,
+        latency_quantile(&metrics->latency, 0.50),
+        latency_quantile(&metrics->latency, 0.99),
+        metrics->latency.max_ms,
+        sensor_db_get_profile()->name
+    );
+    append_log(line, length);
+}
+
+static void stop_archiving(void)
+{
+    if (!archive_cursor_open) return;
+    sensor_db_cursor_close(&archive_cursor);
+    archive_cursor_open = false;
+}
+
+/*
+ * Copies a partition into the archive before it is dropped, at most
+ * STORAGEMGR_ARCHIVE_STEP_ROWS readings per call, so group commits keep going
+ * while a large partition is archived. Before the first step the archive's
+ * committed length is stored as the partition's mark: a mark below the current
+ * length means a previous run committed the partition but stopped before the drop.
+ * \return zero once the partition is archived, non-zero keeps it (next step or failure)
+ */
+static int archive_partition(DBCONN *conn, sensor_ts_t start, sensor_ts_t end, int64_t mark, void *context)
+{
+    tsarchive_writer_t *writer = context;
+    sensor_data_t rows[STORAGEMGR_READ_CHUNK];
+    size_t budget = STORAGEMGR_ARCHIVE_STEP_ROWS;
+    ssize_t count = 0;
+    int rc = 0;
+
+    if (archive_cursor_open && archive_start != start) {
+        /* The writer holds uncommitted points of another partition. */
+        archive_failed = true;
+        return -1;
+    }
+    if (!archive_cursor_open) {
+        if (mark >= 0 && writer->header.data_bytes > (uint64_t)mark) return 0;
+        if (sensor_db_set_partition_mark(conn, start, (int64_t)writer->header.data_bytes) != 0 ||
+            sensor_db_cursor_open(conn, &archive_cursor, SENSOR_DB_QUERY_TS_RANGE, 0, 0, start, end - 1) != 0) {
+            archive_failed = true;
+            return -1;
+        }
+        archive_cursor_open = true;
+        archive_start = start;
+    }
+    while (rc == 0 && budget > 0 &&
+           (count = sensor_db_cursor_next(&archive_cursor, rows,
+                                          budget < STORAGEMGR_READ_CHUNK ? budget : STORAGEMGR_READ_CHUNK)) > 0) {
+        for (ssize_t index = 0; index < count && rc == 0; index++) {
+            rc = tsarchive_writer_append(writer, &rows[index]);
+        }
+        budget -= (size_t)count;
+    }
+    if (rc == 0 && count > 0) return 1;     // step done, the partition continues next time
+    stop_archiving();
+    /* The partition is only dropped once its blocks are committed. */
+    if (rc != 0 || count < 0 || tsarchive_writer_commit(writer) != 0) {
+        archive_failed = true;
+        return -1;
+    }
+    archive_committed = writer->points;
+    return 0;
+}
+
+/*
+ * Drops the partitions that ended more than retention_seconds ago, between two group
+ * commits, archiving each one first unless the archive is off. A partition being
+ * archived keeps it for the next call.
+ */
+static void apply_retention(DBCONN *conn)
+{
+    sensor_ts_t cutoff = time(NULL) - retention_seconds;
+    unsigned long long archived;
+    char line[192];
+    int dropped;
+
+    if (retention_seconds <= 0) return;
+    if (archive_path != NULL && !archive_open) {
+        if (tsarchive_writer_open(&archive, archive_path, 0) != 0) {
+            append_log(line, snprintf(line, sizeof(line), "RETENTION dropped=0 cutoff=%lld archived_points=0 "
+                                      "status=FAILED\n", (long long)cutoff));
+            return;
+        }
+        archive_open = true;
+        archive_committed = 0;
+        archive_reported = 0;
+    }
+    archive_failed = false;
+    dropped = sensor_db_drop_partitions(conn, cutoff, archive_open ? archive_partition : NULL, &archive);
+    if (dropped < 0) stop_archiving();
+    if (dropped == 0 && !archive_failed) return;
+    archived = archive_committed - archive_reported;
+    archive_reported = archive_committed;
+    if (archive_failed) {
+        /* Reopening cuts off the blocks of the partition that failed. */
+        stop_archiving();
+        tsarchive_writer_close(&archive);
+        archive_open = false;
+    }
+    append_log(line, snprintf(line, sizeof(line), "RETENTION dropped=%d cutoff=%lld archived_points=%llu status=%s\n",
+                              dropped < 0 ? 0 : dropped, (long long)cutoff, archived,
+                              dropped < 0 || archive_failed ? "FAILED" : "OK"));
+}
+
+/* Reads whatever the pipe holds, up to the free queue space. Returns 0 at EOF. */
+static int fill_queue(int input_fd, unsigned char *partial, size_t *partial_used, storage_metrics_t *metrics)
+{
+    sensor_data_t records[STORAGEMGR_READ_CHUNK];
+    double now = monotonic_ms();
+
+    while (queue_count < STORAGEMGR_QUEUE_CAPACITY) {
+        size_t room = STORAGEMGR_QUEUE_CAPACITY - queue_count;
+        size_t want = (room < STORAGEMGR_READ_CHUNK ? room : STORAGEMGR_READ_CHUNK) * sizeof(sensor_data_t);
+        unsigned char *bytes = (unsigned char *)records;
+        size_t count;
+        ssize_t rc;
+
+        memcpy(bytes, partial, *partial_used);
+        rc = read(input_fd, bytes + *partial_used, want - *partial_used);
+        if (rc == 0) return 0;
+        if (rc < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 1 : 0;
+        }
+        rc += (ssize_t)*partial_used;
+        count = (size_t)rc / sizeof(sensor_data_t);
+        *partial_used = (size_t)rc - count * sizeof(sensor_data_t);
+        memcpy(partial, bytes + count * sizeof(sensor_data_t), *partial_used);
+
+        for (size_t index = 0; index < count; index++) {
+            size_t tail = (queue_head + queue_count) % STORAGEMGR_QUEUE_CAPACITY;
+
+            queue[tail] = records[index];
+            queued_at[tail] = now;
+            queue_count++;
+        }
+        if (queue_count > metrics->queue_max) metrics->queue_max = queue_count;
+        if ((size_t)rc < want) return 1;    // pipe drained
+    }
+    return 1;
+}
+
+/* Stores up to commit_rows queued readings in one transaction. */
+static void commit_group(DBCONN *conn, storage_metrics_t *metrics)
+{
+    size_t group = queue_count < commit_rows ? queue_count : commit_rows;
+    double started;
+    double finished;
+    bool ok = true;
+
+    for (size_t index = 0; index < group && ok; index++) {
+        const sensor_data_t *reading = &queue[(queue_head + index) % STORAGEMGR_QUEUE_CAPACITY];
+
+        ok = insert_reading(conn, reading) == 0;
+    }
+    started = monotonic_ms();
+    ok = sensor_db_flush(conn) == 0 && ok;
+    finished = monotonic_ms();
+
+    latency_add(&metrics->commit, finished - started);
+    metrics->commits++;
+    if (ok) {
+        metrics->rows += group;
+        for (size_t index = 0; index < group; index++) {
+            latency_add(&metrics->latency, finished - queued_at[(queue_head + index) % STORAGEMGR_QUEUE_CAPACITY]);
+        }
+    } else {
+        metrics->failed += group;
+    }
+    queue_head = (queue_head + group) % STORAGEMGR_QUEUE_CAPACITY;
+    queue_count -= group;
+}
+
+int storagemgr_run(int input_fd)
+{
+    unsigned char partial[sizeof(sensor_data_t)];
+    size_t partial_used = 0;
+    storage_metrics_t interval = {0};
+    storage_metrics_t total = {0};
+    double last_report = monotonic_ms();
+    double last_retention = last_report;
+    bool input_open = true;
+    DBCONN *conn = init_connection(NULL);
+
+    if (conn == NULL) return -1;
+    /* Commits are driven from here, so the connection never commits on its own. */
+    sensor_db_set_batch(conn, SIZE_MAX, 0);
+    queue_head = 0;
+    queue_count = 0;
+    apply_retention(conn);
+    (void)fcntl(input_fd, F_SETFL, fcntl(input_fd, F_GETFL, 0) | O_NONBLOCK);
+
+    while (input_open || queue_count > 0) {
+        int timeout_ms = STORAGEMGR_IDLE_TICK_MS;
+        double now;
+
+        if (queue_count > 0) {
+            double waited = monotonic_ms() - queued_at[queue_head];
+
+            timeout_ms = waited >= commit_ms ? 0 : (int)(commit_ms - waited) + 1;
+        }
+        if (archive_cursor_open) timeout_ms = 0;    // keep archiving between group commits
+        if (input_open && queue_count < STORAGEMGR_QUEUE_CAPACITY) {
+            struct pollfd pfd = { .fd = input_fd, .events = POLLIN };
+
+            if (poll(&pfd, 1, timeout_ms) > 0) {
+                input_open = fill_queue(input_fd, partial, &partial_used, &interval) != 0;
+            }
+        }
+
+        /* Group commit: a full group, the oldest reading's deadline, or the end of input. */
+        now = monotonic_ms();
+        while (queue_count >= commit_rows ||
+               (queue_count > 0 && (!input_open || now - queued_at[queue_head] >= commit_ms))) {
+            commit_group(conn, &interval);
+            now = monotonic_ms();
+        }
+
+        if (archive_cursor_open || now - last_retention >= STORAGEMGR_RETENTION_CHECK_MS) {
+            apply_retention(conn);
+            last_retention = now;
+        }
+        if (report_interval > 0 && now - last_report >= report_interval * 1000.0) {
+            write_report("STORAGE", &interval);
+            metrics_merge(&total, &interval);
+            memset(&interval, 0, sizeof(interval));
+            last_report = now;
+        }
+    }
+
+    metrics_merge(&total, &interval);
+    write_report("STORAGE_SUMMARY", &total);
+    /* A partition archived only in part keeps its mark; the next run starts it over. */
+    stop_archiving();
+    if (archive_open) {
+        tsarchive_writer_close(&archive);
+        archive_open = false;
+    }
+    disconnect(conn);
+    return 0;
+}
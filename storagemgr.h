@@ -0,0 +1,55 @@
+/**
+ * \author Yongkai Zhang
+ */
+
+#ifndef _STORAGEMGR_H_
+#define _STORAGEMGR_H_
+
+#include <stddef.h>
+#include "config.h"
+
+#define STORAGEMGR_QUEUE_CAPACITY 65536     // readings held while a commit is in progress
+#define STORAGEMGR_PIPE_SIZE (1024 * 1024)  // requested pipe capacity (Linux), best effort
+
+/**
+ * Creates the pipe that feeds the storage manager. The write end is non-blocking:
+ * a writer that finds the pipe full drops the reading instead of waiting for the disk.
+ * \return zero on success, -1 on failure
+ */
+int storagemgr_open_pipe(int fds[2]);
+
+/**
+ * Sets the group commit policy: a transaction is committed once it holds
+ * 'rows' readings or its oldest reading waited 'ms' milliseconds
+ * (defaults STORAGE_COMMIT_ROWS / STORAGE_COMMIT_MS)
+ */
+void storagemgr_set_commit_policy(size_t rows, int ms);
+
+/**
+ * Sets how often a STORAGE line with interval metrics is appended to gateway.log
+ * \param seconds interval in seconds, 0 = only the STORAGE_SUMMARY line at exit
+ */
+void storagemgr_set_report_interval(int seconds);
+
+/**
+ * Sets how long readings are kept: every minute, partitions that ended more than
+ * 'seconds' ago are dropped and a RETENTION line is appended to gateway.log
+ * \param seconds retention in seconds, 0 = keep everything (default DB_RETENTION_HOURS)
+ */
+void storagemgr_set_retention(sensor_ts_t seconds);
+
+/**
+ * Sets the archive (see tsarchive.h) that receives every partition before retention
+ * drops it; a partition that cannot be archived is kept
+ * \param path archive file, NULL or "" = drop without archiving (default DB_ARCHIVE_FILE)
+ */
+void storagemgr_set_archive(const char *path);
+
+/**
+ * Reads sensor_data_t records from 'input_fd' until EOF and stores them in
+ * Sensor.db in group commits, queueing readings in memory while a commit runs.
+ * \return zero on success, -1 if the database cannot be opened
+ */
+int storagemgr_run(int input_fd);
+
+#endif /* _STORAGEMGR_H_ */
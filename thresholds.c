@@ -0,0 +1,134 @@
+/**
+ * \author Yongkai Zhang
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "thresholds.h"
+
+#define THRESHOLDS_LINE_MAX 256
+
+/* Parses "<min> <max> [hysteresis]"; returns the number of fields read. */
+static int parse_limits(const char *text, threshold_t *limits)
+{
+    int fields = sscanf(text, "%lf %lf %lf", &limits->min_temp, &limits->max_temp, &limits->hysteresis);
+
+    if (fields == 2) limits->hysteresis = 0;
+    return fields;
+}
+
+static int parse_rule(char *line, threshold_rule_t *rule)
+{
+    char scope[16];
+    unsigned int id;
+    int consumed = 0;
+
+    if (sscanf(line, "%15s%n", scope, &consumed) != 1) return -1;
+    line += consumed;
+
+    if (strcmp(scope, "default") == 0) {
+        rule->scope = THRESHOLD_SCOPE_DEFAULT;
+        rule->id = 0;
+    } else {
+        if (strcmp(scope, "room") == 0) {
+            rule->scope = THRESHOLD_SCOPE_ROOM;
+        } else if (strcmp(scope, "sensor") == 0) {
+            rule->scope = THRESHOLD_SCOPE_SENSOR;
+        } else {
+            return -1;
+        }
+        if (sscanf(line, "%u%n", &id, &consumed) != 1 || id > UINT16_MAX) return -1;
+        rule->id = (uint16_t)id;
+        line += consumed;
+    }
+
+    if (parse_limits(line, &rule->limits) < 2) return -1;
+    if (rule->limits.min_temp > rule->limits.max_temp || rule->limits.hysteresis < 0) return -1;
+    return 0;
+}
+
+int thresholds_load(const char *path, const threshold_t *fallback, thresholds_t *thresholds)
+{
+    FILE *file = fopen(path, "r");
+    char line[THRESHOLDS_LINE_MAX];
+    thresholds_t loaded = { *fallback, NULL, 0 };
+    size_t capacity = 0;
+    int line_number = 0;
+
+    if (file == NULL) return -1;
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        threshold_rule_t rule;
+        char *comment = strchr(line, '#');
+        char *text = line;
+
+        line_number++;
+        if (comment != NULL) *comment = '\0';
+        text += strspn(text, " \t\r\n");
+        if (*text == '\0') continue;
+
+        if (parse_rule(text, &rule) != 0) {
+            fprintf(stderr, "%s:%d: invalid threshold rule\n", path, line_number);
+            free(loaded.rules);
+            fclose(file);
+            return -1;
+        }
+        if (rule.scope == THRESHOLD_SCOPE_DEFAULT) {
+            loaded.defaults = rule.limits;
+            continue;
+        }
+        if (loaded.count == capacity) {
+            size_t new_capacity = capacity == 0 ? 16 : capacity * 2;
+            threshold_rule_t *rules = realloc(loaded.rules, new_capacity * sizeof(*rules));
+
+            if (rules == NULL) {
+                free(loaded.rules);
+                fclose(file);
+                return -1;
+            }
+            loaded.rules = rules;
+            capacity = new_capacity;
+        }
+        loaded.rules[loaded.count++] = rule;
+    }
+
+    fclose(file);
+    *thresholds = loaded;
+    return 0;
+}
+
+void thresholds_free(thresholds_t *thresholds)
+{
+    free(thresholds->rules);
+    thresholds->rules = NULL;
+    thresholds->count = 0;
+}
+
+/* Later lines override earlier ones for the same sensor or room. */
+static const threshold_t *find_rule(const thresholds_t *thresholds, int scope, uint16_t id)
+{
+    const threshold_t *found = NULL;
+
+    for (size_t index = 0; index < thresholds->count; index++) {
+        if (thresholds->rules[index].scope == scope && thresholds->rules[index].id == id) {
+            found = &thresholds->rules[index].limits;
+        }
+    }
+    return found;
+}
+
+threshold_t thresholds_for_sensor(const thresholds_t *thresholds, sensor_id_t sensor_id, uint16_t room_id)
+{
+    const threshold_t *limits = find_rule(thresholds, THRESHOLD_SCOPE_SENSOR, sensor_id);
+
+    if (limits == NULL) limits = find_rule(thresholds, THRESHOLD_SCOPE_ROOM, room_id);
+    return limits != NULL ? *limits : thresholds->defaults;
+}
+
+threshold_t thresholds_for_room(const thresholds_t *thresholds, uint16_t room_id)
+{
+    const threshold_t *limits = find_rule(thresholds, THRESHOLD_SCOPE_ROOM, room_id);
+
+    return limits != NULL ? *limits : thresholds->defaults;
+}
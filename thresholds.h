@@ -0,0 +1,72 @@
+/**
+ * \author Yongkai Zhang
+ */
+
+#ifndef _THRESHOLDS_H_
+#define _THRESHOLDS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "config.h"
+
+#define THRESHOLDS_FILE "thresholds.conf"   // default path, override with --thresholds
+
+enum {
+    THRESHOLD_SCOPE_DEFAULT,
+    THRESHOLD_SCOPE_ROOM,
+    THRESHOLD_SCOPE_SENSOR
+};
+
+/**
+ * Alert band of one sensor or room. An alert is raised outside [min_temp, max_temp]
+ * and cleared only once the average is back inside by 'hysteresis'.
+ */
+typedef struct {
+    double min_temp;
+    double max_temp;
+    double hysteresis;
+} threshold_t;
+
+typedef struct {
+    int scope;                  /**< THRESHOLD_SCOPE_* */
+    uint16_t id;                /**< room_id or sensor_id, unused for the default */
+    threshold_t limits;
+} threshold_rule_t;
+
+/**
+ * Parsed thresholds file
+ */
+typedef struct {
+    threshold_t defaults;       /**< 'default' line, else the compile-time limits */
+    threshold_rule_t *rules;
+    size_t count;
+} thresholds_t;
+
+/**
+ * Parses a thresholds file. One rule per line, '#' starts a comment:
+ *   default <min> <max> [hysteresis]
+ *   room <room_id> <min> <max> [hysteresis]
+ *   sensor <sensor_id> <min> <max> [hysteresis]
+ * \param path the file to read
+ * \param fallback limits used when the file has no 'default' line
+ * \param thresholds receives the rules; left untouched on error
+ * \return zero on success, -1 when the file cannot be read or a line is invalid (reported on stderr)
+ */
+int thresholds_load(const char *path, const threshold_t *fallback, thresholds_t *thresholds);
+
+/**
+ * Frees the rules of 'thresholds'
+ */
+void thresholds_free(thresholds_t *thresholds);
+
+/**
+ * \return the limits of a sensor: its own rule, else its room's rule, else the default
+ */
+threshold_t thresholds_for_sensor(const thresholds_t *thresholds, sensor_id_t sensor_id, uint16_t room_id);
+
+/**
+ * \return the limits of a room aggregate: the room's rule, else the default
+ */
+threshold_t thresholds_for_room(const thresholds_t *thresholds, uint16_t room_id);
+
+#endif /* _THRESHOLDS_H_ */
@@ -0,0 +1,636 @@
+/**
+ * \author Yongkai Zhang
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "tsarchive.h"
+
+#define TSARCHIVE_SENSOR_SPACE 65536
+#define TSARCHIVE_POINT_BITS_MAX 145    // 4 + 64 timestamp bits, 13 + 64 value bits
+
+static uint32_t fnv1a(const uint8_t *bytes, size_t size)
+{
+    uint32_t hash = 2166136261u;
+
+    for (size_t index = 0; index < size; index++) {
+        hash ^= bytes[index];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int64_t window_start(int64_t ts, int64_t seconds)
+{
+    int64_t offset = ts % seconds;
+
+    return ts - (offset < 0 ? offset + seconds : offset);
+}
+
+static int index_path(char *buffer, size_t size, const char *path)
+{
+    int length = snprintf(buffer, size, "%s%s", path, TSARCHIVE_INDEX_SUFFIX);
+
+    return length < 0 || (size_t)length >= size ? -1 : 0;
+}
+
+static int check_header(const tsarchive_header_t *header, const char *path)
+{
+    if (memcmp(header->magic, TSARCHIVE_MAGIC, sizeof(TSARCHIVE_MAGIC)) != 0 ||
+        header->version != TSARCHIVE_VERSION || header->block_size != sizeof(tsarchive_block_t) ||
+        header->block_seconds == 0 || header->data_bytes < sizeof(*header)) {
+        fprintf(stderr, "tsarchive: %s is not a version %d archive\n", path, TSARCHIVE_VERSION);
+        return -1;
+    }
+    return 0;
+}
+
+static bool valid_block(const tsarchive_block_t *block, uint64_t data_bytes)
+{
+    return block->count > 0 && block->payload_bytes > 0 && block->first_ts <= block->last_ts &&
+           block->offset >= sizeof(tsarchive_header_t) + sizeof(tsarchive_block_t) &&
+           block->offset <= data_bytes && block->payload_bytes <= data_bytes - block->offset;
+}
+
+/* Bits are written most significant first; the payload is zeroed beyond 'bits'. */
+static void put_bits(tsarchive_builder_t *builder, uint64_t value, unsigned int count)
+{
+    while (count > 0) {
+        unsigned int used = (unsigned int)(builder->bits % 8);
+        unsigned int take = count < 8 - used ? count : 8 - used;
+        uint8_t chunk = (uint8_t)((value >> (count - take)) & ((1u << take) - 1));
+
+        builder->payload[builder->bits / 8] |= (uint8_t)(chunk << (8 - used - take));
+        builder->bits += take;
+        count -= take;
+    }
+}
+
+static int get_bits(tsarchive_decoder_t *decoder, unsigned int count, uint64_t *value)
+{
+    uint64_t result = 0;
+
+    if (decoder->bit + count > (uint64_t)decoder->block->payload_bytes * 8) return -1;
+    while (count > 0) {
+        unsigned int used = (unsigned int)(decoder->bit % 8);
+        unsigned int take = count < 8 - used ? count : 8 - used;
+        uint8_t byte = decoder->payload[decoder->bit / 8];
+
+        result = (result << take) | ((uint64_t)(byte >> (8 - used - take)) & ((1u << take) - 1));
+        decoder->bit += take;
+        count -= take;
+    }
+    *value = result;
+    return 0;
+}
+
+/* Timestamp: '0' when the delta repeats, else a 2-4 bit prefix and the delta-of-delta. */
+static void encode_timestamp(tsarchive_builder_t *builder, int64_t ts)
+{
+    int64_t delta = ts - builder->prev_ts;
+    int64_t dod = delta - builder->prev_delta;
+
+    if (dod == 0) {
+        put_bits(builder, 0x0, 1);
+    } else if (dod >= -63 && dod <= 64) {
+        put_bits(builder, 0x2, 2);
+        put_bits(builder, (uint64_t)(dod + 63), 7);
+    } else if (dod >= -255 && dod <= 256) {
+        put_bits(builder, 0x6, 3);
+        put_bits(builder, (uint64_t)(dod + 255), 9);
+    } else if (dod >= -2047 && dod <= 2048) {
+        put_bits(builder, 0xE, 4);
+        put_bits(builder, (uint64_t)(dod + 2047), 12);
+    } else {
+        put_bits(builder, 0xF, 4);
+        put_bits(builder, (uint64_t)dod, 64);
+    }
+    builder->prev_ts = ts;
+    builder->prev_delta = delta;
+}
+
+/*
+ * Value: '0' when it repeats; '10' and the meaningful bits when the XOR fits the
+ * previous window; '11', 5 bits of leading zeros, 6 bits of length and the bits otherwise.
+ */
+static void encode_value(tsarchive_builder_t *builder, uint64_t value)
+{
+    uint64_t xor = value ^ builder->prev_value;
+    int leading;
+    int trailing;
+    int significant;
+
+    builder->prev_value = value;
+    if (xor == 0) {
+        put_bits(builder, 0x0, 1);
+        return;
+    }
+    leading = __builtin_clzll(xor);
+    trailing = __builtin_ctzll(xor);
+    if (leading > 31) leading = 31;
+    if (builder->prev_leading >= 0 && leading >= builder->prev_leading && trailing >= builder->prev_trailing) {
+        put_bits(builder, 0x2, 2);
+        put_bits(builder, xor >> builder->prev_trailing,
+                 (unsigned int)(64 - builder->prev_leading - builder->prev_trailing));
+        return;
+    }
+    significant = 64 - leading - trailing;
+    put_bits(builder, 0x3, 2);
+    put_bits(builder, (uint64_t)leading, 5);
+    put_bits(builder, (uint64_t)(significant & 63), 6);    // 64 is stored as 0
+    put_bits(builder, xor >> trailing, (unsigned int)significant);
+    builder->prev_leading = leading;
+    builder->prev_trailing = trailing;
+}
+
+static int decode_timestamp(tsarchive_decoder_t *decoder)
+{
+    static const unsigned int widths[] = { 7, 9, 12 };
+    static const int64_t biases[] = { 63, 255, 2047 };
+    uint64_t bits;
+    int ones = 0;
+    int64_t dod = 0;
+
+    while (ones < 4) {
+        if (get_bits(decoder, 1, &bits) != 0) return -1;
+        if (bits == 0) break;
+        ones++;
+    }
+    if (ones == 4) {
+        if (get_bits(decoder, 64, &bits) != 0) return -1;
+        dod = (int64_t)bits;
+    } else if (ones > 0) {
+        if (get_bits(decoder, widths[ones - 1], &bits) != 0) return -1;
+        dod = (int64_t)bits - biases[ones - 1];
+    }
+    decoder->delta += dod;
+    decoder->ts += decoder->delta;
+    return 0;
+}
+
+static int decode_value(tsarchive_decoder_t *decoder)
+{
+    uint64_t bits;
+    uint64_t leading;
+    uint64_t significant;
+
+    if (get_bits(decoder, 1, &bits) != 0) return -1;
+    if (bits == 0) return 0;
+    if (get_bits(decoder, 1, &bits) != 0) return -1;
+    if (bits == 1) {
+        if (get_bits(decoder, 5, &leading) != 0 || get_bits(decoder, 6, &significant) != 0) return -1;
+        if (significant == 0) significant = 64;
+        if (leading + significant > 64) return -1;
+        decoder->leading = (int)leading;
+        decoder->trailing = (int)(64 - leading - significant);
+    } else if (decoder->leading < 0) {
+        return -1;
+    }
+    if (get_bits(decoder, (unsigned int)(64 - decoder->leading - decoder->trailing), &bits) != 0) return -1;
+    decoder->value ^= bits << decoder->trailing;
+    return 0;
+}
+
+void tsarchive_decoder_init(tsarchive_decoder_t *decoder, const tsarchive_block_t *block, const uint8_t *payload)
+{
+    memset(decoder, 0, sizeof(*decoder));
+    decoder->block = block;
+    decoder->payload = payload;
+    decoder->ts = block->first_ts;
+    decoder->leading = -1;
+}
+
+int tsarchive_decoder_next(tsarchive_decoder_t *decoder, int64_t *ts, double *value)
+{
+    if (decoder->decoded >= decoder->block->count) return 0;
+    if (decoder->decoded == 0) {
+        if (get_bits(decoder, 64, &decoder->value) != 0) return -1;
+    } else if (decode_timestamp(decoder) != 0 || decode_value(decoder) != 0) {
+        return -1;
+    }
+    decoder->decoded++;
+    *ts = decoder->ts;
+    memcpy(value, &decoder->value, sizeof(*value));
+    return 1;
+}
+
+/* Makes room for one more point (TSARCHIVE_POINT_BITS_MAX bits) in the payload. */
+static int reserve_point(tsarchive_builder_t *builder)
+{
+    size_t needed = (size_t)((builder->bits + TSARCHIVE_POINT_BITS_MAX + 7) / 8);
+    size_t capacity = builder->capacity == 0 ? 256 : builder->capacity;
+    uint8_t *payload;
+
+    if (needed <= builder->capacity) return 0;
+    while (capacity < needed) capacity *= 2;
+    payload = realloc(builder->payload, capacity);
+    if (payload == NULL) return -1;
+    memset(payload + builder->capacity, 0, capacity - builder->capacity);
+    builder->payload = payload;
+    builder->capacity = capacity;
+    return 0;
+}
+
+static void start_block(tsarchive_builder_t *builder, const sensor_data_t *reading, uint32_t block_seconds)
+{
+    uint64_t value;
+
+    memcpy(&value, &reading->value, sizeof(value));
+    memset(&builder->block, 0, sizeof(builder->block));
+    builder->block.sensor_id = reading->sensor_id;
+    builder->block.room_id = reading->room_id;
+    builder->block.count = 1;
+    builder->block.first_ts = (int64_t)reading->timestamp;
+    builder->block.last_ts = (int64_t)reading->timestamp;
+    builder->block.min_value = reading->value;
+    builder->block.max_value = reading->value;
+    builder->window_end = window_start((int64_t)reading->timestamp, block_seconds) + (int64_t)block_seconds;
+    builder->prev_ts = (int64_t)reading->timestamp;
+    builder->prev_delta = 0;
+    builder->prev_value = value;
+    builder->prev_leading = -1;
+    builder->prev_trailing = 0;
+    put_bits(builder, value, 64);
+}
+
+/* Appends the block and its index entry, then empties the builder. */
+static int write_block(tsarchive_writer_t *writer, tsarchive_builder_t *builder)
+{
+    tsarchive_block_t *block = &builder->block;
+    size_t payload_bytes = (size_t)((builder->bits + 7) / 8);
+
+    if (block->count == 0) return 0;
+    block->payload_bytes = (uint32_t)payload_bytes;
+    block->checksum = fnv1a(builder->payload, payload_bytes);
+    block->offset = writer->data_end + sizeof(*block);
+    if (fwrite(block, sizeof(*block), 1, writer->data) != 1 ||
+        fwrite(builder->payload, 1, payload_bytes, writer->data) != payload_bytes ||
+        fwrite(block, sizeof(*block), 1, writer->index) != 1) {
+        return -1;
+    }
+    writer->data_end = block->offset + payload_bytes;
+    writer->index_end += sizeof(*block);
+    writer->blocks++;
+    writer->bytes += sizeof(*block) + payload_bytes;
+
+    memset(builder->payload, 0, payload_bytes);
+    builder->bits = 0;
+    block->count = 0;
+    return 0;
+}
+
+static int sync_file(FILE *file)
+{
+    return fflush(file) == 0 && fsync(fileno(file)) == 0 ? 0 : -1;
+}
+
+static int write_header(tsarchive_writer_t *writer)
+{
+    if (fseek(writer->data, 0, SEEK_SET) != 0 || fwrite(&writer->header, sizeof(writer->header), 1, writer->data) != 1 ||
+        sync_file(writer->data) != 0) {
+        return -1;
+    }
+    return fseek(writer->data, 0, SEEK_END);
+}
+
+/* Writes a fresh index file from the blocks found in the archive itself. */
+static int rebuild_index_file(tsarchive_writer_t *writer, const char *path, const char *idx_path)
+{
+    tsarchive_reader_t reader;
+    int rc = 0;
+
+    if (writer->index != NULL) fclose(writer->index);
+    writer->index = fopen(idx_path, "w+b");
+    if (writer->index == NULL || tsarchive_reader_open(&reader, path) != 0) return -1;
+    if (reader.block_count > 0 &&
+        fwrite(reader.blocks, sizeof(*reader.blocks), reader.block_count, writer->index) != reader.block_count) {
+        rc = -1;
+    }
+    writer->header.index_bytes = (uint64_t)reader.block_count * sizeof(*reader.blocks);
+    tsarchive_reader_close(&reader);
+    if (rc != 0 || sync_file(writer->index) != 0) return -1;
+    return write_header(writer);
+}
+
+int tsarchive_writer_open(tsarchive_writer_t *writer, const char *path, uint32_t block_seconds)
+{
+    char idx_path[TSARCHIVE_PATH_MAX];
+    struct stat info;
+
+    memset(writer, 0, sizeof(*writer));
+    if (index_path(idx_path, sizeof(idx_path), path) != 0) return -1;
+    writer->open = calloc(TSARCHIVE_SENSOR_SPACE, sizeof(*writer->open));
+    if (writer->open == NULL) return -1;
+
+    writer->data = fopen(path, "r+b");
+    if (writer->data == NULL && errno == ENOENT) {
+        /* New archive: header first, then an empty index. */
+        memcpy(writer->header.magic, TSARCHIVE_MAGIC, sizeof(TSARCHIVE_MAGIC));
+        writer->header.version = TSARCHIVE_VERSION;
+        writer->header.block_size = (uint16_t)sizeof(tsarchive_block_t);
+        writer->header.block_seconds = block_seconds == 0 ? TSARCHIVE_BLOCK_SECONDS : block_seconds;
+        writer->header.data_bytes = sizeof(writer->header);
+        writer->header.index_bytes = 0;
+        writer->data = fopen(path, "w+b");
+        writer->index = fopen(idx_path, "w+b");
+        if (writer->data == NULL || writer->index == NULL || sync_file(writer->index) != 0 ||
+            write_header(writer) != 0) {
+            goto open_error;
+        }
+    } else {
+        if (writer->data == NULL || fread(&writer->header, sizeof(writer->header), 1, writer->data) != 1 ||
+            check_header(&writer->header, path) != 0 || fstat(fileno(writer->data), &info) != 0 ||
+            (uint64_t)info.st_size < writer->header.data_bytes) {
+            goto open_error;
+        }
+        /* Cut off what an archive pass that never committed left behind. */
+        if (ftruncate(fileno(writer->data), (off_t)writer->header.data_bytes) != 0) goto open_error;
+        writer->index = fopen(idx_path, "r+b");
+        if (writer->index == NULL || fstat(fileno(writer->index), &info) != 0 ||
+            (uint64_t)info.st_size < writer->header.index_bytes) {
+            if (rebuild_index_file(writer, path, idx_path) != 0) goto open_error;
+        } else if (ftruncate(fileno(writer->index), (off_t)writer->header.index_bytes) != 0) {
+            goto open_error;
+        }
+    }
+    if (fseek(writer->data, 0, SEEK_END) != 0 || fseek(writer->index, 0, SEEK_END) != 0) goto open_error;
+    writer->data_end = writer->header.data_bytes;
+    writer->index_end = writer->header.index_bytes;
+    return 0;
+
+open_error:
+    if (errno != 0) perror(path);
+    tsarchive_writer_close(writer);
+    return -1;
+}
+
+int tsarchive_writer_append(tsarchive_writer_t *writer, const sensor_data_t *reading)
+{
+    tsarchive_builder_t *builder = writer->open[reading->sensor_id];
+    int64_t ts = (int64_t)reading->timestamp;
+    uint64_t value;
+
+    if (builder == NULL) {
+        builder = calloc(1, sizeof(*builder));
+        if (builder == NULL) return -1;
+        writer->open[reading->sensor_id] = builder;
+    }
+    if (builder->block.count > 0 &&
+        (ts < builder->prev_ts || ts >= builder->window_end || reading->room_id != builder->block.room_id ||
+         builder->block.count >= TSARCHIVE_BLOCK_POINTS)) {
+        if (write_block(writer, builder) != 0) return -1;
+    }
+    if (reserve_point(builder) != 0) return -1;
+
+    if (builder->block.count == 0) {
+        start_block(builder, reading, writer->header.block_seconds);
+    } else {
+        memcpy(&value, &reading->value, sizeof(value));
+        encode_timestamp(builder, ts);
+        encode_value(builder, value);
+        builder->block.count++;
+        builder->block.last_ts = ts;
+        if (reading->value < builder->block.min_value) builder->block.min_value = reading->value;
+        if (reading->value > builder->block.max_value) builder->block.max_value = reading->value;
+    }
+    writer->points++;
+    return 0;
+}
+
+int tsarchive_writer_commit(tsarchive_writer_t *writer)
+{
+    for (size_t sensor = 0; sensor < TSARCHIVE_SENSOR_SPACE; sensor++) {
+        if (writer->open[sensor] != NULL && write_block(writer, writer->open[sensor]) != 0) return -1;
+    }
+    /* Blocks and index entries reach the disk before the header that makes them visible. */
+    if (sync_file(writer->data) != 0 || sync_file(writer->index) != 0) return -1;
+    writer->header.data_bytes = writer->data_end;
+    writer->header.index_bytes = writer->index_end;
+    return write_header(writer);
+}
+
+void tsarchive_writer_close(tsarchive_writer_t *writer)
+{
+    if (writer->open != NULL) {
+        for (size_t sensor = 0; sensor < TSARCHIVE_SENSOR_SPACE; sensor++) {
+            if (writer->open[sensor] != NULL) free(writer->open[sensor]->payload);
+            free(writer->open[sensor]);
+        }
+        free(writer->open);
+    }
+    if (writer->data != NULL) fclose(writer->data);
+    if (writer->index != NULL) fclose(writer->index);
+    memset(writer, 0, sizeof(*writer));
+}
+
+static int compare_blocks(const void *left, const void *right)
+{
+    const tsarchive_block_t *a = left;
+    const tsarchive_block_t *b = right;
+
+    if (a->sensor_id != b->sensor_id) return a->sensor_id < b->sensor_id ? -1 : 1;
+    if (a->first_ts != b->first_ts) return a->first_ts < b->first_ts ? -1 : 1;
+    return a->offset < b->offset ? -1 : (a->offset > b->offset ? 1 : 0);
+}
+
+/* Reads the committed index entries; -1 when the file is missing, short or inconsistent. */
+static int load_index(tsarchive_reader_t *reader, const char *idx_path)
+{
+    FILE *index = fopen(idx_path, "rb");
+    size_t count = (size_t)(reader->header.index_bytes / sizeof(tsarchive_block_t));
+    int rc = 0;
+
+    if (index == NULL) return -1;
+    reader->blocks = malloc((count == 0 ? 1 : count) * sizeof(*reader->blocks));
+    if (reader->blocks == NULL || fread(reader->blocks, sizeof(*reader->blocks), count, index) != count) rc = -1;
+    fclose(index);
+    for (size_t entry = 0; entry < count && rc == 0; entry++) {
+        const tsarchive_block_t *block = &reader->blocks[entry];
+
+        if (!valid_block(block, reader->header.data_bytes) ||
+            memcmp(reader->map + block->offset - sizeof(*block), block, sizeof(*block)) != 0) {
+            rc = -1;
+        }
+    }
+    if (rc != 0) {
+        free(reader->blocks);
+        reader->blocks = NULL;
+        return -1;
+    }
+    reader->block_count = count;
+    return 0;
+}
+
+/* Walks the block headers of the archive itself. */
+static int scan_blocks(tsarchive_reader_t *reader)
+{
+    size_t capacity = 0;
+    uint64_t position = sizeof(tsarchive_header_t);
+
+    while (position + sizeof(tsarchive_block_t) <= reader->header.data_bytes) {
+        tsarchive_block_t block;
+
+        memcpy(&block, reader->map + position, sizeof(block));
+        if (!valid_block(&block, reader->header.data_bytes) || block.offset != position + sizeof(block)) break;
+        if (reader->block_count == capacity) {
+            size_t larger = capacity == 0 ? 1024 : capacity * 2;
+            tsarchive_block_t *blocks = realloc(reader->blocks, larger * sizeof(*blocks));
+
+            if (blocks == NULL) return -1;
+            reader->blocks = blocks;
+            capacity = larger;
+        }
+        reader->blocks[reader->block_count++] = block;
+        position = block.offset + block.payload_bytes;
+    }
+    return 0;
+}
+
+int tsarchive_reader_open(tsarchive_reader_t *reader, const char *path)
+{
+    char idx_path[TSARCHIVE_PATH_MAX];
+    struct stat info;
+    void *map;
+    int fd;
+
+    memset(reader, 0, sizeof(*reader));
+    if (index_path(idx_path, sizeof(idx_path), path) != 0) return -1;
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        perror(path);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    if ((size_t)info.st_size < sizeof(tsarchive_header_t)) {
+        fprintf(stderr, "tsarchive: %s is not a version %d archive\n", path, TSARCHIVE_VERSION);
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror(path);
+        return -1;
+    }
+    reader->map = map;
+    reader->size = (size_t)info.st_size;
+    memcpy(&reader->header, map, sizeof(reader->header));
+    if (check_header(&reader->header, path) != 0 || reader->header.data_bytes > reader->size) {
+        tsarchive_reader_close(reader);
+        return -1;
+    }
+    /* Blocks beyond data_bytes were never committed and are not read. */
+    if (load_index(reader, idx_path) != 0 && scan_blocks(reader) != 0) {
+        tsarchive_reader_close(reader);
+        return -1;
+    }
+    if (reader->block_count > 1) qsort(reader->blocks, reader->block_count, sizeof(*reader->blocks), compare_blocks);
+    return 0;
+}
+
+void tsarchive_reader_close(tsarchive_reader_t *reader)
+{
+    if (reader->map != NULL) munmap((void *)reader->map, reader->size);
+    free(reader->blocks);
+    memset(reader, 0, sizeof(*reader));
+}
+
+/* First block at or after (sensor_id, ts) in index order. */
+static size_t lower_bound(const tsarchive_reader_t *reader, int sensor_id, int64_t ts)
+{
+    size_t low = 0;
+    size_t high = reader->block_count;
+
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        const tsarchive_block_t *block = &reader->blocks[middle];
+
+        if (block->sensor_id < sensor_id || (block->sensor_id == sensor_id && block->first_ts < ts)) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+void tsarchive_scan_open(tsarchive_scan_t *scan, const tsarchive_reader_t *reader, int sensor_id, int64_t from,
+                         int64_t to)
+{
+    int64_t span = (int64_t)reader->header.block_seconds;
+
+    memset(scan, 0, sizeof(*scan));
+    scan->reader = reader;
+    scan->sensor_id = sensor_id;
+    scan->from = from;
+    scan->to = to;
+    scan->end_block = reader->block_count;
+    if (sensor_id < 0) return;
+
+    /* A block ends less than block_seconds after it starts, so earlier blocks end before 'from'. */
+    scan->next_block = lower_bound(reader, sensor_id, from > INT64_MIN + span ? from - span + 1 : INT64_MIN);
+    scan->end_block = to < INT64_MAX ? lower_bound(reader, sensor_id, to + 1) : lower_bound(reader, sensor_id + 1,
+                                                                                            INT64_MIN);
+}
+
+/* Moves to the next block that overlaps [from, to]; false when there is none. */
+static int next_block(tsarchive_scan_t *scan)
+{
+    const tsarchive_reader_t *reader = scan->reader;
+
+    while (scan->next_block < scan->end_block) {
+        const tsarchive_block_t *block = &reader->blocks[scan->next_block++];
+        const uint8_t *payload = reader->map + block->offset;
+
+        if (block->last_ts < scan->from || block->first_ts > scan->to) continue;
+        if (fnv1a(payload, block->payload_bytes) != block->checksum) {
+            fprintf(stderr, "tsarchive: corrupt block of sensor %u at offset %llu\n", (unsigned)block->sensor_id,
+                    (unsigned long long)block->offset);
+            return -1;
+        }
+        tsarchive_decoder_init(&scan->decoder, block, payload);
+        scan->in_block = true;
+        scan->blocks_read++;
+        return 1;
+    }
+    return 0;
+}
+
+ssize_t tsarchive_scan_next(tsarchive_scan_t *scan, sensor_data_t *rows, size_t max_rows)
+{
+    size_t count = 0;
+
+    while (count < max_rows) {
+        sensor_data_t *row;
+        int64_t ts;
+        double value;
+        int rc;
+
+        if (!scan->in_block) {
+            rc = next_block(scan);
+            if (rc < 0) return -1;
+            if (rc == 0) break;
+        }
+        rc = tsarchive_decoder_next(&scan->decoder, &ts, &value);
+        if (rc < 0) return -1;
+        if (rc == 0 || ts > scan->to) {
+            scan->in_block = false;
+            continue;
+        }
+        if (ts < scan->from) continue;
+        row = &rows[count++];
+        memset(row, 0, sizeof(*row));
+        row->sensor_id = scan->decoder.block->sensor_id;
+        row->room_id = scan->decoder.block->room_id;
+        row->value = value;
+        row->timestamp = (sensor_ts_t)ts;
+    }
+    return (ssize_t)count;
+}
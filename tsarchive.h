@@ -0,0 +1,197 @@
+/**
+ * \author Yongkai Zhang
+ */
+
+#ifndef _TSARCHIVE_H_
+#define _TSARCHIVE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include "config.h"
+
+#define TSARCHIVE_MAGIC "GWTSARC"       // 7 chars + NUL fill the 8-byte magic
+#define TSARCHIVE_VERSION 1
+#define TSARCHIVE_INDEX_SUFFIX ".idx"   // block index file, next to the archive
+#define TSARCHIVE_BLOCK_SECONDS 7200    // a block never spans an aligned window of this length
+#define TSARCHIVE_BLOCK_POINTS 4096     // points per block at most
+#define TSARCHIVE_PATH_MAX 512
+
+/**
+ * Start of the archive file. Everything after 'data_bytes' (and after 'index_bytes'
+ * in the index file) was written by an archive pass that never committed, and is
+ * cut off by the next writer.
+ */
+typedef struct {
+    char magic[8];
+    uint16_t version;
+    uint16_t block_size;        /**< sizeof(tsarchive_block_t) */
+    uint32_t block_seconds;
+    uint64_t data_bytes;        /**< committed length of the archive file */
+    uint64_t index_bytes;       /**< committed length of the index file */
+} tsarchive_header_t;
+
+/**
+ * A closed block: the points of one sensor (and room) in time order, within one
+ * aligned TSARCHIVE_BLOCK_SECONDS window. The same record precedes the payload in
+ * the archive and makes up the block index.
+ * Payload: the first value as 64 raw bits, then for every later point the
+ * delta-of-delta of its timestamp and its value XORed with the previous one
+ * (Gorilla encoding). The first timestamp is 'first_ts'.
+ */
+typedef struct {
+    uint16_t sensor_id;
+    uint16_t room_id;
+    uint32_t count;             /**< points in the block */
+    uint32_t payload_bytes;
+    uint32_t checksum;          /**< FNV-1a of the payload */
+    int64_t first_ts;
+    int64_t last_ts;
+    double min_value;
+    double max_value;
+    uint64_t offset;            /**< file offset of the payload */
+} tsarchive_block_t;
+
+_Static_assert(sizeof(tsarchive_block_t) == 56, "blocks are written as they are laid out in memory");
+
+/**
+ * Block being filled for one sensor
+ */
+typedef struct {
+    tsarchive_block_t block;
+    uint8_t *payload;
+    size_t capacity;            /**< bytes allocated for 'payload' */
+    uint64_t bits;              /**< bits written to 'payload' */
+    int64_t window_end;         /**< the block closes at this timestamp */
+    int64_t prev_ts;
+    int64_t prev_delta;
+    uint64_t prev_value;        /**< bits of the previous value */
+    int prev_leading;           /**< leading zeros of the last XOR window, -1 before the first one */
+    int prev_trailing;
+} tsarchive_builder_t;
+
+/**
+ * Appends blocks to an archive and its index. Points become durable at
+ * tsarchive_writer_commit(); blocks written after the last commit are discarded
+ * when the archive is opened again.
+ */
+typedef struct {
+    FILE *data;
+    FILE *index;
+    tsarchive_header_t header;  /**< as last committed */
+    uint64_t data_end;          /**< bytes written to the archive file, committed or not */
+    uint64_t index_end;         /**< bytes written to the index file, committed or not */
+    tsarchive_builder_t **open; /**< open block per sensor id, allocated on first use */
+    unsigned long long points;  /**< points appended since the writer was opened */
+    unsigned long long blocks;  /**< blocks written since the writer was opened */
+    unsigned long long bytes;   /**< archive bytes written since the writer was opened */
+} tsarchive_writer_t;
+
+/**
+ * Read-only view of an archive: the file is mapped and the block index is kept
+ * in memory, sorted by sensor and time
+ */
+typedef struct {
+    const uint8_t *map;
+    size_t size;
+    tsarchive_header_t header;
+    tsarchive_block_t *blocks;
+    size_t block_count;
+} tsarchive_reader_t;
+
+/**
+ * Streaming decoder of one block; holds no copy of the payload
+ */
+typedef struct {
+    const tsarchive_block_t *block;
+    const uint8_t *payload;
+    uint64_t bit;               /**< next bit to read */
+    uint32_t decoded;           /**< points returned so far */
+    int64_t ts;
+    int64_t delta;
+    uint64_t value;
+    int leading;
+    int trailing;
+} tsarchive_decoder_t;
+
+/**
+ * A time-range scan over the blocks of one sensor, or of every sensor
+ */
+typedef struct {
+    const tsarchive_reader_t *reader;
+    int sensor_id;              /**< -1 = every sensor */
+    int64_t from;
+    int64_t to;
+    size_t next_block;
+    size_t end_block;
+    bool in_block;
+    tsarchive_decoder_t decoder;
+    unsigned long long blocks_read;
+} tsarchive_scan_t;
+
+/**
+ * Opens 'path' for appending, creating it (and its index) when it does not exist
+ * \param block_seconds window of a block for a new archive (an existing archive keeps
+ * its own), 0 = TSARCHIVE_BLOCK_SECONDS
+ * \return zero on success, -1 if the file cannot be opened or is not an archive
+ */
+int tsarchive_writer_open(tsarchive_writer_t *writer, const char *path, uint32_t block_seconds);
+
+/**
+ * Adds one point (sensor_id, room_id, timestamp, value; seq is not kept). A block
+ * is closed and written when the point leaves its time window, goes back in time,
+ * changes room, or the block is full.
+ * \return zero on success, -1 on allocation or write failure
+ */
+int tsarchive_writer_append(tsarchive_writer_t *writer, const sensor_data_t *reading);
+
+/**
+ * Closes every open block and makes everything written so far durable (fsync)
+ * \return zero on success, -1 on write failure
+ */
+int tsarchive_writer_commit(tsarchive_writer_t *writer);
+
+/**
+ * Closes the archive without committing: points appended since the last commit
+ * are dropped
+ */
+void tsarchive_writer_close(tsarchive_writer_t *writer);
+
+/**
+ * Maps the committed part of 'path' and loads its block index, rebuilding the
+ * index from the archive itself when the index file is missing or short
+ * \return zero on success, -1 if the file cannot be read or is not an archive
+ */
+int tsarchive_reader_open(tsarchive_reader_t *reader, const char *path);
+
+void tsarchive_reader_close(tsarchive_reader_t *reader);
+
+/**
+ * \param block a block of an archive
+ * \param payload its payload_bytes bytes
+ */
+void tsarchive_decoder_init(tsarchive_decoder_t *decoder, const tsarchive_block_t *block, const uint8_t *payload);
+
+/**
+ * Decodes the next point of the block
+ * \return 1 for a point, 0 at the end of the block, -1 if the payload is corrupt
+ */
+int tsarchive_decoder_next(tsarchive_decoder_t *decoder, int64_t *ts, double *value);
+
+/**
+ * Starts a scan of the points with a timestamp in [from, to]; only blocks whose
+ * time range overlaps it are decoded. Points come by sensor, then in time order.
+ * \param sensor_id the sensor to read, -1 for every sensor
+ */
+void tsarchive_scan_open(tsarchive_scan_t *scan, const tsarchive_reader_t *reader, int sensor_id, int64_t from,
+                         int64_t to);
+
+/**
+ * Fetches up to 'max_rows' points (seq is 0)
+ * \return the number of rows stored, 0 at the end, -1 if a block is corrupt
+ */
+ssize_t tsarchive_scan_next(tsarchive_scan_t *scan, sensor_data_t *rows, size_t max_rows);
+
+#endif /* _TSARCHIVE_H_ */